@@ -0,0 +1,395 @@
+/*
+ * churn.c - steady-state churn benchmark
+ *
+ * The traces run for a few thousand requests, so they never show what a
+ * long-running server does to a heap: the live set stays the same size
+ * for hours while objects keep dying and being replaced, and the heap
+ * grows anyway if the holes they leave cannot be reused. This benchmark
+ * runs that in simulated time. Every simulated millisecond the objects
+ * whose lifetime is over are freed, and new objects are allocated until
+ * the live set is back at its target size. Sizes and lifetimes are drawn
+ * from configurable distributions.
+ *
+ * At every sample interval it prints a CSV row with the heap size, the
+ * live bytes, the RSS of the process, the utilization, the fragmentation
+ * of the free space and the length of every free list, and the rate of
+ * operations since the last row. At the end it reports how much the heap
+ * grew over the second half of the run, which should be nothing.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+
+#include "mm.h"
+#include "memlib.h"
+
+/**********************
+ * Constants and macros
+ **********************/
+#define DEFAULT_LIVE       (8 << 20)    /* target live bytes */
+#define DEFAULT_SIZES      "log:16:4096"
+#define DEFAULT_LIFETIMES  "exp:10000"
+#define DEFAULT_SECONDS    3600         /* simulated seconds */
+#define DEFAULT_INTERVAL   60           /* simulated seconds between rows */
+#define TICKS_PER_SEC      1000         /* a tick is a simulated ms */
+
+/* Size and lifetime distributions */
+typedef enum { UNIFORM, LOG_UNIFORM, EXPONENTIAL, PARETO, FIXED } dist_kind_t;
+
+typedef struct {
+    dist_kind_t kind;
+    double a, b;        /* min and max, mean, min and alpha, or value */
+} dist_t;
+
+/* A live object, in a min-heap ordered by the tick it dies at */
+typedef struct {
+    long death;
+    char *ptr;
+    size_t size;
+} object_t;
+
+/* mm.c prints debug output when this is set */
+int verbose = 0;
+
+/* Live objects */
+static object_t *objects;
+static size_t num_objects, max_objects;
+
+/* Random number state, xorshift64* */
+static unsigned long long rng_state = 88172645463325252ULL;
+
+/*********************
+ * Function prototypes
+ *********************/
+static int parse_dist(const char *spec, dist_t *dist);
+static double draw(const dist_t *dist);
+static double uniform(void);
+static void push(long death, char *ptr, size_t size);
+static void pop(void);
+static void print_header(void);
+static void print_row(double secs, long ops, double kops, size_t live);
+static long rss_kb(void);
+static double now(void);
+static void usage(void);
+static void app_error(char *msg);
+
+/**************
+ * Main routine
+ **************/
+int main(int argc, char **argv)
+{
+    size_t target = DEFAULT_LIVE;
+    char *sizes = DEFAULT_SIZES;
+    char *lifetimes = DEFAULT_LIFETIMES;
+    long seconds = DEFAULT_SECONDS;
+    long interval = DEFAULT_INTERVAL;
+    char *fit = NULL;
+    char *order = NULL;
+    dist_t size_dist, life_dist;
+    size_t live = 0, size, half_heap = 0, peak_heap = 0;
+    long tick, ticks, ops = 0, last_ops = 0;
+    double start, last, t;
+    char *p;
+    int c;
+
+    while ((c = getopt(argc, argv, "l:s:L:T:i:p:O:S:h")) != EOF) {
+        switch (c) {
+            case 'l': /* Target live bytes */
+                target = strtoul(optarg, NULL, 0);
+                break;
+            case 's': /* Size distribution */
+                sizes = optarg;
+                break;
+            case 'L': /* Lifetime distribution */
+                lifetimes = optarg;
+                break;
+            case 'T': /* Simulated seconds */
+                seconds = atol(optarg);
+                break;
+            case 'i': /* Sample interval */
+                interval = atol(optarg);
+                break;
+            case 'p': /* Fit policy */
+                fit = optarg;
+                break;
+            case 'O': /* Free list order */
+                order = optarg;
+                break;
+            case 'S': /* Random seed */
+                rng_state = strtoull(optarg, NULL, 0) | 1;
+                break;
+            case 'h': /* Print this message */
+                usage();
+                exit(0);
+            default:
+                usage();
+                exit(1);
+        }
+    }
+    if (target == 0 || seconds <= 0 || interval <= 0 ||
+            parse_dist(sizes, &size_dist) < 0 ||
+            parse_dist(lifetimes, &life_dist) < 0 ||
+            (fit != NULL && mm_set_fit_policy(fit) < 0) ||
+            (order != NULL && mm_set_order_policy(order) < 0)) {
+        usage();
+        exit(1);
+    }
+
+    mem_init();
+    if (mm_init() < 0)
+        app_error("mm_init failed");
+
+    fprintf(stderr, "live %lu bytes, sizes %s, lifetimes %s ms, %ld s, %s fit, %s order\n",
+            (unsigned long)target, sizes, lifetimes, seconds,
+            fit ? fit : "default", order ? order : "default");
+    print_header();
+
+    ticks = seconds * TICKS_PER_SEC;
+    start = last = now();
+    for (tick = 0; tick <= ticks; tick++) {
+        /* free what died by now */
+        while (num_objects > 0 && objects[0].death <= tick) {
+            mm_free(objects[0].ptr);
+            live -= objects[0].size;
+            pop();
+            ops++;
+        }
+
+        /* and refill the live set */
+        while (live < target) {
+            size = (size_t)draw(&size_dist);
+            if (size == 0)
+                size = 1;
+            if ((p = mm_malloc(size)) == NULL)
+                app_error("mm_malloc failed");
+            /* touch the payload, so that RSS follows the heap */
+            memset(p, 0, size);
+            push(tick + 1 + (long)draw(&life_dist), p, size);
+            live += size;
+            ops++;
+        }
+
+        if (mem_heapsize() > peak_heap)
+            peak_heap = mem_heapsize();
+        if (tick == ticks / 2)
+            half_heap = mem_heapsize();
+
+        if (tick % (interval * TICKS_PER_SEC) == 0 || tick == ticks) {
+            t = now();
+            print_row((double)tick / TICKS_PER_SEC, ops,
+                    t > last ? (ops - last_ops) / (t - last) / 1e3 : 0, live);
+            last = t;
+            last_ops = ops;
+        }
+    }
+
+    fprintf(stderr, "%ld ops in %.1f s, heap %.0f KB at half time, %.0f KB at the end "
+            "(%+.1f%%), peak %.0f KB\n", ops, now() - start, half_heap / 1024.0,
+            mem_heapsize() / 1024.0,
+            100.0 * ((double)mem_heapsize() - half_heap) / half_heap,
+            peak_heap / 1024.0);
+
+    free(objects);
+    mem_deinit();
+    exit(0);
+}
+
+/*
+ * parse_dist - Parse a distribution, one of uniform:MIN:MAX,
+ *     log:MIN:MAX, exp:MEAN, pareto:MIN:ALPHA or fixed:VALUE
+ */
+static int parse_dist(const char *spec, dist_t *dist)
+{
+    char name[16];
+    int n;
+
+    dist->b = 0;
+    n = sscanf(spec, "%15[a-z]:%lf:%lf", name, &dist->a, &dist->b);
+    if (n == 3 && !strcmp(name, "uniform") && dist->a <= dist->b)
+        dist->kind = UNIFORM;
+    else if (n == 3 && !strcmp(name, "log") && dist->a >= 1 && dist->a <= dist->b)
+        dist->kind = LOG_UNIFORM;
+    else if (n == 2 && !strcmp(name, "exp") && dist->a > 0)
+        dist->kind = EXPONENTIAL;
+    else if (n == 3 && !strcmp(name, "pareto") && dist->a > 0 && dist->b > 0)
+        dist->kind = PARETO;
+    else if (n == 2 && !strcmp(name, "fixed") && dist->a >= 0)
+        dist->kind = FIXED;
+    else
+        return -1;
+    return 0;
+}
+
+/*
+ * draw - Draw a value from `dist`
+ */
+static double draw(const dist_t *dist)
+{
+    switch (dist->kind) {
+        case UNIFORM:
+            return dist->a + uniform() * (dist->b - dist->a + 1);
+        case LOG_UNIFORM:
+            return exp(log(dist->a) + uniform() * (log(dist->b + 1) - log(dist->a)));
+        case EXPONENTIAL:
+            return -dist->a * log(1 - uniform());
+        case PARETO:
+            return dist->a / pow(1 - uniform(), 1 / dist->b);
+        default:
+            return dist->a;
+    }
+}
+
+/*
+ * uniform - Uniform random number in [0, 1)
+ */
+static double uniform(void)
+{
+    rng_state ^= rng_state >> 12;
+    rng_state ^= rng_state << 25;
+    rng_state ^= rng_state >> 27;
+    return ((rng_state * 2685821657736338717ULL) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+/*
+ * push - Add a live object to the heap of objects
+ */
+static void push(long death, char *ptr, size_t size)
+{
+    size_t i, parent;
+
+    if (num_objects == max_objects) {
+        max_objects = max_objects ? 2 * max_objects : 1024;
+        if ((objects = realloc(objects, max_objects * sizeof(object_t))) == NULL)
+            app_error("realloc failed in push");
+    }
+
+    /* sift up */
+    for (i = num_objects++; i > 0; i = parent) {
+        parent = (i - 1) / 2;
+        if (objects[parent].death <= death)
+            break;
+        objects[i] = objects[parent];
+    }
+    objects[i].death = death;
+    objects[i].ptr = ptr;
+    objects[i].size = size;
+}
+
+/*
+ * pop - Remove the object that dies first from the heap of objects
+ */
+static void pop(void)
+{
+    object_t last = objects[--num_objects];
+    size_t i = 0, child;
+
+    /* sift down */
+    while ((child = 2 * i + 1) < num_objects) {
+        if (child + 1 < num_objects && objects[child + 1].death < objects[child].death)
+            child++;
+        if (last.death <= objects[child].death)
+            break;
+        objects[i] = objects[child];
+        i = child;
+    }
+    objects[i] = last;
+}
+
+/*
+ * print_header - Print the CSV header
+ */
+static void print_header(void)
+{
+    int i;
+
+    printf("time_s,ops,kops_per_s,live_kb,heap_kb,rss_kb,util,frag");
+    for (i = 0; i < MM_STATS_CLASSES; i++)
+        printf(",free%d", i);
+    printf("\n");
+}
+
+/*
+ * print_row - Print a CSV row. frag is the share of the free bytes
+ *     outside the largest free block, 0 when the free space is one block
+ */
+static void print_row(double secs, long ops, double kops, size_t live)
+{
+    mm_stats_t stats;
+    int i;
+
+    mm_stats(&stats);
+    printf("%.0f,%ld,%.1f,%.1f,%.1f,%ld,%.3f,%.3f", secs, ops, kops,
+            live / 1024.0, stats.heap_bytes / 1024.0, rss_kb(),
+            stats.heap_bytes ? (double)live / stats.heap_bytes : 0,
+            stats.free_bytes ? 1 - (double)stats.largest_free / stats.free_bytes : 0);
+    for (i = 0; i < MM_STATS_CLASSES; i++)
+        printf(",%lu", (unsigned long)stats.free_blocks[i]);
+    printf("\n");
+    fflush(stdout);
+}
+
+/*
+ * rss_kb - Resident set size of the process in KB, or -1 when
+ *     /proc/self/statm cannot be read
+ */
+static long rss_kb(void)
+{
+    FILE *fp;
+    long pages, resident;
+
+    if ((fp = fopen("/proc/self/statm", "r")) == NULL)
+        return -1;
+    if (fscanf(fp, "%ld %ld", &pages, &resident) != 2)
+        resident = -1;
+    fclose(fp);
+
+    return resident < 0 ? -1 : resident * (long)(sysconf(_SC_PAGESIZE) / 1024);
+}
+
+/*
+ * now - Wall clock time in seconds
+ */
+static double now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + 1e-9 * ts.tv_nsec;
+}
+
+/*
+ * usage - Explain the command line arguments
+ */
+static void usage(void)
+{
+    fprintf(stderr, "Usage: churn [-h] [-l <live>] [-s <dist>] [-L <dist>] [-T <secs>] "
+            "[-i <secs>] [-p <fit>] [-O <order>] [-S <seed>]\n");
+    fprintf(stderr, "Options\n");
+    fprintf(stderr, "\t-h            Print this message.\n");
+    fprintf(stderr, "\t-i <secs>     Simulated seconds between rows (default %d).\n",
+            DEFAULT_INTERVAL);
+    fprintf(stderr, "\t-l <live>     Target live bytes (default %d).\n", DEFAULT_LIVE);
+    fprintf(stderr, "\t-L <dist>     Lifetime distribution in ms (default %s).\n",
+            DEFAULT_LIFETIMES);
+    fprintf(stderr, "\t-O <order>    mm free list order, as for mdriver -O.\n");
+    fprintf(stderr, "\t-p <fit>      mm fit policy, as for mdriver -p.\n");
+    fprintf(stderr, "\t-s <dist>     Size distribution in bytes (default %s).\n",
+            DEFAULT_SIZES);
+    fprintf(stderr, "\t-S <seed>     Random seed.\n");
+    fprintf(stderr, "\t-T <secs>     Simulated seconds to run (default %d).\n",
+            DEFAULT_SECONDS);
+    fprintf(stderr, "\tDistributions are uniform:MIN:MAX, log:MIN:MAX, exp:MEAN,\n");
+    fprintf(stderr, "\tpareto:MIN:ALPHA and fixed:VALUE.\n");
+}
+
+/*
+ * app_error - Report an application error and terminate
+ */
+static void app_error(char *msg)
+{
+    printf("%s\n", msg);
+    exit(1);
+}
@@ -1,167 +1,189 @@
 /* 
- * clock.c - Routines for using the cycle counters on x86, 
- *           Alpha, and Sparc boxes.
+ * clock.c - Routines for using the cycle counter on x86 boxes, and
+ *           the raw monotonic clock elsewhere.
  * 
  * Copyright (c) 2002, R. Bryant and D. O'Hallaron, All rights reserved.
  * May not be used, modified, or copied without permission.
  */
 
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
+#include <sched.h>
+#include <time.h>
 #include <sys/times.h>
 #include "clock.h"
 
+/* Calibration time of mhz(), in seconds */
+#define CALIBRATE_SECS 0.1
+
+
+/* Read CLOCK_MONOTONIC_RAW in ns. Unlike CLOCK_MONOTONIC, NTP does not slew it */
+static unsigned long long raw_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC_RAW, &ts);
+    return (unsigned long long) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
 
 /******************************************************* 
  * Machine dependent functions 
  *
- * Note: the constants __i386__ and  __alpha
+ * Note: the constants __i386__ and __x86_64__
  * are set by GCC when it calls the C preprocessor
  * You can verify this for yourself using gcc -v.
  *******************************************************/
 
-#if defined(__i386__)  
+#if defined(__i386__) || defined(__x86_64__)
 /*******************************************************
- * Pentium versions of start_counter() and get_counter()
+ * x86 time stamp counter
+ *
+ * rdtscp waits for all earlier instructions to finish before it reads
+ * the counter, and the lfence after it keeps later instructions from
+ * starting before. The start of a measurement is read with
+ * lfence; rdtsc; lfence, so that neither the code before nor the code
+ * being measured is reordered across it. Without rdtscp, the end is
+ * read the same way.
+ *
+ * The counter is only used when it is invariant: it then ticks at a
+ * constant rate in every P-, C- and T-state, and mhz() calibrates that
+ * rate against CLOCK_MONOTONIC_RAW. An older counter follows the core
+ * frequency, and CLOCK_MONOTONIC_RAW itself is used instead.
  *******************************************************/
+#include <cpuid.h>
 
+#define HAVE_TSC 1
 
-/* $begin x86cyclecounter */
-/* Initialize the cycle counter */
-static unsigned cyc_hi = 0;
-static unsigned cyc_lo = 0;
+static int has_rdtscp;
 
-
-/* Set *hi and *lo to the high and low order bits  of the cycle counter.  
-   Implementation requires assembly code to use the rdtsc instruction. */
-void access_counter(unsigned *hi, unsigned *lo)
+/* Is the time stamp counter invariant? also looks for rdtscp */
+static int tsc_invariant(void)
 {
-    asm("rdtsc; movl %%edx,%0; movl %%eax,%1"   /* Read cycle counter */
-	: "=r" (*hi), "=r" (*lo)                /* and move results to */
-	: /* No input */                        /* the two outputs */
-	: "%edx", "%eax");
+    unsigned eax, ebx, ecx, edx;
+
+    if (__get_cpuid(0x80000001, &eax, &ebx, &ecx, &edx))
+	has_rdtscp = (edx >> 27) & 1;
+    return __get_cpuid(0x80000007, &eax, &ebx, &ecx, &edx) && ((edx >> 8) & 1);
 }
 
-/* Record the current value of the cycle counter. */
-void start_counter()
+/* $begin x86cyclecounter */
+/* Read the counter at the start of a measurement */
+static inline unsigned long long tsc_begin(void)
 {
-    access_counter(&cyc_hi, &cyc_lo);
+    unsigned hi, lo;
+
+    asm volatile("lfence; rdtsc; lfence" : "=a" (lo), "=d" (hi) : : "memory");
+    return ((unsigned long long) hi << 32) | lo;
 }
 
-/* Return the number of cycles since the last call to start_counter. */
-double get_counter()
+/* Read the counter at the end of a measurement */
+static inline unsigned long long tsc_end(void)
 {
-    unsigned ncyc_hi, ncyc_lo;
-    unsigned hi, lo, borrow;
-    double result;
+    unsigned hi, lo, aux;
 
-    /* Get cycle counter */
-    access_counter(&ncyc_hi, &ncyc_lo);
-
-    /* Do double precision subtraction */
-    lo = ncyc_lo - cyc_lo;
-    borrow = lo > ncyc_lo;
-    hi = ncyc_hi - cyc_hi - borrow;
-    result = (double) hi * (1 << 30) * 4 + lo;
-    if (result < 0) {
-	fprintf(stderr, "Error: counter returns neg value: %.0f\n", result);
-    }
-    return result;
+    if (has_rdtscp)
+	asm volatile("rdtscp; lfence" : "=a" (lo), "=d" (hi), "=c" (aux) : : "memory");
+    else
+	asm volatile("lfence; rdtsc; lfence" : "=a" (lo), "=d" (hi) : : "memory");
+    return ((unsigned long long) hi << 32) | lo;
 }
 /* $end x86cyclecounter */
 
-#elif defined(__alpha)
-
-/****************************************************
- * Alpha versions of start_counter() and get_counter()
- ***************************************************/
-
-/* Initialize the cycle counter */
-static unsigned cyc_hi = 0;
-static unsigned cyc_lo = 0;
-
-
-/* Use Alpha cycle timer to compute cycles.  Then use
-   measured clock speed to compute seconds 
-*/
-
-/*
- * counterRoutine is an array of Alpha instructions to access 
- * the Alpha's processor cycle counter. It uses the rpcc 
- * instruction to access the counter. This 64 bit register is 
- * divided into two parts. The lower 32 bits are the cycles 
- * used by the current process. The upper 32 bits are wall 
- * clock cycles. These instructions read the counter, and 
- * convert the lower 32 bits into an unsigned int - this is the 
- * user space counter value.
- * NOTE: The counter has a very limited time span. With a 
- * 450MhZ clock the counter can time things for about 9 
- * seconds. */
-static unsigned int counterRoutine[] =
-{
-    0x601fc000u,
-    0x401f0000u,
-    0x6bfa8001u
-};
+#else
 
-/* Cast the above instructions into a function. */
-static unsigned int (*counter)(void)= (void *)counterRoutine;
+/****************************************************************
+ * All the other platforms. Their cycle counters are not readable
+ * from user programs everywhere, so CLOCK_MONOTONIC_RAW is used,
+ * and a "cycle" is a ns.
+ ***************************************************************/
+#define HAVE_TSC 0
+#endif
 
+/* 1 when the counter is the TSC, 0 when it is CLOCK_MONOTONIC_RAW, -1 until chosen */
+static int use_tsc = -1;
 
-void start_counter()
+static unsigned long long cyc_start = 0;
+
+static void select_counter(void)
 {
-    /* Get cycle counter */
-    cyc_hi = 0;
-    cyc_lo = counter();
+#if HAVE_TSC
+    use_tsc = tsc_invariant();
+#else
+    use_tsc = 0;
+#endif
 }
 
-double get_counter()
+static inline unsigned long long counter_begin(void)
 {
-    unsigned ncyc_hi, ncyc_lo;
-    unsigned hi, lo, borrow;
-    double result;
-    ncyc_lo = counter();
-    ncyc_hi = 0;
-    lo = ncyc_lo - cyc_lo;
-    borrow = lo > ncyc_lo;
-    hi = ncyc_hi - cyc_hi - borrow;
-    result = (double) hi * (1 << 30) * 4 + lo;
-    if (result < 0) {
-	fprintf(stderr, "Error: Cycle counter returning negative value: %.0f\n", result);
-    }
-    return result;
+#if HAVE_TSC
+    if (use_tsc)
+	return tsc_begin();
+#endif
+    return raw_ns();
 }
 
-#else
-
-/****************************************************************
- * All the other platforms for which we haven't implemented cycle
- * counter routines. Newer models of sparcs (v8plus) have cycle
- * counters that can be accessed from user programs, but since there
- * are still many sparc boxes out there that don't support this, we
- * haven't provided a Sparc version here.
- ***************************************************************/
+static inline unsigned long long counter_end(void)
+{
+#if HAVE_TSC
+    if (use_tsc)
+	return tsc_end();
+#endif
+    return raw_ns();
+}
 
+/* Record the current value of the cycle counter. */
 void start_counter()
 {
-    printf("ERROR: You are trying to use a start_counter routine in clock.c\n");
-    printf("that has not been implemented yet on this platform.\n");
-    printf("Please choose another timing package in config.h.\n");
-    exit(1);
+    if (use_tsc < 0)
+	select_counter();
+    cyc_start = counter_begin();
 }
 
-double get_counter() 
+/* Return the number of cycles since the last call to start_counter. */
+double get_counter()
 {
-    printf("ERROR: You are trying to use a get_counter routine in clock.c\n");
-    printf("that has not been implemented yet on this platform.\n");
-    printf("Please choose another timing package in config.h.\n");
-    exit(1);
+    return (double) (counter_end() - cyc_start);
 }
-#endif
 
+/* 
+ * CPU pinning. The TSCs of different CPUs are not always in sync, and
+ * a thread that migrates in the middle of a measurement also pays for
+ * a cold cache, so measurements are taken on one CPU.
+ */
+static cpu_set_t saved_mask;
+static int pin_depth = 0;
+static int pin_saved = 0;
 
+/* Pin the calling thread to the CPU it runs on. Calls nest */
+int pin_counter()
+{
+    cpu_set_t mask;
+    int cpu;
+
+    if (pin_depth++ > 0)
+	return 0;
+    pin_saved = 0;
+    if (sched_getaffinity(0, sizeof(saved_mask), &saved_mask) < 0 ||
+	(cpu = sched_getcpu()) < 0)
+	return -1;
+    CPU_ZERO(&mask);
+    CPU_SET(cpu, &mask);
+    if (sched_setaffinity(0, sizeof(mask), &mask) < 0)
+	return -1;
+    pin_saved = 1;
+    return 0;
+}
 
+/* Undo the matching pin_counter */
+void unpin_counter()
+{
+    if (pin_depth == 0 || --pin_depth > 0)
+	return;
+    if (pin_saved)
+	sched_setaffinity(0, sizeof(saved_mask), &saved_mask);
+}
 
 /*******************************
  * Machine-independent functions
@@ -179,26 +201,70 @@ double ovhd()
     return result;
 }
 
+/* 
+ * Read the counter and CLOCK_MONOTONIC_RAW at the same moment. Of a
+ * few tries, the one with the fewest cycles around the clock read is
+ * kept, and the counter is taken halfway through it.
+ */
+static void read_pair(unsigned long long *cyc, unsigned long long *ns)
+{
+    unsigned long long before, after, t, best = ~0ULL;
+    int i;
+
+    for (i = 0; i < 5; i++) {
+	before = counter_begin();
+	t = raw_ns();
+	after = counter_end();
+	if (after - before < best) {
+	    best = after - before;
+	    *cyc = before + best / 2;
+	    *ns = t;
+	}
+    }
+}
+
 /* $begin mhz */
-/* Estimate the clock rate by measuring the cycles that elapse */ 
-/* while sleeping for sleeptime seconds */
-double mhz_full(int verbose, int sleeptime)
+/* Calibrate the counter against CLOCK_MONOTONIC_RAW over secs seconds */
+static double calibrate(int verbose, double secs)
 {
+    unsigned long long cyc0, ns0, cyc1, ns1;
+    struct timespec ts;
     double rate;
 
-    start_counter();
-    sleep(sleeptime);
-    rate = get_counter() / (1e6*sleeptime);
+    if (use_tsc < 0)
+	select_counter();
+    if (!use_tsc) {
+	if (verbose)
+	    printf("No invariant cycle counter, timing with CLOCK_MONOTONIC_RAW\n");
+	return 1000.0;
+    }
+
+    pin_counter();
+    read_pair(&cyc0, &ns0);
+    ts.tv_sec = (time_t) secs;
+    ts.tv_nsec = (long) ((secs - ts.tv_sec) * 1e9);
+    nanosleep(&ts, NULL);
+    read_pair(&cyc1, &ns1);
+    unpin_counter();
+
+    rate = (double) (cyc1 - cyc0) * 1e3 / (ns1 - ns0);
     if (verbose) 
-	printf("Processor clock rate ~= %.1f MHz\n", rate);
+	printf("Invariant TSC ~= %.1f MHz\n", rate);
     return rate;
 }
+
+/* Estimate the clock rate by measuring the cycles that elapse */ 
+/* while sleeping for sleeptime seconds */
+double mhz_full(int verbose, int sleeptime)
+{
+    return calibrate(verbose, sleeptime);
+}
 /* $end mhz */
 
-/* Version using a default sleeptime */
+/* Version using a default calibration time */
 double mhz(int verbose)
 {
-    return mhz_full(verbose, 2);
+    return calibrate(verbose, CALIBRATE_SECS);
 }
 
 /** Special counters that compensate for timer interrupt overhead */
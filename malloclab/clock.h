@@ -1,4 +1,5 @@
 /* Routines for using cycle counter */
+/* (the TSC on x86, CLOCK_MONOTONIC_RAW in ns elsewhere) */
 
 /* Start the counter */
 void start_counter();
@@ -6,6 +7,10 @@ void start_counter();
 /* Get # cycles since counter started */
 double get_counter();
 
+/* Pin the calling thread to its current CPU while measuring, and undo it */
+int pin_counter();
+void unpin_counter();
+
 /* Measure overhead for counter */
 double ovhd();
 
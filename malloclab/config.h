@@ -62,15 +62,34 @@
 #define ALIGNMENT 8  
 
 /* 
- * Maximum heap size in bytes 
+ * Maximum heap size in bytes. memlib only reserves this much virtual
+ * address space; pages are committed as the brk pointer advances.
  */
-#define MAX_HEAP (20*(1<<20))  /* 20 MB */
+#if __SIZEOF_POINTER__ == 8
+#define MAX_HEAP ((size_t)64 << 30)  /* 64 GB */
+#else
+#define MAX_HEAP ((size_t)1 << 30)   /* 1 GB */
+#endif
+
+/*
+ * The reserved heap is committed (made readable and writable) in steps
+ * of MEM_COMMIT_CHUNK bytes. It is also the alignment of the heap start,
+ * so a 2 MB chunk lets the kernel back the heap with huge pages.
+ */
+#define MEM_COMMIT_CHUNK (2*(1<<20))  /* 2 MB */
+
+/*
+ * Set to 1 to ask the kernel to back the heap with transparent huge
+ * pages (madvise MADV_HUGEPAGE). Fewer TLB misses on big heaps.
+ */
+#define MEM_HUGEPAGES 0
 
 /*****************************************************************************
  * Set exactly one of these USE_xxx constants to "1" to select a timing method
  *****************************************************************************/
-#define USE_FCYC   0   /* cycle counter w/K-best scheme (x86 & Alpha only) */
+#define USE_FCYC   1   /* cycle counter w/K-best scheme (TSC on x86, else
+                          CLOCK_MONOTONIC_RAW; see clock.c) */
 #define USE_ITIMER 0   /* interval timer (any Unix box) */
-#define USE_GETTOD 1   /* gettimeofday (any Unix box) */
+#define USE_GETTOD 0   /* gettimeofday (any Unix box) */
 
 #endif /* __CONFIG_H */
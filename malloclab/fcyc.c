@@ -5,7 +5,8 @@
  * May not be used, modified, or copied without permission.
  *
  * Uses the cycle timer routines in clock.c to estimate the
- * the time in CPU cycles for a function f.
+ * the time in CPU cycles for a function f. The samples are all
+ * taken on the CPU the caller runs on when fcyc is called.
  */
 #include <stdlib.h>
 #include <sys/times.h>
@@ -130,6 +131,7 @@ double fcyc(test_funct f, void *argp)
 {
     double result;
     init_sampler();
+    pin_counter();
     if (compensate) {
 	do {
 	    double cyc;
@@ -159,6 +161,7 @@ double fcyc(test_funct f, void *argp)
 	    printf("%.0f%s", values[i], i==kbest-1 ? "]\n" : ", ");
     }
 #endif
+    unpin_counter();
     result = values[0];
 #if !KEEP_VALS
     free(values); 
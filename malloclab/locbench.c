@@ -0,0 +1,379 @@
+/*
+ * locbench.c - pointer-chasing benchmark for placement and free list order
+ *
+ * A long-running program leaves its heap full of holes, freed in no
+ * particular order. This benchmark ages a heap like that, then builds a
+ * linked list with one allocation per node, the way a program would
+ * load a tree or a graph, and times walks along it. It does so once
+ * with LIFO free lists and once with address-ordered free lists. With
+ * LIFO lists, nodes allocated one after the other land wherever the
+ * last frees were; in address order, they fill the holes front to back.
+ *
+ * Nodes usually come with data the walk never reads, and each node
+ * allocates a cold buffer for it right after itself. Two more runs use
+ * LIFO lists with mm_malloc_hint: one hints every node at the one before
+ * it, and one also allocates the cold buffers with MM_HINT_COLD, which
+ * keeps them out from between the nodes.
+ *
+ * For every run it reports the walk time per node, L1 data cache misses
+ * per node where the kernel allows perf_event_open, and the heap size
+ * the list ends up costing. Timings and counters are noisy on shared
+ * machines, or missing, so it also reports two figures that only depend
+ * on where the nodes are: the misses per node of a walk through a
+ * simulated 32 KB, 8-way L1 data cache, and the share of nodes on the
+ * same page as their predecessor.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <time.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+
+#include "mm.h"
+#include "memlib.h"
+
+/**********************
+ * Constants and macros
+ **********************/
+#define DEFAULT_NODES    100000  /* nodes in the list */
+#define DEFAULT_MAXSIZE  64      /* largest node, in bytes */
+#define DEFAULT_WALKS    20      /* walks timed, the best is reported */
+#define DEFAULT_COLD     32      /* cold bytes allocated with every node */
+#define PAGE_SHIFT       12      /* 4 KB pages */
+
+/* The simulated L1 data cache, see simulate_misses */
+#define LINE_SHIFT       6       /* 64 byte lines */
+#define CACHE_SETS       64
+#define CACHE_WAYS       8
+
+/* A node of the list */
+typedef struct node {
+    struct node *next;
+    char *cold;                  /* data the walk does not read */
+    long value;
+} node_t;
+
+/* A run: free list order and how nodes and cold buffers are placed */
+typedef struct {
+    char *name;
+    char *order;
+    int hint;                    /* hint every node at the one before */
+    int cold;                    /* allocate cold buffers with MM_HINT_COLD */
+} run_t;
+
+static run_t runs[] = {
+    {"lifo", "lifo", 0, 0},
+    {"address", "address", 0, 0},
+    {"hint", "lifo", 1, 0},
+    {"hint+cold", "lifo", 1, 1},
+};
+
+/* mm.c prints debug output when this is set */
+int verbose = 0;
+
+/* Keeps the walks from being optimized away */
+volatile long sink;
+
+/* L1 data cache read miss counter, see open_counter */
+static int counter_fd = -1;
+
+/*********************
+ * Function prototypes
+ *********************/
+static void age_heap(int nodes, int maxsize, unsigned int *seed);
+static node_t *build_list(int nodes, int maxsize, int coldsize, const run_t *run,
+        unsigned int *seed);
+static double walk(node_t *head, long *misses);
+static long simulate_misses(node_t *head);
+static void open_counter(void);
+static double now(void);
+static void usage(void);
+static void app_error(char *msg);
+
+/**************
+ * Main routine
+ **************/
+int main(int argc, char **argv)
+{
+    int nodes = DEFAULT_NODES;
+    int maxsize = DEFAULT_MAXSIZE;
+    int walks = DEFAULT_WALKS;
+    int coldsize = DEFAULT_COLD;
+    unsigned int seed;
+    node_t *head, *n;
+    double secs, best;
+    long misses, best_misses;
+    long same_page;
+    int c, i, r;
+
+    while ((c = getopt(argc, argv, "n:s:w:c:h")) != EOF) {
+        switch (c) {
+            case 'n': /* Nodes in the list */
+                nodes = atoi(optarg);
+                break;
+            case 's': /* Largest node size */
+                maxsize = atoi(optarg);
+                break;
+            case 'w': /* Walks per run */
+                walks = atoi(optarg);
+                break;
+            case 'c': /* Cold bytes per node */
+                coldsize = atoi(optarg);
+                break;
+            case 'h': /* Print this message */
+                usage();
+                exit(0);
+            default:
+                usage();
+                exit(1);
+        }
+    }
+    if (nodes <= 1 || maxsize < (int)sizeof(node_t) || walks <= 0 || coldsize < 0) {
+        usage();
+        exit(1);
+    }
+
+    mem_init();
+    open_counter();
+
+    printf("%d nodes of %d..%d bytes, %d cold bytes each\n", nodes,
+            (int)sizeof(node_t), maxsize, coldsize);
+    printf("%-10s%10s%10s%10s%12s%10s\n", "run", "ns/node", "L1D miss",
+            "sim miss", "same page", "heap KB");
+
+    for (r = 0; r < (int)(sizeof(runs) / sizeof(runs[0])); r++) {
+        if (mm_set_order_policy(runs[r].order) < 0)
+            app_error("mm_set_order_policy failed");
+        mem_reset_brk();
+        if (mm_init() < 0)
+            app_error("mm_init failed");
+
+        /* the same heap history and the same list for every run */
+        seed = 1;
+        age_heap(nodes, maxsize, &seed);
+        head = build_list(nodes, maxsize, coldsize, &runs[r], &seed);
+
+        best = 0;
+        best_misses = -1;
+        for (i = 0; i < walks; i++) {
+            secs = walk(head, &misses);
+            if (i == 0 || secs < best) {
+                best = secs;
+                best_misses = misses;
+            }
+        }
+
+        same_page = 0;
+        for (n = head; n->next != NULL; n = n->next)
+            if ((unsigned long)n >> PAGE_SHIFT == (unsigned long)n->next >> PAGE_SHIFT)
+                same_page++;
+
+        printf("%-10s%10.2f", runs[r].name, best * 1e9 / nodes);
+        if (best_misses < 0)
+            printf("%10s", "-");
+        else
+            printf("%10.3f", (double)best_misses / nodes);
+        printf("%10.3f%11.1f%%%10.0f\n", (double)simulate_misses(head) / nodes,
+                100.0 * same_page / (nodes - 1), mem_heapsize() / 1024.0);
+    }
+
+    mem_deinit();
+    exit(0);
+}
+
+/*
+ * age_heap - Allocate twice as many blocks as the list will have, then
+ *     free a random half of them in random order
+ */
+static void age_heap(int nodes, int maxsize, unsigned int *seed)
+{
+    char **blocks, *tmp;
+    int i, j, n = 2 * nodes;
+
+    if ((blocks = calloc(n, sizeof(char *))) == NULL)
+        app_error("calloc failed in age_heap");
+
+    for (i = 0; i < n; i++)
+        if ((blocks[i] = mm_malloc(1 + rand_r(seed) % maxsize)) == NULL)
+            app_error("mm_malloc failed in age_heap");
+
+    /* shuffle, then free the first half */
+    for (i = n - 1; i > 0; i--) {
+        j = rand_r(seed) % (i + 1);
+        tmp = blocks[i];
+        blocks[i] = blocks[j];
+        blocks[j] = tmp;
+    }
+    for (i = 0; i < nodes; i++)
+        mm_free(blocks[i]);
+
+    /* the other half stays allocated for good */
+    free(blocks);
+}
+
+/*
+ * build_list - Allocate `nodes` nodes one after the other, each followed
+ *     by its cold buffer, and link them in allocation order
+ */
+static node_t *build_list(int nodes, int maxsize, int coldsize, const run_t *run,
+        unsigned int *seed)
+{
+    node_t *head = NULL, *tail = NULL, *n;
+    size_t size;
+    int i;
+
+    for (i = 0; i < nodes; i++) {
+        size = sizeof(node_t) + rand_r(seed) % (maxsize - sizeof(node_t) + 1);
+        if (run->hint)
+            n = mm_malloc_hint(size, tail, 0);
+        else
+            n = mm_malloc(size);
+        if (n == NULL)
+            app_error("mm_malloc failed in build_list");
+
+        n->cold = NULL;
+        if (coldsize > 0) {
+            if (run->cold)
+                n->cold = mm_malloc_hint(coldsize, NULL, MM_HINT_COLD);
+            else
+                n->cold = mm_malloc(coldsize);
+            if (n->cold == NULL)
+                app_error("mm_malloc failed in build_list");
+        }
+
+        n->next = NULL;
+        n->value = i;
+        if (tail == NULL)
+            head = n;
+        else
+            tail->next = n;
+        tail = n;
+    }
+
+    return head;
+}
+
+/*
+ * walk - Follow the list from `head` to its end, and return the time
+ *     it took in seconds. The L1 data cache misses of the walk go in
+ *     *misses, or -1 without a counter
+ */
+static double walk(node_t *head, long *misses)
+{
+    double start, secs;
+    long long count = -1;
+    long sum = 0;
+    node_t *n;
+
+    if (counter_fd >= 0) {
+        ioctl(counter_fd, PERF_EVENT_IOC_RESET, 0);
+        ioctl(counter_fd, PERF_EVENT_IOC_ENABLE, 0);
+    }
+    start = now();
+    for (n = head; n != NULL; n = n->next)
+        sum += n->value;
+    secs = now() - start;
+    if (counter_fd >= 0) {
+        ioctl(counter_fd, PERF_EVENT_IOC_DISABLE, 0);
+        if (read(counter_fd, &count, sizeof(count)) != sizeof(count))
+            count = -1;
+    }
+    sink = sum;
+
+    *misses = count;
+    return secs;
+}
+
+/*
+ * simulate_misses - Walk the list through a simulated set-associative
+ *     LRU cache, starting cold, and return the misses. A node that
+ *     straddles two lines touches both
+ */
+static long simulate_misses(node_t *head)
+{
+    static unsigned long tags[CACHE_SETS][CACHE_WAYS];
+    unsigned long line, last;
+    long misses = 0;
+    node_t *n;
+    int set, w;
+
+    memset(tags, 0xff, sizeof(tags));
+    for (n = head; n != NULL; n = n->next) {
+        last = ((unsigned long)n + sizeof(node_t) - 1) >> LINE_SHIFT;
+        for (line = (unsigned long)n >> LINE_SHIFT; line <= last; line++) {
+            set = line % CACHE_SETS;
+
+            /* find the line, or evict the least recently used one */
+            for (w = 0; w < CACHE_WAYS - 1 && tags[set][w] != line; w++)
+                ;
+            if (tags[set][w] != line)
+                misses++;
+
+            /* the most recently used line goes first */
+            memmove(&tags[set][1], &tags[set][0], w * sizeof(unsigned long));
+            tags[set][0] = line;
+        }
+    }
+
+    return misses;
+}
+
+/*
+ * open_counter - Open the L1 data cache read miss counter of this
+ *     thread. If the kernel refuses, the column is printed as "-"
+ */
+static void open_counter(void)
+{
+    struct perf_event_attr attr;
+
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.disabled = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    attr.type = PERF_TYPE_HW_CACHE;
+    attr.config = PERF_COUNT_HW_CACHE_L1D |
+        (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+        (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+    counter_fd = syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+/*
+ * now - Wall clock time in seconds
+ */
+static double now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + 1e-9 * ts.tv_nsec;
+}
+
+/*
+ * usage - Explain the command line arguments
+ */
+static void usage(void)
+{
+    fprintf(stderr, "Usage: locbench [-h] [-n <nodes>] [-s <maxsize>] [-w <walks>] [-c <cold>]\n");
+    fprintf(stderr, "Options\n");
+    fprintf(stderr, "\t-c <cold>     Cold bytes allocated with every node (default %d).\n",
+            DEFAULT_COLD);
+    fprintf(stderr, "\t-h            Print this message.\n");
+    fprintf(stderr, "\t-n <nodes>    Nodes in the list (default %d).\n", DEFAULT_NODES);
+    fprintf(stderr, "\t-s <maxsize>  Largest node size in bytes (default %d).\n",
+            DEFAULT_MAXSIZE);
+    fprintf(stderr, "\t-w <walks>    Walks timed per run, the best is reported (default %d).\n",
+            DEFAULT_WALKS);
+}
+
+/*
+ * app_error - Report an application error and terminate
+ */
+static void app_error(char *msg)
+{
+    printf("%s\n", msg);
+    exit(1);
+}
@@ -0,0 +1,172 @@
+#!/usr/bin/perl
+#!/usr/local/bin/perl
+use Getopt::Std;
+use JSON::PP;
+use POSIX qw(erfc);
+
+#######################################################################
+# mdcompare - performance regression gate for the Malloc Lab.
+#
+# Compares the output of "mdriver -J <runs>" against a baseline made
+# the same way. For every trace, the throughput of the runs is
+# compared with a one-sided Mann-Whitney U test, which needs no
+# assumption about the distribution of the run-to-run noise. A trace
+# regresses if it is slower with significance alpha and its median
+# throughput dropped by more than the threshold, or if its utilization
+# dropped at all. Exits with status 1 if any trace regressed, is
+# missing, or has become invalid.
+#
+#######################################################################
+
+$| = 1; # autoflush output on every print statement
+
+#
+# void usage(void) - print help message and terminate
+#
+sub usage
+{
+    printf STDERR "$_[0]\n";
+    printf STDERR "Usage: $0 [-h] [-a <alpha>] [-t <pct>] <baseline.json> <current.json>\n";
+    printf STDERR "Options:\n";
+    printf STDERR "  -a <alpha>  Significance level of the test (default 0.01)\n";
+    printf STDERR "  -h          Print this message\n";
+    printf STDERR "  -t <pct>    Ignore median slowdowns up to pct percent (default 2)\n";
+    die "\n" ;
+}
+
+#
+# read_runs(file) - read the JSON written by mdriver -J, and return
+#     a hash of its traces by name
+#
+sub read_runs
+{
+    my $file = $_[0];
+    my ($json, $trace, %traces);
+
+    open(JSON, "<", $file) or die "$0: cannot open $file: $!\n";
+    local $/;
+    $json = eval { decode_json(<JSON>) };
+    close(JSON);
+    die "$0: $file is not mdriver -J output\n" unless $json && $json->{traces};
+
+    foreach $trace (@{$json->{traces}}) {
+        $traces{$trace->{name}} = $trace;
+    }
+    return %traces;
+}
+
+#
+# median(values) - median of a list of numbers
+#
+sub median
+{
+    my @v = sort { $a <=> $b } @_;
+    my $n = scalar(@v);
+
+    return ($n % 2) ? $v[($n - 1) / 2] : ($v[$n / 2 - 1] + $v[$n / 2]) / 2;
+}
+
+#
+# mann_whitney(x, y) - p-value of the one-sided Mann-Whitney U test
+#     that the values in list x tend to be smaller than those in list y.
+#     Uses the normal approximation, corrected for ties and continuity.
+#
+sub mann_whitney
+{
+    my ($x, $y) = @_;
+    my $n1 = scalar(@$x);
+    my $n2 = scalar(@$y);
+    my $n = $n1 + $n2;
+    my (@all, @rank, $i, $j, $t, $ties, $r1, $u, $mean, $var, $z);
+
+    # rank the pooled sample, giving tied values their average rank
+    @all = sort { $a->[0] <=> $b->[0] }
+        ((map { [$_, 0] } @$x), (map { [$_, 1] } @$y));
+    $ties = 0;
+    for ($i = 0; $i < $n; $i = $j) {
+        for ($j = $i; $j < $n && $all[$j][0] == $all[$i][0]; $j++) {
+        }
+        $t = $j - $i;
+        $ties += $t * $t * $t - $t;
+        foreach ($i .. $j - 1) {
+            $rank[$_] = ($i + $j + 1) / 2;
+        }
+    }
+
+    $r1 = 0;
+    for ($i = 0; $i < $n; $i++) {
+        $r1 += $rank[$i] if $all[$i][1] == 0;
+    }
+    $u = $r1 - $n1 * ($n1 + 1) / 2;
+
+    $mean = $n1 * $n2 / 2;
+    $var = $n1 * $n2 / 12 * (($n + 1) - $ties / ($n * ($n - 1)));
+    return 0.5 if $var <= 0;
+
+    # P(U <= u) under the null hypothesis
+    $z = ($u - $mean + 0.5) / sqrt($var);
+    return 0.5 * erfc(-$z / sqrt(2));
+}
+
+##############
+# Main routine
+##############
+
+getopts('ha:t:');
+if ($opt_h) {
+    usage("");
+}
+usage("Two files are needed") unless scalar(@ARGV) == 2;
+$alpha = defined($opt_a) ? $opt_a : 0.01;
+$threshold = defined($opt_t) ? $opt_t : 2;
+
+%base = read_runs($ARGV[0]);
+%cur = read_runs($ARGV[1]);
+
+$failed = 0;
+printf("%-20s%10s%10s%8s%10s%8s  %s\n", "trace", "base Kops", "Kops",
+       "change", "p", "util", "verdict");
+foreach $name (sort keys %base) {
+    $bt = $base{$name};
+    $ct = $cur{$name};
+
+    if (!$ct) {
+        printf("%-20s%58s\n", $name, "MISSING");
+        $failed = 1;
+        next;
+    }
+    if (!$ct->{valid}) {
+        printf("%-20s%58s\n", $name, "INVALID");
+        $failed = 1;
+        next;
+    }
+    if (!$bt->{valid}) {
+        printf("%-20s%58s\n", $name, "no baseline");
+        next;
+    }
+
+    $base_kops = median(@{$bt->{kops}});
+    $kops = median(@{$ct->{kops}});
+    $change = ($kops - $base_kops) / $base_kops * 100;
+    $p = mann_whitney($ct->{kops}, $bt->{kops});
+
+    $verdict = "ok";
+    if ($p < $alpha && -$change > $threshold) {
+        $verdict = "SLOWER";
+        $failed = 1;
+    }
+    if ($ct->{util} < $bt->{util} - 0.00005) {
+        $verdict = ($verdict eq "ok") ? "LESS UTIL" : "$verdict, LESS UTIL";
+        $failed = 1;
+    }
+
+    printf("%-20s%10.0f%10.0f%7.1f%%%10.4f%7.1f%%  %s\n", $name, $base_kops,
+           $kops, $change, $p, $ct->{util} * 100, $verdict);
+}
+
+if ($failed) {
+    print "Performance regressed against $ARGV[0]\n";
+    exit(1);
+}
+print "No significant regressions against $ARGV[0]\n";
+exit(0);
@@ -15,8 +15,12 @@
 #include <assert.h>
 #include <float.h>
 #include <time.h>
+#include <pthread.h>
 
 #include "mm.h"
+#include "mm_region.h"
+#include "mm_cores.h"
+#include "mm_prof.h"
 #include "memlib.h"
 #include "fsecs.h"
 #include "config.h"
@@ -30,6 +34,20 @@
 #define HDRLINES       4 /* number of header lines in a trace file */
 #define LINENUM(i) (i+5) /* cnvt trace request nums to linenums (origin 1) */
 
+/* Multithreaded replay (-T) */
+#define MT_RUNS        3 /* keep the fastest of MT_RUNS runs per thread count */
+#define MT_XFREE_PCT  25 /* default percentage of frees done by another thread */
+
+/* Repeated runs for the regression gate (-J) */
+#define LAT_SAMPLE_MAX  (1 << 22) /* most latency samples kept per trace */
+
+/* Compaction (-c) */
+#define COMPACT_PIN_EVERY 8 /* pin every 8th live block while compacting */
+
+/* Heap profiling (-P) */
+#define PROF_FILE        "mdriver.heap"   /* pprof heap profile */
+#define PROF_FOLDED_FILE "mdriver.folded" /* folded stacks of allocated bytes */
+
 /* Returns true if p is ALIGNMENT-byte aligned */
 #define IS_ALIGNED(p)  ((((unsigned int)(p)) % ALIGNMENT) == 0)
 
@@ -37,11 +55,13 @@
  * The key compound data types
  *****************************/
 
-/* Records the extent of each block's payload */
+/* Records the extent of each block's payload, as a node of a treap */
 typedef struct range_t {
-    char *lo;              /* low payload address */
+    char *lo;              /* low payload address (treap key) */
     char *hi;              /* high payload address */
-    struct range_t *next;  /* next list element */
+    unsigned priority;     /* treap heap priority */
+    struct range_t *left;  /* ranges at lower addresses */
+    struct range_t *right; /* ranges at higher addresses */
 } range_t;
 
 /* Characterizes a single trace operation (allocator request) */
@@ -70,6 +90,7 @@ typedef struct {
 typedef struct {
     trace_t *trace;
     range_t *ranges;
+    const mm_core_t *core;  /* allocator core timed by eval_core_speed */
 } speed_t;
 
 /* Summarizes the important stats for some malloc function on some trace */
@@ -85,11 +106,46 @@ typedef struct {
     /* Note: secs and util are only defined if valid is true */
 } stats_t;
 
+/* Allocator entry points driven by the multithreaded replay */
+typedef struct {
+    char *name;                           /* name printed in the results */
+    void (*reset)(void);                  /* prepare a fresh heap */
+    void *(*malloc)(size_t size);
+    void (*free)(void *ptr);
+    void *(*realloc)(void *ptr, size_t size);
+} mt_alloc_t;
+
+/*
+ * Per-thread state for the multithreaded replay. Every thread replays
+ * its own copy of the trace. Frees of selected block ids are handed off
+ * to the next thread's mailbox, which frees them on its own time.
+ */
+typedef struct mt_thread_t {
+    pthread_t tid;
+    trace_t *trace;              /* shared, read-only request stream */
+    char **blocks;               /* this thread's block pointers */
+    mt_alloc_t *alloc;           /* allocator under test */
+    struct mt_thread_t *peer;    /* receives our cross-thread frees */
+    pthread_barrier_t *barrier;  /* lines up start and final drain */
+    int xfree_pct;               /* percentage of frees handed to peer */
+
+    pthread_mutex_t lock;        /* protects the mailbox below */
+    char **mailbox;              /* blocks other threads asked us to free */
+    int mailbox_count;           /* number of entries in mailbox */
+    char **drain;                /* scratch array used while draining */
+
+    double ops;                  /* operations performed by this thread */
+    double secs;                 /* wall clock time of this thread */
+    int failed;                  /* an allocation failed during the run */
+} mt_thread_t;
+
 /********************
  * Global variables
  *******************/
 int verbose = 0;        /* global flag for verbose output */
 static int errors = 0;  /* number of errs found when running student malloc */
+static int hint_allocs = 0; /* If set, mm_malloc_hint every allocation (-H) */
+static char *hint_block;    /* last block allocated, while it is live */
 char msg[MAXLINE];      /* for whenever we need to compose an error message */
 
 /* Directory where default tracefiles are found */
@@ -105,7 +161,7 @@ static char *default_tracefiles[] = {
  * Function prototypes
  *********************/
 
-/* these functions manipulate range lists */
+/* these functions manipulate the range tree */
 static int add_range(range_t **ranges, char *lo, int size,
         int tracenum, int opnum);
 static void remove_range(range_t **ranges, char *lo);
@@ -124,20 +180,67 @@ static void eval_libc_speed(void *ptr);
 static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges);
 static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges);
 static void eval_mm_speed(void *ptr);
+static int eval_mm_compact(trace_t *trace, int tracenum, range_t **ranges);
+static void *trace_malloc(size_t size);
+static void *trace_realloc(void *ptr, size_t size);
+static void trace_free(void *ptr);
+
+/* Routines for the repeated runs compared by mdcompare.pl */
+static void eval_mm_json(char **tracefiles, int num_tracefiles, int runs);
+static int eval_mm_latency(trace_t *trace, double *lat, double *probes,
+        double overhead);
+static double timer_overhead(void);
+static int cmp_double(const void *a, const void *b);
+
+/* Routines for evaluating the prebuilt mm_core allocators */
+static double eval_core_util(trace_t *trace, int tracenum, const mm_core_t *core,
+        range_t **ranges);
+static void eval_core_speed(void *ptr);
+
+/* Routines for evaluating the mm_region allocator layered on mm.c */
+static double eval_region_util(trace_t *trace, int tracenum);
+static void eval_region_speed(void *ptr);
+static int region_replay(trace_t *trace, mm_region_t *region, int i,
+        int *live);
+
+/* Routines for replaying a trace on several threads at once */
+static void eval_mt_scaling(trace_t *trace, mt_alloc_t *alloc,
+        int max_threads, int xfree_pct);
+static void *mt_replay(void *vargp);
+static void mt_drain(mt_thread_t *self);
+static void mt_mm_reset(void);
+static void *mt_mm_malloc(size_t size);
+static void mt_mm_free(void *ptr);
+static void *mt_mm_realloc(void *ptr, size_t size);
+static void mt_libc_reset(void);
 
 /* Various helper routines */
 static void printresults(int n, stats_t *stats);
+static void write_profile(char *filename, int format);
 static void usage(void);
 static void unix_error(char *msg);
 static void malloc_error(int tracenum, int opnum, char *msg);
 static void app_error(char *msg);
 
+/*
+ * The mm package is not thread-safe, so the replay drives it through
+ * a single global lock. This is the baseline any thread-aware design
+ * has to beat.
+ */
+static pthread_mutex_t mt_mm_lock = PTHREAD_MUTEX_INITIALIZER;
+static mt_alloc_t mt_mm = {
+    "mm (global lock)", mt_mm_reset, mt_mm_malloc, mt_mm_free, mt_mm_realloc
+};
+static mt_alloc_t mt_libc = {
+    "libc", mt_libc_reset, malloc, free, realloc
+};
+
 /**************
  * Main routine
  **************/
 int main(int argc, char **argv)
 {
-    int i;
+    int i, j;
     char c;
     char **tracefiles = NULL;  /* null-terminated array of trace file names */
     int num_tracefiles = 0;    /* the number of traces in that array */
@@ -145,10 +248,19 @@ int main(int argc, char **argv)
     range_t *ranges = NULL;    /* keeps track of block extents for one trace */
     stats_t *libc_stats = NULL;/* libc stats for each trace */
     stats_t *mm_stats = NULL;  /* mm (i.e. student) stats for each trace */
+    stats_t *region_stats = NULL; /* mm_region stats for each trace */
+    stats_t *core_stats = NULL; /* mm_core stats for each trace */
     speed_t speed_params;      /* input parameters to the xx_speed routines */
 
     int run_libc = 0;    /* If set, run libc malloc (set by -l) */
+    int run_region = 0;  /* If set, run the mm_region allocator (set by -R) */
+    int run_cores = 0;   /* If set, run the prebuilt mm_core allocators (set by -C) */
+    int run_compact = 0; /* If set, replay through handles and compact (set by -c) */
     int autograder = 0;  /* If set, emit summary info for autograder (-g) */
+    int mt_threads = 0;  /* If set, replay on up to this many threads (-T) */
+    int xfree_pct = MT_XFREE_PCT; /* cross-thread free percentage (-x) */
+    size_t prof_rate = 0; /* If set, profile mm with this sampling rate (-P) */
+    int json_runs = 0;   /* If set, print this many runs per trace as JSON (-J) */
 
     /* temporaries used to compute the performance index */
     double secs, ops, util, avg_mm_util, avg_mm_throughput, p1, p2, perfindex;
@@ -157,7 +269,7 @@ int main(int argc, char **argv)
     /*
      * Read and interpret the command line arguments
      */
-    while ((c = getopt(argc, argv, "f:t:hvVgal")) != EOF) {
+    while ((c = getopt(argc, argv, "f:t:T:x:p:s:O:P:J:hvVgalRCHc")) != EOF) {
         switch (c) {
             case 'g': /* Generate summary info for the autograder */
                 autograder = 1;
@@ -180,6 +292,60 @@ int main(int argc, char **argv)
             case 'l': /* Run libc malloc */
                 run_libc = 1;
                 break;
+            case 'R': /* Run the mm_region allocator */
+                run_region = 1;
+                break;
+            case 'C': /* Run the prebuilt mm_core allocators */
+                run_cores = 1;
+                break;
+            case 'c': /* Replay through handles, then compact the heap */
+                run_compact = 1;
+                break;
+            case 'H': /* Hint every allocation at the one before it */
+                hint_allocs = 1;
+                break;
+            case 'p': /* Fit policy of the mm package */
+                if (mm_set_fit_policy(optarg) < 0) {
+                    usage();
+                    exit(1);
+                }
+                break;
+            case 's': /* Split policy of the mm package */
+                if (mm_set_split_policy(optarg) < 0) {
+                    usage();
+                    exit(1);
+                }
+                break;
+            case 'O': /* Free list order of the mm package */
+                if (mm_set_order_policy(optarg) < 0) {
+                    usage();
+                    exit(1);
+                }
+                break;
+            case 'P': /* Sample the mm heap every optarg bytes on average */
+                prof_rate = atol(optarg);
+                if (prof_rate == 0)
+                    prof_rate = MM_PROF_RATE;
+                break;
+            case 'T': /* Multithreaded replay on up to optarg threads */
+                mt_threads = atoi(optarg);
+                if (mt_threads <= 0)
+                    mt_threads = sysconf(_SC_NPROCESSORS_ONLN);
+                break;
+            case 'J': /* Run every trace optarg times, print JSON */
+                json_runs = atoi(optarg);
+                if (json_runs <= 0) {
+                    usage();
+                    exit(1);
+                }
+                break;
+            case 'x': /* Percentage of frees done by another thread */
+                xfree_pct = atoi(optarg);
+                if (xfree_pct < 0 || xfree_pct > 100) {
+                    usage();
+                    exit(1);
+                }
+                break;
             case 'v': /* Print per-trace performance breakdown */
                 verbose = 1;
                 break;
@@ -202,12 +368,42 @@ int main(int argc, char **argv)
     if (tracefiles == NULL) {
         tracefiles = default_tracefiles;
         num_tracefiles = sizeof(default_tracefiles) / sizeof(char *) - 1;
-        printf("Using default tracefiles in %s\n", tracedir);
+        if (!json_runs)
+            printf("Using default tracefiles in %s\n", tracedir);
     }
 
     /* Initialize the timing package */
     init_fsecs();
 
+    /*
+     * Multithreaded replay replaces the usual evaluation: measure the
+     * scaling of the mm package (and optionally libc) on every trace.
+     */
+    if (mt_threads) {
+        mem_init();
+        for (i=0; i < num_tracefiles; i++) {
+            trace = read_trace(tracedir, tracefiles[i]);
+            printf("\nTrace %d (%s), %d%% cross-thread frees\n",
+                    i, tracefiles[i], xfree_pct);
+            eval_mt_scaling(trace, &mt_mm, mt_threads, xfree_pct);
+            if (run_libc)
+                eval_mt_scaling(trace, &mt_libc, mt_threads, xfree_pct);
+            free_trace(trace);
+        }
+        exit(0);
+    }
+
+    /*
+     * Repeated runs replace the usual evaluation as well: print every
+     * run of every trace as JSON, for mdcompare.pl to compare against
+     * a baseline, instead of the best run
+     */
+    if (json_runs) {
+        mem_init();
+        eval_mm_json(tracefiles, num_tracefiles, json_runs);
+        exit(0);
+    }
+
     /*
      * Optionally run and evaluate the libc malloc package
      */
@@ -257,6 +453,10 @@ int main(int argc, char **argv)
     /* Initialize the simulated memory system in memlib.c */
     mem_init();
 
+    /* Profile everything allocated from mm from here on, including mm_region */
+    if (prof_rate)
+        mm_prof_start(prof_rate);
+
     /* Evaluate student's mm malloc package using the K-best scheme */
     for (i=0; i < num_tracefiles; i++) {
         trace = read_trace(tracedir, tracefiles[i]);
@@ -284,6 +484,95 @@ int main(int argc, char **argv)
         printf("\n");
     }
 
+    /*
+     * Optionally replay every trace through relocatable handles, then
+     * compact the heap and check that the blocks survived the move
+     */
+    if (run_compact) {
+        printf("\nResults for mm_compact:\n");
+        printf("%5s%12s%14s%13s%13s%8s\n",
+               "trace", "live bytes", "util before", "util pinned",
+               "util after", "moves");
+        for (i=0; i < num_tracefiles; i++) {
+            trace = read_trace(tracedir, tracefiles[i]);
+            eval_mm_compact(trace, i, &ranges);
+            free_trace(trace);
+        }
+        printf("\n");
+    }
+
+    /*
+     * Optionally run and evaluate the mm_region allocator, which frees
+     * all live blocks at once whenever a trace has no live blocks left
+     */
+    if (run_region) {
+        if (verbose > 1)
+            printf("\nTesting mm_region\n");
+
+        region_stats = (stats_t *)calloc(num_tracefiles, sizeof(stats_t));
+        if (region_stats == NULL)
+            unix_error("region_stats calloc in main failed");
+
+        for (i=0; i < num_tracefiles; i++) {
+            trace = read_trace(tracedir, tracefiles[i]);
+            region_stats[i].ops = trace->num_ops;
+            region_stats[i].util = eval_region_util(trace, i);
+            region_stats[i].valid = (region_stats[i].util >= 0);
+            if (region_stats[i].valid) {
+                speed_params.trace = trace;
+                region_stats[i].secs = fsecs(eval_region_speed, &speed_params);
+            }
+            free_trace(trace);
+        }
+
+        printf("\nResults for mm_region:\n");
+        printresults(num_tracefiles, region_stats);
+        printf("\n");
+    }
+
+    /*
+     * Optionally run and evaluate every prebuilt instantiation of the
+     * templated allocator core, one after the other
+     */
+    if (run_cores) {
+        core_stats = (stats_t *)calloc(num_tracefiles, sizeof(stats_t));
+        if (core_stats == NULL)
+            unix_error("core_stats calloc in main failed");
+
+        for (j = 0; j < mm_num_cores; j++) {
+            if (verbose > 1)
+                printf("\nTesting mm_core %s\n", mm_cores[j].name);
+
+            for (i=0; i < num_tracefiles; i++) {
+                trace = read_trace(tracedir, tracefiles[i]);
+                core_stats[i].ops = trace->num_ops;
+                core_stats[i].util = eval_core_util(trace, i, &mm_cores[j], &ranges);
+                core_stats[i].valid = (core_stats[i].util >= 0);
+                if (core_stats[i].valid) {
+                    speed_params.trace = trace;
+                    speed_params.core = &mm_cores[j];
+                    core_stats[i].secs = fsecs(eval_core_speed, &speed_params);
+                }
+                free_trace(trace);
+            }
+
+            printf("\nResults for mm_core %s:\n", mm_cores[j].name);
+            printresults(num_tracefiles, core_stats);
+            printf("\n");
+        }
+    }
+
+    if (prof_rate) {
+        mm_prof_stop();
+        write_profile(PROF_FILE, MM_PROF_PPROF);
+        write_profile(PROF_FOLDED_FILE, MM_PROF_FOLDED_ALLOC);
+        printf("Heap profile in %s (pprof) and %s (folded stacks)",
+                PROF_FILE, PROF_FOLDED_FILE);
+        if (mm_prof_dropped)
+            printf(", %lu samples dropped", (unsigned long)mm_prof_dropped);
+        printf("\n");
+    }
+
     /*
      * Accumulate the aggregate statistics for the student's mm package
      */
@@ -337,16 +626,93 @@ int main(int argc, char **argv)
 
 
 /*****************************************************************
- * The following routines manipulate the range list, which keeps
+ * The following routines manipulate the range tree, which keeps
  * track of the extent of every allocated block payload. We use the
- * range list to detect any overlapping allocated blocks.
+ * range tree to detect any overlapping allocated blocks. The tree is
+ * a treap ordered by payload address, so every check, insertion and
+ * removal takes O(log n) expected time.
  ****************************************************************/
 
+/*
+ * range_priority - pseudo-random heap priority for a new treap node
+ */
+static unsigned range_priority(void)
+{
+    static unsigned state = 2463534242u;
+
+    state ^= state << 13;
+    state ^= state >> 17;
+    state ^= state << 5;
+    return state;
+}
+
+/*
+ * rotate_right, rotate_left - treap rotations around *root
+ */
+static void rotate_right(range_t **root)
+{
+    range_t *l = (*root)->left;
+
+    (*root)->left = l->right;
+    l->right = *root;
+    *root = l;
+}
+
+static void rotate_left(range_t **root)
+{
+    range_t *r = (*root)->right;
+
+    (*root)->right = r->left;
+    r->left = *root;
+    *root = r;
+}
+
+/*
+ * insert_range - insert node p into the treap rooted at *root
+ */
+static void insert_range(range_t **root, range_t *p)
+{
+    if (*root == NULL) {
+        *root = p;
+        return;
+    }
+
+    if (p->lo < (*root)->lo) {
+        insert_range(&(*root)->left, p);
+        if ((*root)->left->priority > (*root)->priority)
+            rotate_right(root);
+    }
+    else {
+        insert_range(&(*root)->right, p);
+        if ((*root)->right->priority > (*root)->priority)
+            rotate_left(root);
+    }
+}
+
+/*
+ * find_range_below - return the range with the largest lo <= addr,
+ *     or NULL if every range starts above addr
+ */
+static range_t *find_range_below(range_t *root, char *addr)
+{
+    range_t *best = NULL;
+
+    while (root != NULL) {
+        if (root->lo <= addr) {
+            best = root;
+            root = root->right;
+        }
+        else
+            root = root->left;
+    }
+    return best;
+}
+
 /*
  * add_range - As directed by request opnum in trace tracenum,
  *     we've just called the student's mm_malloc to allocate a block of
  *     size bytes at addr lo. After checking the block for correctness,
- *     we create a range struct for this block and add it to the range list.
+ *     we create a range struct for this block and add it to the range tree.
  */
 static int add_range(range_t **ranges, char *lo, int size,
         int tracenum, int opnum)
@@ -365,36 +731,39 @@ static int add_range(range_t **ranges, char *lo, int size,
         return 0;
     }
 
-    /* The payload must lie within the extent of the heap */
-    if ((lo < (char *)mem_heap_lo()) || (lo > (char *)mem_heap_hi()) ||
-            (hi < (char *)mem_heap_lo()) || (hi > (char *)mem_heap_hi())) {
+    /* The payload must lie within the extent of the heap or of a region */
+    if (!mem_in_heap(lo, hi)) {
         sprintf(msg, "Payload (%p:%p) lies outside heap (%p:%p)",
                 lo, hi, mem_heap_lo(), mem_heap_hi());
         malloc_error(tracenum, opnum, msg);
         return 0;
     }
 
-    /* The payload must not overlap any other payloads */
-    for (p = *ranges;  p != NULL;  p = p->next) {
-        if ((lo >= p->lo && lo <= p-> hi) ||
-                (hi >= p->lo && hi <= p->hi)) {
-            sprintf(msg, "Payload (%p:%p) overlaps another payload (%p:%p)\n",
-                    lo, hi, p->lo, p->hi);
-            malloc_error(tracenum, opnum, msg);
-            return 0;
-        }
+    /*
+     * The payload must not overlap any other payloads. Live payloads
+     * are disjoint, so only the last one starting at or below hi can
+     * reach into [lo, hi].
+     */
+    p = find_range_below(*ranges, hi);
+    if (p != NULL && p->hi >= lo) {
+        sprintf(msg, "Payload (%p:%p) overlaps another payload (%p:%p)\n",
+                lo, hi, p->lo, p->hi);
+        malloc_error(tracenum, opnum, msg);
+        return 0;
     }
 
     /*
      * Everything looks OK, so remember the extent of this block
-     * by creating a range struct and adding it the range list.
+     * by creating a range struct and adding it the range tree.
      */
     if ((p = (range_t *)malloc(sizeof(range_t))) == NULL)
         unix_error("malloc error in add_range");
-    p->next = *ranges;
     p->lo = lo;
     p->hi = hi;
-    *ranges = p;
+    p->priority = range_priority();
+    p->left = NULL;
+    p->right = NULL;
+    insert_range(ranges, p);
     return 1;
 }
 
@@ -403,19 +772,29 @@ static int add_range(range_t **ranges, char *lo, int size,
  */
 static void remove_range(range_t **ranges, char *lo)
 {
+    range_t **pp = ranges;
     range_t *p;
-    range_t **prevpp = ranges;
-    int size;
 
-    for (p = *ranges;  p != NULL; p = p->next) {
-        if (p->lo == lo) {
-            *prevpp = p->next;
-            size = p->hi - p->lo + 1;
-            free(p);
-            break;
+    /* find the node */
+    while (*pp != NULL && (*pp)->lo != lo)
+        pp = (lo < (*pp)->lo) ? &(*pp)->left : &(*pp)->right;
+    if (*pp == NULL)
+        return;
+
+    /* rotate it down until it has at most one child, then unlink it */
+    while ((*pp)->left != NULL && (*pp)->right != NULL) {
+        if ((*pp)->left->priority > (*pp)->right->priority) {
+            rotate_right(pp);
+            pp = &(*pp)->right;
+        }
+        else {
+            rotate_left(pp);
+            pp = &(*pp)->left;
         }
-        prevpp = &(p->next);
     }
+    p = *pp;
+    *pp = (p->left != NULL) ? p->left : p->right;
+    free(p);
 }
 
 /*
@@ -423,13 +802,12 @@ static void remove_range(range_t **ranges, char *lo)
  */
 static void clear_ranges(range_t **ranges)
 {
-    range_t *p;
-    range_t *pnext;
+    if (*ranges == NULL)
+        return;
 
-    for (p = *ranges;  p != NULL;  p = pnext) {
-        pnext = p->next;
-        free(p);
-    }
+    clear_ranges(&(*ranges)->left);
+    clear_ranges(&(*ranges)->right);
+    free(*ranges);
     *ranges = NULL;
 }
 
@@ -554,7 +932,7 @@ static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges)
     char *oldp;
     char *p;
 
-    /* Reset the heap and free any records in the range list */
+    /* Reset the heap and free any records in the range tree */
     mem_reset_brk();
     clear_ranges(ranges);
 
@@ -563,6 +941,7 @@ static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges)
         malloc_error(tracenum, 0, "mm_init failed.");
         return 0;
     }
+    hint_block = NULL;
 
     /* Interpret each operation in the trace in order */
     for (i = 0;  i < trace->num_ops;  i++) {
@@ -574,14 +953,14 @@ static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges)
             case ALLOC: /* mm_malloc */
 
                 /* Call the student's malloc */
-                if ((p = mm_malloc(size)) == NULL) {
+                if ((p = trace_malloc(size)) == NULL) {
                     malloc_error(tracenum, i, "mm_malloc failed.");
                     return 0;
                 }
 
                 /*
                  * Test the range of the new block for correctness and add it
-                 * to the range list if OK. The block must be  be aligned properly,
+                 * to the range tree if OK. The block must be  be aligned properly,
                  * and must not overlap any currently allocated block.
                  */
                 if (add_range(ranges, p, size, tracenum, i) == 0)
@@ -603,15 +982,15 @@ static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges)
 
                 /* Call the student's realloc */
                 oldp = trace->blocks[index];
-                if ((newp = mm_realloc(oldp, size)) == NULL) {
+                if ((newp = trace_realloc(oldp, size)) == NULL) {
                     malloc_error(tracenum, i, "mm_realloc failed.");
                     return 0;
                 }
 
-                /* Remove the old region from the range list */
+                /* Remove the old region from the range tree */
                 remove_range(ranges, oldp);
 
-                /* Check new block for correctness and add it to range list */
+                /* Check new block for correctness and add it to range tree */
                 if (add_range(ranges, newp, size, tracenum, i) == 0)
                     return 0;
 
@@ -623,7 +1002,7 @@ static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges)
                 oldsize = trace->block_sizes[index];
                 if (size < oldsize) oldsize = size;
                 for (j = 0; j < oldsize; j++) {
-                    if (newp[j] != (index & 0xFF)) {
+                    if ((unsigned char)newp[j] != (index & 0xFF)) {
                         malloc_error(tracenum, i, "mm_realloc did not preserve the "
                                 "data from old block");
                         return 0;
@@ -641,7 +1020,7 @@ static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges)
                 /* Remove region from list and call student's free function */
                 p = trace->blocks[index];
                 remove_range(ranges, p);
-                mm_free(p);
+                trace_free(p);
                 break;
 
             default:
@@ -660,9 +1039,11 @@ static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges)
  *   an optimal allocator, i.e., no gaps and no internal fragmentation.
  *   Utilization is the ratio hwm/heapsize, where heapsize is the
  *   size of the heap in bytes after running the student's malloc
- *   package on the trace. Note that our implementation of mem_sbrk()
- *   doesn't allow the students to decrement the brk pointer, so brk
- *   is always the high water mark of the heap.
+ *   package on the trace. Note that the mm package only decrements
+ *   the brk pointer in mm_compact(), which the traces never call, so brk
+ *   is always the high water mark of the heap. A package that keeps
+ *   several heaps in memlib regions is charged for all of them, so
+ *   heapsize is the sum over the heap and every region.
  *
  */
 static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges)
@@ -679,6 +1060,7 @@ static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges)
     mem_reset_brk();
     if (mm_init() < 0)
         app_error("mm_init failed in eval_mm_util");
+    hint_block = NULL;
 
     for (i = 0;  i < trace->num_ops;  i++) {
         switch (trace->ops[i].type) {
@@ -687,7 +1069,7 @@ static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges)
                 index = trace->ops[i].index;
                 size = trace->ops[i].size;
 
-                if ((p = mm_malloc(size)) == NULL)
+                if ((p = trace_malloc(size)) == NULL)
                     app_error("mm_malloc failed in eval_mm_util");
 
                 /* Remember region and size */
@@ -709,7 +1091,7 @@ static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges)
                 oldsize = trace->block_sizes[index];
 
                 oldp = trace->blocks[index];
-                if ((newp = mm_realloc(oldp,newsize)) == NULL)
+                if ((newp = trace_realloc(oldp, newsize)) == NULL)
                     app_error("mm_realloc failed in eval_mm_util");
 
                 /* Remember region and size */
@@ -730,7 +1112,7 @@ static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges)
                 size = trace->block_sizes[index];
                 p = trace->blocks[index];
 
-                mm_free(p);
+                trace_free(p);
 
                 /* Keep track of current total size
                  * of all allocated blocks */
@@ -744,10 +1126,149 @@ static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges)
         }
     }
 
-    return ((double)max_total_size / (double)mem_heapsize());
+    return ((double)max_total_size / (double)mem_total_heapsize());
 }
 
 
+/*
+ * eval_mm_compact - Replay the trace through the relocatable blocks of
+ *   mm_halloc, then compact the heap twice: first with every
+ *   COMPACT_PIN_EVERY-th live block pinned, then with none pinned. The
+ *   frees that tear the heap down at the end of the trace are left out,
+ *   so that there is something left to compact. After each mm_compact,
+ *   checks that every block kept its data, that no pinned block moved,
+ *   and that no two blocks overlap. Prints the utilization (live payload
+ *   bytes over heap size) before, and after each compaction.
+ *   Returns 1 if the blocks survived compaction, 0 otherwise.
+ */
+static int eval_mm_compact(trace_t *trace, int tracenum, range_t **ranges)
+{
+    mm_handle_t *handles;
+    char *pinned;
+    int i, j, last, index, size, pass;
+    int moves = 0, ok = 0;
+    size_t live = 0, heapsize, trimmed;
+    double util[3];
+    mm_handle_t h;
+    char *p;
+
+    /* Reset the heap and free any records in the range tree */
+    mem_reset_brk();
+    clear_ranges(ranges);
+    if (mm_init() < 0) {
+        malloc_error(tracenum, 0, "mm_init failed.");
+        return 0;
+    }
+
+    handles = (mm_handle_t *)calloc(trace->num_ids, sizeof(mm_handle_t));
+    pinned = (char *)calloc(trace->num_ids, sizeof(char));
+    if (handles == NULL || pinned == NULL)
+        unix_error("calloc in eval_mm_compact failed");
+
+    /* Stop after the last allocation, before the final frees */
+    for (last = trace->num_ops - 1; last >= 0; last--)
+        if (trace->ops[last].type != FREE)
+            break;
+
+    for (i = 0; i <= last; i++) {
+        index = trace->ops[i].index;
+        size = trace->ops[i].size;
+
+        switch (trace->ops[i].type) {
+
+            case ALLOC:   /* mm_halloc */
+            case REALLOC: /* a new block, then the old one is freed */
+                if ((h = mm_halloc(size)) == 0) {
+                    malloc_error(tracenum, i, "mm_halloc failed.");
+                    goto out;
+                }
+                memset(mm_pin(h), index & 0xFF, size);
+                mm_unpin(h);
+
+                if (trace->ops[i].type == REALLOC) {
+                    mm_hfree(handles[index]);
+                    live -= trace->block_sizes[index];
+                }
+                handles[index] = h;
+                trace->block_sizes[index] = size;
+                live += size;
+                break;
+
+            case FREE: /* mm_hfree */
+                mm_hfree(handles[index]);
+                handles[index] = 0;
+                live -= trace->block_sizes[index];
+                break;
+
+            default:
+                app_error("Nonexistent request type in eval_mm_compact");
+        }
+    }
+    util[0] = (double)live / mem_heapsize();
+
+    for (pass = 0; pass < 2; pass++) {
+        /* Remember where every block is, and pin some in the first pass */
+        for (index = 0, j = 0; index < trace->num_ids; index++) {
+            if ((h = handles[index]) == 0)
+                continue;
+            trace->blocks[index] = mm_pin(h);
+            pinned[index] = (pass == 0 && j++ % COMPACT_PIN_EVERY == 0);
+            if (!pinned[index])
+                mm_unpin(h);
+        }
+
+        heapsize = mem_heapsize();
+        trimmed = mm_compact();
+        if (mem_heapsize() != heapsize - trimmed) {
+            malloc_error(tracenum, last, "mm_compact misreported the bytes it trimmed.");
+            goto out;
+        }
+
+        clear_ranges(ranges);
+        for (index = 0; index < trace->num_ids; index++) {
+            if ((h = handles[index]) == 0)
+                continue;
+            size = trace->block_sizes[index];
+            p = mm_pin(h);
+
+            if (p != trace->blocks[index]) {
+                if (pinned[index]) {
+                    malloc_error(tracenum, last, "mm_compact moved a pinned block.");
+                    goto out;
+                }
+                moves++;
+            }
+
+            /* The block must still be aligned, in the heap and on its own */
+            if (add_range(ranges, p, size, tracenum, last) == 0)
+                goto out;
+
+            for (j = 0; j < size; j++) {
+                if ((unsigned char)p[j] != (index & 0xFF)) {
+                    malloc_error(tracenum, last, "mm_compact did not preserve the "
+                            "data of a block");
+                    goto out;
+                }
+            }
+
+            mm_unpin(h);
+            if (pinned[index])
+                mm_unpin(h);
+        }
+        util[pass + 1] = (double)live / mem_heapsize();
+    }
+
+    printf("%5d%12lu%13.1f%%%12.1f%%%12.1f%%%8d\n", tracenum,
+           (unsigned long)live, 100 * util[0], 100 * util[1], 100 * util[2],
+           moves);
+    ok = 1;
+
+ out:
+    free(handles);
+    free(pinned);
+    return ok;
+}
+
 /*
  * eval_mm_speed - This is the function that is used by fcyc()
  *    to measure the running time of the mm malloc package.
@@ -762,6 +1283,7 @@ static void eval_mm_speed(void *ptr)
     mem_reset_brk();
     if (mm_init() < 0)
         app_error("mm_init failed in eval_mm_speed");
+    hint_block = NULL;
 
     /* Interpret each trace request */
     for (i = 0;  i < trace->num_ops;  i++)
@@ -770,7 +1292,7 @@ static void eval_mm_speed(void *ptr)
             case ALLOC: /* mm_malloc */
                 index = trace->ops[i].index;
                 size = trace->ops[i].size;
-                if ((p = mm_malloc(size)) == NULL)
+                if ((p = trace_malloc(size)) == NULL)
                     app_error("mm_malloc error in eval_mm_speed");
                 trace->blocks[index] = p;
                 break;
@@ -779,7 +1301,7 @@ static void eval_mm_speed(void *ptr)
                 index = trace->ops[i].index;
                 newsize = trace->ops[i].size;
                 oldp = trace->blocks[index];
-                if ((newp = mm_realloc(oldp,newsize)) == NULL)
+                if ((newp = trace_realloc(oldp, newsize)) == NULL)
                     app_error("mm_realloc error in eval_mm_speed");
                 trace->blocks[index] = newp;
                 break;
@@ -787,7 +1309,7 @@ static void eval_mm_speed(void *ptr)
             case FREE: /* mm_free */
                 index = trace->ops[i].index;
                 block = trace->blocks[index];
-                mm_free(block);
+                trace_free(block);
                 break;
 
             default:
@@ -795,6 +1317,206 @@ static void eval_mm_speed(void *ptr)
         }
 }
 
+/*
+ * trace_malloc - mm_malloc, or with -H, mm_malloc_hint next to the
+ *    block the trace allocated last, as long as that block is live.
+ *    Blocks a trace allocates one after the other then end up next to
+ *    each other, as the objects of a linked structure would
+ */
+static void *trace_malloc(size_t size)
+{
+    if (!hint_allocs)
+        return mm_malloc(size);
+    return hint_block = mm_malloc_hint(size, hint_block, 0);
+}
+
+/*
+ * trace_realloc - mm_realloc, keeping track of the hint block
+ */
+static void *trace_realloc(void *ptr, size_t size)
+{
+    void *newp = mm_realloc(ptr, size);
+
+    if (ptr == hint_block && newp != NULL)
+        hint_block = newp;
+    return newp;
+}
+
+/*
+ * trace_free - mm_free, keeping track of the hint block
+ */
+static void trace_free(void *ptr)
+{
+    if (ptr == hint_block)
+        hint_block = NULL;
+    mm_free(ptr);
+}
+
+/*
+ * eval_mm_json - Check every trace once, then run it `runs` times and
+ *    print the throughput of every run, the utilization, and the
+ *    latency percentiles of single requests over all runs as JSON.
+ *    Each run is timed like the regular evaluation does, by fsecs.
+ *    The percentiles of the free blocks each mm_malloc or mm_realloc
+ *    inspected, from mm_fit_probes, come with the latencies.
+ */
+static void eval_mm_json(char **tracefiles, int num_tracefiles, int runs)
+{
+    static const double pct[] = {50, 90, 99, 99.9};
+    static const char *pct_name[] = {"p50", "p90", "p99", "p999"};
+    trace_t *trace;
+    range_t *ranges = NULL;
+    speed_t speed_params;
+    double *lat, *probes, overhead;
+    int i, run, j, n, nprobes, valid;
+
+    overhead = timer_overhead();
+
+    printf("{\n  \"runs\": %d,\n  \"traces\": [", runs);
+    for (i = 0; i < num_tracefiles; i++) {
+        trace = read_trace(tracedir, tracefiles[i]);
+        valid = eval_mm_valid(trace, i, &ranges);
+
+        printf("%s\n    {\"name\": \"%s\", \"ops\": %d, \"valid\": %s",
+                i ? "," : "", tracefiles[i], trace->num_ops,
+                valid ? "true" : "false");
+        if (!valid) {
+            printf("}");
+            free_trace(trace);
+            continue;
+        }
+
+        printf(", \"util\": %.4f,\n     \"kops\": [",
+                eval_mm_util(trace, i, &ranges));
+        speed_params.trace = trace;
+        speed_params.ranges = ranges;
+        for (run = 0; run < runs; run++)
+            printf("%s%.1f", run ? ", " : "",
+                    trace->num_ops / 1e3 / fsecs(eval_mm_speed, &speed_params));
+
+        /* as many whole runs as the sample buffer holds, at least one */
+        n = LAT_SAMPLE_MAX / trace->num_ops;
+        if (n > runs)
+            n = runs;
+        if (n < 1)
+            n = 1;
+        if ((lat = malloc((size_t)n * trace->num_ops * sizeof(double))) == NULL ||
+                (probes = malloc((size_t)n * trace->num_ops * sizeof(double))) == NULL)
+            unix_error("malloc failed in eval_mm_json");
+        nprobes = 0;
+        for (run = 0; run < n; run++)
+            nprobes += eval_mm_latency(trace, lat + (size_t)run * trace->num_ops,
+                    probes + nprobes, overhead);
+        n *= trace->num_ops;
+        qsort(lat, n, sizeof(double), cmp_double);
+        qsort(probes, nprobes, sizeof(double), cmp_double);
+
+        printf("],\n     \"latency_ns\": {");
+        for (j = 0; j < (int)(sizeof(pct) / sizeof(pct[0])); j++)
+            printf("\"%s\": %.0f, ", pct_name[j], lat[(int)(pct[j] / 100 * (n - 1))]);
+        printf("\"max\": %.0f}", lat[n - 1]);
+
+        printf(",\n     \"probes\": {");
+        if (nprobes > 0) {
+            for (j = 0; j < (int)(sizeof(pct) / sizeof(pct[0])); j++)
+                printf("\"%s\": %.0f, ", pct_name[j],
+                        probes[(int)(pct[j] / 100 * (nprobes - 1))]);
+            printf("\"max\": %.0f", probes[nprobes - 1]);
+        }
+        printf("}}");
+
+        free(lat);
+        free(probes);
+        free_trace(trace);
+    }
+    printf("\n  ]\n}\n");
+}
+
+/*
+ * eval_mm_latency - Replay the trace on a fresh heap like eval_mm_speed,
+ *    and store the time each request took in ns, less the overhead of
+ *    reading the clock, in lat[]. The free blocks inspected by every
+ *    mm_malloc and mm_realloc go to probes[]; returns how many there are.
+ */
+static int eval_mm_latency(trace_t *trace, double *lat, double *probes,
+        double overhead)
+{
+    struct timespec start, end;
+    unsigned long before;
+    int i, index, nprobes = 0;
+    char *p;
+
+    mem_reset_brk();
+    if (mm_init() < 0)
+        app_error("mm_init failed in eval_mm_latency");
+
+    for (i = 0;  i < trace->num_ops;  i++) {
+        index = trace->ops[i].index;
+        before = mm_fit_probes();
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        switch (trace->ops[i].type) {
+
+            case ALLOC: /* mm_malloc */
+                p = mm_malloc(trace->ops[i].size);
+                break;
+
+            case REALLOC: /* mm_realloc */
+                p = mm_realloc(trace->blocks[index], trace->ops[i].size);
+                break;
+
+            case FREE: /* mm_free */
+                mm_free(trace->blocks[index]);
+                p = trace->blocks[index];
+                break;
+
+            default:
+                app_error("Nonexistent request type in eval_mm_latency");
+        }
+        clock_gettime(CLOCK_MONOTONIC, &end);
+
+        if (p == NULL)
+            app_error("mm_malloc or mm_realloc error in eval_mm_latency");
+        if (trace->ops[i].type != FREE)
+            probes[nprobes++] = mm_fit_probes() - before;
+        trace->blocks[index] = p;
+        lat[i] = (end.tv_sec - start.tv_sec) * 1e9 + (end.tv_nsec - start.tv_nsec)
+            - overhead;
+        if (lat[i] < 0)
+            lat[i] = 0;
+    }
+
+    return nprobes;
+}
+
+/*
+ * timer_overhead - the least time in ns between two clock readings
+ */
+static double timer_overhead(void)
+{
+    struct timespec start, end;
+    double ns, best = -1;
+    int i;
+
+    for (i = 0; i < 1000; i++) {
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        ns = (end.tv_sec - start.tv_sec) * 1e9 + (end.tv_nsec - start.tv_nsec);
+        if (best < 0 || ns < best)
+            best = ns;
+    }
+    return best;
+}
+
+/*
+ * cmp_double - qsort comparison of doubles, in increasing order
+ */
+static int cmp_double(const void *a, const void *b)
+{
+    double x = *(const double *)a, y = *(const double *)b;
+
+    return (x > y) - (x < y);
+}
+
 /*
  * eval_libc_valid - We run this function to make sure that the
  *    libc malloc can run to completion on the set of traces.
@@ -880,11 +1602,494 @@ static void eval_libc_speed(void *ptr)
     }
 }
 
+/*
+ * eval_core_util - Check an mm_core allocator for correctness, as
+ *     eval_mm_valid does, and evaluate its space utilization on the
+ *     trace, as eval_mm_util does, in one pass. Returns -1 if the
+ *     allocator failed.
+ */
+static double eval_core_util(trace_t *trace, int tracenum, const mm_core_t *core,
+        range_t **ranges)
+{
+    int i, j;
+    int index, size, oldsize;
+    int total_size = 0;
+    int max_total_size = 0;
+    char *p, *oldp;
+
+    mem_reset_brk();
+    clear_ranges(ranges);
+    if (core->init() < 0) {
+        malloc_error(tracenum, 0, "mm_core init failed.");
+        return -1;
+    }
+
+    for (i = 0;  i < trace->num_ops;  i++) {
+        index = trace->ops[i].index;
+        size = trace->ops[i].size;
+
+        switch (trace->ops[i].type) {
+
+            case ALLOC: /* malloc */
+                if ((p = core->malloc(size)) == NULL) {
+                    malloc_error(tracenum, i, "mm_core malloc failed.");
+                    return -1;
+                }
+                if (add_range(ranges, p, size, tracenum, i) == 0)
+                    return -1;
+                memset(p, index & 0xFF, size);
+                trace->blocks[index] = p;
+                trace->block_sizes[index] = size;
+                total_size += size;
+                break;
+
+            case REALLOC: /* realloc, which must preserve the old data */
+                oldp = trace->blocks[index];
+                if ((p = core->realloc(oldp, size)) == NULL) {
+                    malloc_error(tracenum, i, "mm_core realloc failed.");
+                    return -1;
+                }
+                remove_range(ranges, oldp);
+                if (add_range(ranges, p, size, tracenum, i) == 0)
+                    return -1;
+                oldsize = trace->block_sizes[index];
+                for (j = 0; j < ((size < oldsize) ? size : oldsize); j++) {
+                    if ((unsigned char)p[j] != (index & 0xFF)) {
+                        malloc_error(tracenum, i, "mm_core realloc did not preserve "
+                                "the data from old block");
+                        return -1;
+                    }
+                }
+                memset(p, index & 0xFF, size);
+                trace->blocks[index] = p;
+                trace->block_sizes[index] = size;
+                total_size += size - oldsize;
+                break;
+
+            case FREE: /* free */
+                p = trace->blocks[index];
+                remove_range(ranges, p);
+                core->free(p);
+                total_size -= trace->block_sizes[index];
+                break;
+
+            default:
+                app_error("Nonexistent request type in eval_core_util");
+        }
+
+        max_total_size = (total_size > max_total_size) ?
+            total_size : max_total_size;
+    }
+
+    return ((double)max_total_size / (double)mem_total_heapsize());
+}
+
+/*
+ * eval_core_speed - This is the function that is used by fcyc()
+ *    to measure the running time of an mm_core allocator.
+ */
+static void eval_core_speed(void *ptr)
+{
+    int i, index;
+    trace_t *trace = ((speed_t *)ptr)->trace;
+    const mm_core_t *core = ((speed_t *)ptr)->core;
+    char *p;
+
+    mem_reset_brk();
+    if (core->init() < 0)
+        app_error("mm_core init failed in eval_core_speed");
+
+    for (i = 0;  i < trace->num_ops;  i++) {
+        index = trace->ops[i].index;
+        switch (trace->ops[i].type) {
+
+            case ALLOC: /* malloc */
+                if ((p = core->malloc(trace->ops[i].size)) == NULL)
+                    app_error("mm_core malloc failed in eval_core_speed");
+                trace->blocks[index] = p;
+                break;
+
+            case REALLOC: /* realloc */
+                if ((p = core->realloc(trace->blocks[index], trace->ops[i].size)) == NULL)
+                    app_error("mm_core realloc failed in eval_core_speed");
+                trace->blocks[index] = p;
+                break;
+
+            case FREE: /* free */
+                core->free(trace->blocks[index]);
+                break;
+
+            default:
+                app_error("Nonexistent request type in eval_core_speed");
+        }
+    }
+}
+
+/*
+ * region_replay - Replay request i of the trace on the region. Frees
+ *     only count live blocks; when none are left the region is reset.
+ *     Reallocs bump-allocate a new block and copy the old contents.
+ *     Returns 0 if the region ran out of memory, 1 otherwise.
+ */
+static int region_replay(trace_t *trace, mm_region_t *region, int i,
+        int *live)
+{
+    int index = trace->ops[i].index;
+    int size = trace->ops[i].size;
+    int oldsize;
+    char *p;
+
+    switch (trace->ops[i].type) {
+
+        case ALLOC: /* mm_region_alloc */
+            if ((p = mm_region_alloc(region, size)) == NULL)
+                return 0;
+            trace->blocks[index] = p;
+            trace->block_sizes[index] = size;
+            (*live)++;
+            break;
+
+        case REALLOC: /* mm_region_alloc and copy */
+            if ((p = mm_region_alloc(region, size)) == NULL)
+                return 0;
+            oldsize = trace->block_sizes[index];
+            memcpy(p, trace->blocks[index], (size < oldsize) ? size : oldsize);
+            trace->blocks[index] = p;
+            trace->block_sizes[index] = size;
+            break;
+
+        case FREE: /* the whole region goes at once */
+            if (--(*live) == 0)
+                mm_region_reset(region);
+            break;
+
+        default:
+            app_error("Nonexistent request type in region_replay");
+    }
+
+    return 1;
+}
+
+/*
+ * eval_region_util - Evaluate the space utilization of mm_region on
+ *     the trace, measured the same way as eval_mm_util. Returns -1 if
+ *     the region ran out of memory, which happens on traces whose
+ *     blocks are never all free at the same time.
+ */
+static double eval_region_util(trace_t *trace, int tracenum)
+{
+    int i;
+    int live = 0;
+    int total_size = 0;
+    int max_total_size = 0;
+    mm_region_t *region;
+
+    mem_reset_brk();
+    if (mm_init() < 0)
+        app_error("mm_init failed in eval_region_util");
+    if ((region = mm_region_create(0)) == NULL)
+        app_error("mm_region_create failed in eval_region_util");
+
+    for (i = 0;  i < trace->num_ops;  i++) {
+        int index = trace->ops[i].index;
+
+        /* Keep track of current total size of all live blocks */
+        if (trace->ops[i].type != ALLOC)
+            total_size -= trace->block_sizes[index];
+
+        if (!region_replay(trace, region, i, &live))
+            return -1;
+
+        if (trace->ops[i].type != FREE)
+            total_size += trace->block_sizes[index];
+
+        max_total_size = (total_size > max_total_size) ?
+            total_size : max_total_size;
+    }
+
+    mm_region_destroy(region);
+    return ((double)max_total_size / (double)mem_total_heapsize());
+}
+
+/*
+ * eval_region_speed - This is the function that is used by fcyc()
+ *    to measure the running time of the mm_region allocator.
+ */
+static void eval_region_speed(void *ptr)
+{
+    int i;
+    int live = 0;
+    trace_t *trace = ((speed_t *)ptr)->trace;
+    mm_region_t *region;
+
+    mem_reset_brk();
+    if (mm_init() < 0)
+        app_error("mm_init failed in eval_region_speed");
+    if ((region = mm_region_create(0)) == NULL)
+        app_error("mm_region_create failed in eval_region_speed");
+
+    for (i = 0;  i < trace->num_ops;  i++)
+        if (!region_replay(trace, region, i, &live))
+            app_error("mm_region_alloc failed in eval_region_speed");
+
+    mm_region_destroy(region);
+}
+
+/*****************************************************************
+ * The following routines replay a trace on several threads at
+ * once, to measure the scaling and contention of an allocator.
+ ****************************************************************/
+
+/*
+ * eval_mt_scaling - Replay the trace on 1, 2, 4, 8, ... max_threads
+ *     threads. Each thread replays its own copy of the trace, so the
+ *     total amount of work grows with the number of threads. Prints
+ *     per-thread and aggregate throughput, and the scaling efficiency
+ *     relative to the single-threaded run.
+ */
+static void eval_mt_scaling(trace_t *trace, mt_alloc_t *alloc,
+        int max_threads, int xfree_pct)
+{
+    mt_thread_t *threads;
+    pthread_barrier_t barrier;
+    double base_kops = 0;
+    double ops, secs, kops, best_kops;
+    int nthreads, i, run, failed;
+
+    if ((threads = calloc(max_threads, sizeof(mt_thread_t))) == NULL)
+        unix_error("calloc failed in eval_mt_scaling");
+
+    for (i = 0; i < max_threads; i++) {
+        threads[i].trace = trace;
+        threads[i].alloc = alloc;
+        threads[i].xfree_pct = xfree_pct;
+        threads[i].blocks = malloc(trace->num_ids * sizeof(char *));
+        threads[i].mailbox = malloc(trace->num_ids * sizeof(char *));
+        threads[i].drain = malloc(trace->num_ids * sizeof(char *));
+        if (!threads[i].blocks || !threads[i].mailbox || !threads[i].drain)
+            unix_error("malloc failed in eval_mt_scaling");
+        pthread_mutex_init(&threads[i].lock, NULL);
+    }
+
+    printf("Results for %s:\n", alloc->name);
+    printf("%7s%10s%7s  %s\n", "threads", "Kops", "eff", "per-thread Kops");
+
+    nthreads = 1;
+    while (1) {
+        best_kops = 0;
+        failed = 0;
+        for (run = 0; run < MT_RUNS && !failed; run++) {
+            alloc->reset();
+            pthread_barrier_init(&barrier, NULL, nthreads);
+            for (i = 0; i < nthreads; i++) {
+                threads[i].peer = &threads[(i + 1) % nthreads];
+                threads[i].barrier = &barrier;
+                threads[i].mailbox_count = 0;
+                threads[i].ops = 0;
+                threads[i].secs = 0;
+                threads[i].failed = 0;
+            }
+            for (i = 0; i < nthreads; i++)
+                if (pthread_create(&threads[i].tid, NULL, mt_replay,
+                            &threads[i]) != 0)
+                    unix_error("pthread_create failed in eval_mt_scaling");
+            ops = 0;
+            secs = 0;
+            for (i = 0; i < nthreads; i++) {
+                pthread_join(threads[i].tid, NULL);
+                ops += threads[i].ops;
+                if (threads[i].secs > secs)
+                    secs = threads[i].secs;
+                failed |= threads[i].failed;
+            }
+            pthread_barrier_destroy(&barrier);
+
+            kops = (ops / 1e3) / secs;
+            if (!failed && kops > best_kops)
+                best_kops = kops;
+        }
+
+        if (failed) {
+            printf("%7d%10s%7s  out of memory\n", nthreads, "-", "-");
+        } else {
+            if (nthreads == 1)
+                base_kops = best_kops;
+            printf("%7d%10.0f%6.0f%% ", nthreads, best_kops,
+                    100.0 * best_kops / (nthreads * base_kops));
+            for (i = 0; i < nthreads; i++)
+                printf(" %.0f", (threads[i].ops / 1e3) / threads[i].secs);
+            printf("\n");
+        }
+
+        if (nthreads == max_threads)
+            break;
+        nthreads = (2 * nthreads < max_threads) ? 2 * nthreads : max_threads;
+    }
+
+    for (i = 0; i < max_threads; i++) {
+        pthread_mutex_destroy(&threads[i].lock);
+        free(threads[i].blocks);
+        free(threads[i].mailbox);
+        free(threads[i].drain);
+    }
+    free(threads);
+}
+
+/*
+ * mt_replay - Thread routine for the multithreaded replay. Replays the
+ *     whole trace, handing the frees of selected block ids to the peer
+ *     thread and freeing whatever other threads handed to us. After
+ *     everyone is done with the trace, drain the mailbox one last time.
+ */
+static void *mt_replay(void *vargp)
+{
+    mt_thread_t *self = (mt_thread_t *)vargp;
+    trace_t *trace = self->trace;
+    mt_alloc_t *alloc = self->alloc;
+    struct timespec start, end;
+    int i, index;
+    char *p;
+
+    pthread_barrier_wait(self->barrier);
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    for (i = 0; i < trace->num_ops && !self->failed; i++) {
+        if (__atomic_load_n(&self->mailbox_count, __ATOMIC_RELAXED))
+            mt_drain(self);
+
+        index = trace->ops[i].index;
+        switch (trace->ops[i].type) {
+
+            case ALLOC: /* malloc */
+                if ((p = alloc->malloc(trace->ops[i].size)) == NULL)
+                    self->failed = 1;
+                self->blocks[index] = p;
+                self->ops++;
+                break;
+
+            case REALLOC: /* realloc */
+                p = alloc->realloc(self->blocks[index], trace->ops[i].size);
+                if (p == NULL)
+                    self->failed = 1;
+                self->blocks[index] = p;
+                self->ops++;
+                break;
+
+            case FREE: /* free, possibly on the peer thread */
+                p = self->blocks[index];
+                if ((unsigned)(index * 2654435761u) % 100 <
+                        (unsigned)self->xfree_pct) {
+                    pthread_mutex_lock(&self->peer->lock);
+                    self->peer->mailbox[self->peer->mailbox_count] = p;
+                    __atomic_store_n(&self->peer->mailbox_count,
+                            self->peer->mailbox_count + 1, __ATOMIC_RELAXED);
+                    pthread_mutex_unlock(&self->peer->lock);
+                } else {
+                    alloc->free(p);
+                    self->ops++;
+                }
+                break;
+
+            default:
+                app_error("Nonexistent request type in mt_replay");
+        }
+    }
+
+    /* no more frees can arrive once every thread passed the barrier */
+    pthread_barrier_wait(self->barrier);
+    mt_drain(self);
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    self->secs = (end.tv_sec - start.tv_sec) +
+        1e-9 * (end.tv_nsec - start.tv_nsec);
+    return NULL;
+}
+
+/*
+ * mt_drain - Free the blocks other threads handed to this thread.
+ *     The mailbox is swapped out under the lock and freed outside it.
+ */
+static void mt_drain(mt_thread_t *self)
+{
+    char **batch;
+    int i, count;
+
+    pthread_mutex_lock(&self->lock);
+    batch = self->mailbox;
+    count = self->mailbox_count;
+    self->mailbox = self->drain;
+    __atomic_store_n(&self->mailbox_count, 0, __ATOMIC_RELAXED);
+    pthread_mutex_unlock(&self->lock);
+
+    for (i = 0; i < count; i++)
+        self->alloc->free(batch[i]);
+    self->ops += count;
+    self->drain = batch;
+}
+
+/*
+ * mt_mm_reset - Reset the simulated heap and reinitialize the mm package
+ */
+static void mt_mm_reset(void)
+{
+    mem_reset_brk();
+    if (mm_init() < 0)
+        app_error("mm_init failed in mt_mm_reset");
+}
+
+static void *mt_mm_malloc(size_t size)
+{
+    void *p;
+
+    pthread_mutex_lock(&mt_mm_lock);
+    p = mm_malloc(size);
+    pthread_mutex_unlock(&mt_mm_lock);
+    return p;
+}
+
+static void mt_mm_free(void *ptr)
+{
+    pthread_mutex_lock(&mt_mm_lock);
+    mm_free(ptr);
+    pthread_mutex_unlock(&mt_mm_lock);
+}
+
+static void *mt_mm_realloc(void *ptr, size_t size)
+{
+    void *p;
+
+    pthread_mutex_lock(&mt_mm_lock);
+    p = mm_realloc(ptr, size);
+    pthread_mutex_unlock(&mt_mm_lock);
+    return p;
+}
+
+/*
+ * mt_libc_reset - libc malloc needs no preparation between runs
+ */
+static void mt_libc_reset(void)
+{
+}
+
 /*************************************
  * Some miscellaneous helper routines
  ************************************/
 
 
+/*
+ * write_profile - dump the mm heap profile to a file
+ */
+static void write_profile(char *filename, int format)
+{
+    FILE *fp;
+
+    if ((fp = fopen(filename, "w")) == NULL)
+        unix_error("Could not open profile file in write_profile");
+    if (mm_prof_dump(fp, format) < 0)
+        unix_error("Could not write profile in write_profile");
+    fclose(fp);
+}
+
 /*
  * printresults - prints a performance summary for some malloc package
  */
@@ -974,14 +2179,26 @@ void malloc_error(int tracenum, int opnum, char *msg)
  */
 static void usage(void)
 {
-    fprintf(stderr, "Usage: mdriver [-hvVal] [-f <file>] [-t <dir>]\n");
+    fprintf(stderr, "Usage: mdriver [-hvValRCHc] [-f <file>] [-t <dir>] [-p <fit>] [-s <split>]\n");
+    fprintf(stderr, "               [-O <order>] [-T <n>] [-x <pct>] [-P <rate>] [-J <runs>]\n");
     fprintf(stderr, "Options\n");
     fprintf(stderr, "\t-a         Don't check the team structure.\n");
+    fprintf(stderr, "\t-c         Replay through mm_halloc, then mm_compact and check the blocks.\n");
+    fprintf(stderr, "\t-C         Run the prebuilt mm_core allocators as well.\n");
     fprintf(stderr, "\t-f <file>  Use <file> as the trace file.\n");
     fprintf(stderr, "\t-g         Generate summary info for autograder.\n");
     fprintf(stderr, "\t-h         Print this message.\n");
+    fprintf(stderr, "\t-H         Place every mm allocation with mm_malloc_hint.\n");
+    fprintf(stderr, "\t-J <runs>  Run every trace runs times, print JSON for mdcompare.pl.\n");
     fprintf(stderr, "\t-l         Run libc malloc as well.\n");
+    fprintf(stderr, "\t-p <fit>   mm fit policy: first, next, best[:K] or bounded[:K].\n");
+    fprintf(stderr, "\t-O <order> mm free list order: lifo or address.\n");
+    fprintf(stderr, "\t-P <rate>  Sample mm allocations every rate bytes, write a heap profile.\n");
+    fprintf(stderr, "\t-R         Run the mm_region allocator as well.\n");
+    fprintf(stderr, "\t-s <split> mm split policy: MIN[:RIGHT] bytes.\n");
     fprintf(stderr, "\t-t <dir>   Directory to find default traces.\n");
+    fprintf(stderr, "\t-T <n>     Replay on 1, 2, 4, ... n threads (0: all CPUs).\n");
     fprintf(stderr, "\t-v         Print per-trace performance breakdowns.\n");
     fprintf(stderr, "\t-V         Print additional debug info.\n");
+    fprintf(stderr, "\t-x <pct>   With -T, free pct%% of blocks on another thread.\n");
 }
@@ -8,30 +8,146 @@
 #include <assert.h>
 #include <unistd.h>
 #include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
 #include <string.h>
+#include <stdint.h>
 #include <errno.h>
+#include <pthread.h>
 
 #include "memlib.h"
 #include "config.h"
 
+/*
+ * A region of the simulated memory. The heap that mem_sbrk grows is one,
+ * and mem_region_create carves out more, for allocators that keep
+ * several independent heaps (arenas). Each region reserves its own
+ * address space, and commits it as its brk pointer advances.
+ *
+ * The brk pointer of a region is advanced with a compare-and-swap, so
+ * threads may call mem_sbrk and mem_region_sbrk at the same time.
+ * Committing more of a region takes its commit_lock.
+ */
+struct mem_region {
+    char *start_brk;        /* points to first byte of the region */
+    char *brk;              /* points to last byte of the region, plus one */
+    char *max_addr;         /* largest legal region address */
+    char *commit_brk;       /* end of the committed part of the region */
+    char *map_start;        /* start of the reserved mapping */
+    size_t map_size;        /* size of the reserved mapping */
+    pthread_mutex_t commit_lock;
+    mem_region_t *next;     /* next carved region */
+};
+
 /* private variables */
-static char *mem_start_brk;  /* points to first byte of heap */
-static char *mem_brk;        /* points to last byte of heap */
-static char *mem_max_addr;   /* largest legal heap address */
+static mem_region_t mem_heap;           /* the heap of mem_sbrk */
+static mem_region_t *mem_regions;       /* regions from mem_region_create */
+static pthread_mutex_t mem_regions_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/*
+ * File backend (mem_init_file). The first page of the file holds a
+ * header, and the heap follows it. Committed parts of the heap are
+ * mapped MAP_SHARED from the file instead of being made accessible.
+ */
+#define MEM_FILE_MAGIC "memlib1"
+
+typedef struct {
+    char magic[8];               /* MEM_FILE_MAGIC */
+    unsigned long long brk;      /* heap size in bytes */
+} mem_file_hdr_t;
+
+static int mem_fd = -1;             /* heap file, or -1 for anonymous memory */
+static mem_file_hdr_t *mem_hdr;     /* mapped header page of the heap file */
+static size_t mem_file_off;         /* file offset of the first heap byte */
+static size_t mem_file_size;        /* current size of the heap file */
+
+static int mem_reserve(mem_region_t *r, size_t size);
+static int mem_commit(mem_region_t *r, char *new_brk);
+static void mem_release_regions(void);
+static void mem_region_free(mem_region_t *r);
 
 /*
  * mem_init - initialize the memory system model
  */
 void mem_init(void)
 {
-    /* allocate the storage we will use to model the available VM */
-    if ((mem_start_brk = (char *)malloc(MAX_HEAP)) == NULL) {
-        fprintf(stderr, "mem_init_vm: malloc error\n");
+    if (mem_reserve(&mem_heap, MAX_HEAP) < 0) {
+        fprintf(stderr, "mem_init_vm: mmap error\n");
         exit(1);
     }
+}
+
+/*
+ * mem_reserve - reserve the address space a region of size bytes will
+ *    use to model the available VM. Nothing is committed yet; the sbrk
+ *    functions commit pages as brk advances. Reserves one extra chunk
+ *    so the region start can be chunk aligned.
+ */
+static int mem_reserve(mem_region_t *r, size_t size)
+{
+    r->map_size = size + MEM_COMMIT_CHUNK;
+    r->map_start = mmap(NULL, r->map_size, PROT_NONE,
+            MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (r->map_start == MAP_FAILED)
+        return -1;
+
+    r->start_brk = (char *)(((uintptr_t)r->map_start + MEM_COMMIT_CHUNK - 1)
+            & ~(uintptr_t)(MEM_COMMIT_CHUNK - 1));
+#if MEM_HUGEPAGES && defined(MADV_HUGEPAGE)
+    madvise(r->start_brk, size, MADV_HUGEPAGE);
+#endif
 
-    mem_max_addr = mem_start_brk + MAX_HEAP;  /* max legal heap address */
-    mem_brk = mem_start_brk;                  /* heap is empty initially */
+    r->max_addr = r->start_brk + size;    /* max legal region address */
+    r->brk = r->start_brk;                /* region is empty initially */
+    r->commit_brk = r->start_brk;         /* nothing committed yet */
+    pthread_mutex_init(&r->commit_lock, NULL);
+    r->next = NULL;
+    return 0;
+}
+
+/*
+ * mem_init_file - initialize the memory system model with a heap kept in
+ *    the file at path, which is created if needed. The heap is mapped
+ *    MAP_SHARED, so it outlives the process. If the file already holds a
+ *    heap, it is mapped back in with its old brk pointer, and 1 is
+ *    returned. Otherwise the heap starts out empty and 0 is returned.
+ */
+int mem_init_file(const char *path)
+{
+    struct stat st;
+    char *brk;
+
+    mem_init();
+
+    mem_file_off = mem_pagesize();
+    if ((mem_fd = open(path, O_RDWR | O_CREAT, 0644)) < 0 ||
+            fstat(mem_fd, &st) < 0 ||
+            ((size_t)st.st_size < mem_file_off && ftruncate(mem_fd, mem_file_off) < 0)) {
+        fprintf(stderr, "mem_init_file: cannot open %s: %s\n", path, strerror(errno));
+        exit(1);
+    }
+    mem_file_size = (size_t)st.st_size < mem_file_off ? mem_file_off : (size_t)st.st_size;
+
+    mem_hdr = mmap(NULL, mem_file_off, PROT_READ | PROT_WRITE, MAP_SHARED, mem_fd, 0);
+    if (mem_hdr == MAP_FAILED) {
+        fprintf(stderr, "mem_init_file: mmap error\n");
+        exit(1);
+    }
+
+    /* anything but a heap of a plausible size starts over */
+    if (memcmp(mem_hdr->magic, MEM_FILE_MAGIC, sizeof(mem_hdr->magic)) != 0 ||
+            mem_hdr->brk > mem_file_size - mem_file_off || mem_hdr->brk > MAX_HEAP) {
+        memcpy(mem_hdr->magic, MEM_FILE_MAGIC, sizeof(mem_hdr->magic));
+        mem_hdr->brk = 0;
+    }
+
+    brk = mem_heap.start_brk + mem_hdr->brk;
+    if (mem_commit(&mem_heap, brk) < 0) {
+        fprintf(stderr, "mem_init_file: cannot map %s: %s\n", path, strerror(errno));
+        exit(1);
+    }
+    mem_heap.brk = brk;
+    return mem_heap.brk > mem_heap.start_brk;
 }
 
 /*
@@ -39,33 +155,102 @@ void mem_init(void)
  */
 void mem_deinit(void)
 {
-    free(mem_start_brk);
+    mem_release_regions();
+    munmap(mem_heap.map_start, mem_heap.map_size);
+    if (mem_fd >= 0) {
+        munmap(mem_hdr, mem_file_off);
+        close(mem_fd);
+        mem_fd = -1;
+        mem_hdr = NULL;
+    }
 }
 
 /*
- * mem_reset_brk - reset the simulated brk pointer to make an empty heap
+ * mem_sync - write a file-backed heap back to its file, so it also
+ *    survives a crash of the machine and not just of the process
+ */
+int mem_sync(void)
+{
+    if (mem_fd < 0)
+        return 0;
+
+    if (msync(mem_heap.start_brk, mem_heap.commit_brk - mem_heap.start_brk, MS_SYNC) < 0 ||
+            msync(mem_hdr, mem_file_off, MS_SYNC) < 0)
+        return -1;
+    return 0;
+}
+
+/*
+ * mem_reset_brk - reset the simulated brk pointer to make an empty heap.
+ *    The regions carved out with mem_region_create are released as well,
+ *    so the whole simulated memory starts over
  */
 void mem_reset_brk()
 {
-    mem_brk = mem_start_brk;
+    mem_heap.brk = mem_heap.start_brk;
+    if (mem_hdr != NULL)
+        mem_hdr->brk = 0;
+    mem_release_regions();
 }
 
 /*
- * mem_sbrk - simple model of the sbrk function. Extends the heap
- *    by incr bytes and returns the start address of the new area. In
- *    this model, the heap cannot be shrunk.
+ * mem_commit - make the reserved region readable and writable up to at
+ *    least new_brk. Commits whole MEM_COMMIT_CHUNK steps at a time.
  */
-void *mem_sbrk(int incr)
+static int mem_commit(mem_region_t *r, char *new_brk)
 {
-    char *old_brk = mem_brk;
+    char *new_commit;
+    int rc = 0;
+
+    if (new_brk <= __atomic_load_n(&r->commit_brk, __ATOMIC_ACQUIRE))
+        return 0;
+
+    pthread_mutex_lock(&r->commit_lock);
+    if (new_brk <= r->commit_brk)
+        goto out;
+
+    new_commit = r->start_brk +
+        ((new_brk - r->start_brk + MEM_COMMIT_CHUNK - 1)
+         & ~(size_t)(MEM_COMMIT_CHUNK - 1));
+    if (new_commit > r->max_addr)
+        new_commit = r->max_addr;
+
+    if (r == &mem_heap && mem_fd >= 0) {
+        /* map the next part of the heap file over the reservation */
+        size_t file_size = mem_file_off + (new_commit - r->start_brk);
 
-    if ( (incr < 0) || ((mem_brk + incr) > mem_max_addr)) {
-        errno = ENOMEM;
-        fprintf(stderr, "ERROR: mem_sbrk failed. Ran out of memory...\n");
-        return (void *)-1;
+        if (file_size > mem_file_size) {
+            if (ftruncate(mem_fd, file_size) < 0) {
+                rc = -1;
+                goto out;
+            }
+            mem_file_size = file_size;
+        }
+        if (mmap(r->commit_brk, new_commit - r->commit_brk,
+                    PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, mem_fd,
+                    mem_file_off + (r->commit_brk - r->start_brk)) == MAP_FAILED) {
+            rc = -1;
+            goto out;
+        }
+    } else if (mprotect(r->commit_brk, new_commit - r->commit_brk,
+                PROT_READ | PROT_WRITE) < 0) {
+        rc = -1;
+        goto out;
     }
-    mem_brk += incr;
-    return (void *)old_brk;
+    __atomic_store_n(&r->commit_brk, new_commit, __ATOMIC_RELEASE);
+out:
+    pthread_mutex_unlock(&r->commit_lock);
+    return rc;
+}
+
+/*
+ * mem_sbrk - simple model of the sbrk function. Extends the heap
+ *    by incr bytes and returns the start address of the new area. A
+ *    negative incr shrinks the heap, but never below its start.
+ */
+void *mem_sbrk(int incr)
+{
+    return mem_region_sbrk(&mem_heap, incr);
 }
 
 /*
@@ -73,7 +258,7 @@ void *mem_sbrk(int incr)
  */
 void *mem_heap_lo()
 {
-    return (void *)mem_start_brk;
+    return mem_region_heap_lo(&mem_heap);
 }
 
 /*
@@ -81,7 +266,7 @@ void *mem_heap_lo()
  */
 void *mem_heap_hi()
 {
-    return (void *)(mem_brk - 1);
+    return mem_region_heap_hi(&mem_heap);
 }
 
 /*
@@ -89,7 +274,7 @@ void *mem_heap_hi()
  */
 size_t mem_heapsize()
 {
-    return (size_t)(mem_brk - mem_start_brk);
+    return mem_region_heapsize(&mem_heap);
 }
 
 /*
@@ -99,3 +284,160 @@ size_t mem_pagesize()
 {
     return (size_t)getpagesize();
 }
+
+/*
+ * mem_region_create - carve out a new, empty region of at most size
+ *    bytes, independent of the heap and of every other region. Returns
+ *    NULL if the address space cannot be reserved
+ */
+mem_region_t *mem_region_create(size_t size)
+{
+    mem_region_t *r;
+
+    if (size == 0 || (r = malloc(sizeof(mem_region_t))) == NULL)
+        return NULL;
+    if (mem_reserve(r, size) < 0) {
+        free(r);
+        return NULL;
+    }
+
+    pthread_mutex_lock(&mem_regions_lock);
+    r->next = mem_regions;
+    mem_regions = r;
+    pthread_mutex_unlock(&mem_regions_lock);
+    return r;
+}
+
+/*
+ * mem_region_destroy - release a region and everything in it
+ */
+void mem_region_destroy(mem_region_t *r)
+{
+    mem_region_t **rp;
+
+    pthread_mutex_lock(&mem_regions_lock);
+    for (rp = &mem_regions; *rp != NULL; rp = &(*rp)->next) {
+        if (*rp == r) {
+            *rp = r->next;
+            mem_region_free(r);
+            break;
+        }
+    }
+    pthread_mutex_unlock(&mem_regions_lock);
+}
+
+/*
+ * mem_release_regions - release every region from mem_region_create
+ */
+static void mem_release_regions(void)
+{
+    mem_region_t *r;
+
+    pthread_mutex_lock(&mem_regions_lock);
+    while ((r = mem_regions) != NULL) {
+        mem_regions = r->next;
+        mem_region_free(r);
+    }
+    pthread_mutex_unlock(&mem_regions_lock);
+}
+
+/*
+ * mem_region_free - unmap a region that is no longer on mem_regions
+ */
+static void mem_region_free(mem_region_t *r)
+{
+    munmap(r->map_start, r->map_size);
+    pthread_mutex_destroy(&r->commit_lock);
+    free(r);
+}
+
+/*
+ * mem_region_sbrk - mem_sbrk on region r. Safe to call from several
+ *    threads at once: the brk pointer is advanced with a compare-and-swap
+ *    once the pages it covers are committed, so each caller gets its own
+ *    area. Committed pages are never given back, so a failed swap just
+ *    retries
+ */
+void *mem_region_sbrk(mem_region_t *r, int incr)
+{
+    char *old_brk = __atomic_load_n(&r->brk, __ATOMIC_ACQUIRE);
+
+    do {
+        if ( (incr < 0 && -incr > old_brk - r->start_brk) ||
+                (incr > r->max_addr - old_brk) ||
+                (mem_commit(r, old_brk + incr) < 0)) {
+            errno = ENOMEM;
+            fprintf(stderr, "ERROR: mem_sbrk failed. Ran out of memory...\n");
+            return (void *)-1;
+        }
+    } while (!__atomic_compare_exchange_n(&r->brk, &old_brk, old_brk + incr,
+                1, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE));
+
+    /* the last thread to take the lock writes the latest brk */
+    if (r == &mem_heap && mem_hdr != NULL) {
+        pthread_mutex_lock(&r->commit_lock);
+        mem_hdr->brk = __atomic_load_n(&r->brk, __ATOMIC_ACQUIRE) - r->start_brk;
+        pthread_mutex_unlock(&r->commit_lock);
+    }
+    return (void *)old_brk;
+}
+
+/*
+ * mem_region_heap_lo - return address of the first byte of region r
+ */
+void *mem_region_heap_lo(mem_region_t *r)
+{
+    return (void *)r->start_brk;
+}
+
+/*
+ * mem_region_heap_hi - return address of the last byte of region r
+ */
+void *mem_region_heap_hi(mem_region_t *r)
+{
+    return (void *)(__atomic_load_n(&r->brk, __ATOMIC_ACQUIRE) - 1);
+}
+
+/*
+ * mem_region_heapsize - returns the size of region r in bytes
+ */
+size_t mem_region_heapsize(mem_region_t *r)
+{
+    return (size_t)(__atomic_load_n(&r->brk, __ATOMIC_ACQUIRE) - r->start_brk);
+}
+
+/*
+ * mem_total_heapsize - returns the size of the heap and of every region,
+ *    in bytes
+ */
+size_t mem_total_heapsize()
+{
+    size_t size = mem_heapsize();
+    mem_region_t *r;
+
+    pthread_mutex_lock(&mem_regions_lock);
+    for (r = mem_regions; r != NULL; r = r->next)
+        size += mem_region_heapsize(r);
+    pthread_mutex_unlock(&mem_regions_lock);
+    return size;
+}
+
+/*
+ * mem_in_heap - is lo..hi inside the heap or inside one region?
+ */
+int mem_in_heap(const void *lo, const void *hi)
+{
+    mem_region_t *r;
+    int found = 0;
+
+    if ((char *)lo >= mem_heap.start_brk && (char *)hi <= (char *)mem_heap_hi() &&
+            lo <= hi)
+        return 1;
+
+    pthread_mutex_lock(&mem_regions_lock);
+    for (r = mem_regions; r != NULL && !found; r = r->next)
+        found = (char *)lo >= r->start_brk &&
+            (char *)hi <= (char *)mem_region_heap_hi(r) && lo <= hi;
+    pthread_mutex_unlock(&mem_regions_lock);
+    return found;
+}
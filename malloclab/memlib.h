@@ -1,7 +1,9 @@
 #include <unistd.h>
 
 void mem_init(void);               
+int mem_init_file(const char *path);
 void mem_deinit(void);
+int mem_sync(void);
 void *mem_sbrk(int incr);
 void mem_reset_brk(void); 
 void *mem_heap_lo(void);
@@ -9,3 +11,15 @@ void *mem_heap_hi(void);
 size_t mem_heapsize(void);
 size_t mem_pagesize(void);
 
+
+/* independent regions of the simulated memory, for arenas. see memlib.c */
+typedef struct mem_region mem_region_t;
+
+mem_region_t *mem_region_create(size_t size);
+void mem_region_destroy(mem_region_t *r);
+void *mem_region_sbrk(mem_region_t *r, int incr);
+void *mem_region_heap_lo(mem_region_t *r);
+void *mem_region_heap_hi(mem_region_t *r);
+size_t mem_region_heapsize(mem_region_t *r);
+size_t mem_total_heapsize(void);
+int mem_in_heap(const void *lo, const void *hi);
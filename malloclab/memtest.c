@@ -0,0 +1,279 @@
+/*
+ * memtest.c - test of concurrent mem_sbrk and mem_region_sbrk calls
+ *
+ * memlib advances the brk pointer of the heap and of every region with a
+ * compare-and-swap, so several threads may grow them at the same time.
+ * This test starts threads that all grow either the heap or one shared
+ * region by random amounts, and fill each area they get with their own
+ * byte. Afterwards the areas of each brk must tile it exactly: sorted by
+ * address, every area starts where the one before ended, the first starts
+ * at the low end and the last ends at the high end, their sizes add up to
+ * the size of the heap or region, and every area still holds the byte of
+ * the thread that got it.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "memlib.h"
+
+/**********************
+ * Constants and macros
+ **********************/
+#define DEFAULT_THREADS  4       /* threads, alternating heap and region */
+#define DEFAULT_OPS      10000   /* sbrk calls per thread */
+#define MAX_INCR         1024    /* largest increment, in bytes */
+#define INCR_ALIGN       8       /* increments are multiples of this */
+
+/* An area returned by one sbrk call */
+typedef struct {
+    char *ptr;
+    int size;
+    int id;                      /* byte the owning thread filled it with */
+} area_t;
+
+/* Per-thread state */
+typedef struct {
+    pthread_t tid;
+    mem_region_t *region;        /* region to grow, or NULL for the heap */
+    area_t *areas;
+    int id;
+    int ops;
+    int failed;                  /* an sbrk call failed */
+} worker_t;
+
+static pthread_barrier_t start_barrier;
+
+/*********************
+ * Function prototypes
+ *********************/
+static void *worker(void *vargp);
+static int check(const char *name, worker_t *workers, int nworkers,
+        mem_region_t *region, char *lo, char *hi, size_t heapsize);
+static int compare_areas(const void *a, const void *b);
+static void usage(void);
+static void unix_error(char *msg);
+static void app_error(char *msg);
+
+/**************
+ * Main routine
+ **************/
+int main(int argc, char **argv)
+{
+    int nthreads = DEFAULT_THREADS;
+    int ops = DEFAULT_OPS;
+    worker_t *workers;
+    mem_region_t *region;
+    size_t heapsize, regionsize;
+    int i, c, rc, errors = 0;
+
+    while ((c = getopt(argc, argv, "t:n:h")) != EOF) {
+        switch (c) {
+            case 't': /* Threads */
+                nthreads = atoi(optarg);
+                break;
+            case 'n': /* sbrk calls per thread */
+                ops = atoi(optarg);
+                break;
+            case 'h': /* Print this message */
+                usage();
+                exit(0);
+            default:
+                usage();
+                exit(1);
+        }
+    }
+    if (nthreads < 1 || nthreads > 255 || ops < 1) {
+        usage();
+        exit(1);
+    }
+
+    mem_init();
+    if ((region = mem_region_create((size_t)nthreads * ops * MAX_INCR)) == NULL)
+        app_error("mem_region_create failed");
+    if ((workers = calloc(nthreads, sizeof(worker_t))) == NULL)
+        unix_error("calloc failed");
+    if ((rc = pthread_barrier_init(&start_barrier, NULL, nthreads)) != 0)
+        app_error("pthread_barrier_init failed");
+
+    for (i = 0; i < nthreads; i++) {
+        workers[i].region = (i % 2) ? region : NULL;
+        workers[i].id = i + 1;
+        workers[i].ops = ops;
+        if ((workers[i].areas = malloc(ops * sizeof(area_t))) == NULL)
+            unix_error("malloc failed");
+    }
+    for (i = 0; i < nthreads; i++)
+        if ((rc = pthread_create(&workers[i].tid, NULL, worker, &workers[i])) != 0)
+            app_error("pthread_create failed");
+    for (i = 0; i < nthreads; i++) {
+        pthread_join(workers[i].tid, NULL);
+        if (workers[i].failed) {
+            printf("thread %d: sbrk failed\n", workers[i].id);
+            errors++;
+        }
+    }
+
+    heapsize = mem_heapsize();
+    regionsize = mem_region_heapsize(region);
+    errors += check("heap", workers, nthreads, NULL,
+            mem_heap_lo(), mem_heap_hi(), heapsize);
+    errors += check("region", workers, nthreads, region,
+            mem_region_heap_lo(region), mem_region_heap_hi(region), regionsize);
+    if (mem_total_heapsize() != heapsize + regionsize) {
+        printf("total: %lu bytes, expected %lu\n",
+                (unsigned long)mem_total_heapsize(),
+                (unsigned long)(heapsize + regionsize));
+        errors++;
+    }
+
+    mem_region_destroy(region);
+    if (mem_total_heapsize() != heapsize) {
+        printf("total after mem_region_destroy: %lu bytes, expected %lu\n",
+                (unsigned long)mem_total_heapsize(), (unsigned long)heapsize);
+        errors++;
+    }
+
+    for (i = 0; i < nthreads; i++)
+        free(workers[i].areas);
+    free(workers);
+    pthread_barrier_destroy(&start_barrier);
+    mem_deinit();
+
+    if (errors) {
+        printf("memtest: FAILED, %d errors\n", errors);
+        exit(1);
+    }
+    printf("memtest: ok, %d threads, %d sbrk calls each\n", nthreads, ops);
+    exit(0);
+}
+
+/*
+ * worker - Grow the heap or the region of w by random amounts, and fill
+ *     every area with the id of w
+ */
+static void *worker(void *vargp)
+{
+    worker_t *w = (worker_t *)vargp;
+    unsigned int seed = w->id;
+    char *p;
+    int i, size;
+
+    pthread_barrier_wait(&start_barrier);
+    for (i = 0; i < w->ops; i++) {
+        size = (rand_r(&seed) % (MAX_INCR / INCR_ALIGN) + 1) * INCR_ALIGN;
+        p = w->region ? mem_region_sbrk(w->region, size) : mem_sbrk(size);
+        if (p == (char *)-1) {
+            w->failed = 1;
+            break;
+        }
+        memset(p, w->id, size);
+        w->areas[i].ptr = p;
+        w->areas[i].size = size;
+        w->areas[i].id = w->id;
+    }
+    w->ops = i;
+    return NULL;
+}
+
+/*
+ * check - Check that the areas the workers got from region (or the heap,
+ *     if region is NULL) tile lo..hi exactly and still hold their bytes.
+ *     Returns the number of errors
+ */
+static int check(const char *name, worker_t *workers, int nworkers,
+        mem_region_t *region, char *lo, char *hi, size_t heapsize)
+{
+    area_t *areas;
+    char *next = lo;
+    size_t total = 0;
+    int i, j, n = 0, errors = 0;
+
+    for (i = 0; i < nworkers; i++)
+        if (workers[i].region == region)
+            n += workers[i].ops;
+    if ((areas = malloc((n ? n : 1) * sizeof(area_t))) == NULL)
+        unix_error("malloc failed");
+    for (i = 0, n = 0; i < nworkers; i++)
+        if (workers[i].region == region)
+            for (j = 0; j < workers[i].ops; j++)
+                areas[n++] = workers[i].areas[j];
+    qsort(areas, n, sizeof(area_t), compare_areas);
+
+    for (i = 0; i < n; i++) {
+        if (areas[i].ptr != next) {
+            printf("%s: area %p of thread %d starts at offset %ld, expected %ld\n",
+                    name, areas[i].ptr, areas[i].id,
+                    (long)(areas[i].ptr - lo), (long)(next - lo));
+            errors++;
+        }
+        for (j = 0; j < areas[i].size; j++) {
+            if (areas[i].ptr[j] != (char)areas[i].id) {
+                printf("%s: area %p of thread %d was overwritten at byte %d\n",
+                        name, areas[i].ptr, areas[i].id, j);
+                errors++;
+                break;
+            }
+        }
+        next = areas[i].ptr + areas[i].size;
+        total += areas[i].size;
+    }
+    if (next != hi + 1) {
+        printf("%s: areas end at offset %ld, expected %ld\n",
+                name, (long)(next - lo), (long)(hi + 1 - lo));
+        errors++;
+    }
+    if (total != heapsize) {
+        printf("%s: areas add up to %lu bytes, size is %lu\n",
+                name, (unsigned long)total, (unsigned long)heapsize);
+        errors++;
+    }
+
+    free(areas);
+    return errors;
+}
+
+/*
+ * compare_areas - qsort comparison of areas by address
+ */
+static int compare_areas(const void *a, const void *b)
+{
+    const char *pa = ((const area_t *)a)->ptr;
+    const char *pb = ((const area_t *)b)->ptr;
+
+    return (pa > pb) - (pa < pb);
+}
+
+/*
+ * usage - Explain the command line arguments
+ */
+static void usage(void)
+{
+    fprintf(stderr, "Usage: memtest [-h] [-t <threads>] [-n <calls>]\n");
+    fprintf(stderr, "Options\n");
+    fprintf(stderr, "\t-h            Print this message.\n");
+    fprintf(stderr, "\t-n <calls>    sbrk calls per thread (default %d).\n",
+            DEFAULT_OPS);
+    fprintf(stderr, "\t-t <threads>  Threads, alternating heap and region (default %d).\n",
+            DEFAULT_THREADS);
+}
+
+/*
+ * unix_error - Report a Unix-style error and terminate
+ */
+static void unix_error(char *msg)
+{
+    perror(msg);
+    exit(1);
+}
+
+/*
+ * app_error - Report an application error and terminate
+ */
+static void app_error(char *msg)
+{
+    printf("%s\n", msg);
+    exit(1);
+}
@@ -2,7 +2,8 @@
  *
  * Here, I use a segregated list approach, maintaining a linked list for
  * size classes of the pattern [2 ^ n, 2 ^ n+1).
- * New free blocks are inserted at the very front, and re-allocation attempts
+ * New free blocks are inserted at the very front, or in address order (see
+ * mm_set_order_policy), and re-allocation attempts
  * to optimize performance by searching its previous and next blocks.
  *
  */
@@ -11,9 +12,11 @@
 #include <assert.h>
 #include <unistd.h>
 #include <string.h>
+#include <limits.h>
 
 #include "mm.h"
 #include "memlib.h"
+#include "mm_prof.h"
 
 /* single word (4) or double word (8) alignment */
 #define ALIGNMENT 8
@@ -35,22 +38,46 @@
 #define GET(p)          (*(unsigned int *)(p))
 #define PUT(p, val)     (*(unsigned int *)(p) = (val))
 
-#define GETP(p)         (*(char **)(p))
-#define PUTP(p, val)    (*(char **)(p) = (val))
+/* Read and write a pointer into the heap at address p. it is stored as a   */
+/* word offset from the start of the heap, so the heap may be mapped at a   */
+/* different address by the next process. offset 0 is the first size class */
+/* head, which is never pointed to, and stands for NULL                     */
+#define GETP(p)         (GET(p) ? heap_start + (size_t)GET(p) * WSIZE : (char *)NULL)
+#define PUTP(p, val)    PUT(p, (val) ? (unsigned int)((size_t)((char *)(val) - heap_start) / WSIZE) : 0)
 
 #define GET_SIZE(p)     (GET(p) & ~0x7)
 #define GET_ALLOC(p)    (GET(p) & 0x1)
 
+/* realloc history, kept in the spare header bits of allocated blocks */
+#define GROWN_BIT       0x2     // block has been grown by mm_realloc
+#define SLACK_BIT       0x4     // block reserves slack for further growth
+#define GET_GROWN(p)    (GET(p) & GROWN_BIT)
+#define GET_SLACK(p)    ((GET(p) & (GROWN_BIT | SLACK_BIT)) == (GROWN_BIT | SLACK_BIT))
+
+/* a slack bit without the grown bit never occurs otherwise, and marks a handle block */
+#define HANDLE_BIT      SLACK_BIT
+#define GET_HANDLE(p)   ((GET(p) & (GROWN_BIT | SLACK_BIT)) == HANDLE_BIT)
+
+/* requested size of a block with slack, or handle of a handle block, */
+/* kept in its last payload word                                      */
+#define TAGP(bp)        (FTRP(bp) - WSIZE)
+
+/* handle table entry: block pointer and pin count, or next free entry */
+#define HENTRY(h)       (GETP(HANDLES) + ((h) - 1) * DSIZE)
+#define HPTR(h)         GETP(HENTRY(h))
+#define HPINS(h)        (HENTRY(h) + WSIZE)
+#define HANDLE_TABLE_MIN 16   // entries in a freshly created handle table
+
 /* bp starts at payload */
 #define HDRP(bp)        ((char *)(bp) - WSIZE)
 /* since bp starts at payload, subtract double word size */
 #define FTRP(bp)        ((char *)(bp) + GET_SIZE(HDRP(bp)) - DSIZE)
 
 /* get address of next free block. effective equivalent of GETP */
-#define GET_NEXTP(bp)   (*(char **)(bp))
+#define GET_NEXTP(bp)   GETP(bp)
 
 /* get address of previous free block */
-#define GET_PREVP(bp)   (*((char **)((bp) + WSIZE)))  // get pp from bp
+#define GET_PREVP(bp)   GETP((char *)(bp) + WSIZE)  // get pp from bp
 
 #define ADJ_PREVP(bp)   ((char *)(bp) + WSIZE)  // get pp from bp
 #define ADJ_NEXTP(pp)   ((char *)(pp) - WSIZE)  // get bp from pp
@@ -63,6 +90,70 @@
 /* number of `size classes` */
 #define SIZE_CLASS_SIZE 10
 
+/*
+Address order:
+each free list is also a skip list, so a block finds its place in
+logarithmic time. level 0 is the free list itself. a block of more than
+2 * DSIZE bytes keeps its level right after its links, followed by its
+link on every level above 0; a block of 2 * DSIZE bytes has no room and
+is only on level 0. the heads of levels above 0 live in a block that
+mm_init allocates, see SKIP_HEADS
+*/
+#define SKIP_LEVELS         8
+#define SKIP_LEVELP(bp)     ((char *)(bp) + DSIZE)
+#define SKIP_LINKP(bp, i)   ((i) ? SKIP_LEVELP(bp) + (i) * WSIZE : (char *)(bp))
+#define SKIP_HEADP(idx, i)  ((i) ? GETP(SKIP_HEADS) + ((idx) * (SKIP_LEVELS - 1) + (i) - 1) * WSIZE : HEADP(idx))
+#define GET_LEVEL(bp)       (GET_SIZE(HDRP(bp)) > 2 * DSIZE ? GET(SKIP_LEVELP(bp)) : 1)
+
+/* link on level i after node x of size class idx, where NULL is the head */
+#define SKIP_NEXTP(x, idx, i) ((x) ? SKIP_LINKP(x, i) : SKIP_HEADP(idx, i))
+
+/*
+Heap layout:
+everything mm.c needs to find its way around the heap lives at a fixed
+offset from the start of the heap, so that mm_attach can adopt a heap
+that memlib mapped back in from a file.
+    heads       SIZE_CLASS_SIZE words
+    rovers      SIZE_CLASS_SIZE words
+    roots       ROOT_WORDS words: magic, handle table, handle capacity,
+                free handle, user root, size class occupancy, skip list
+                heads and one word of padding
+    prologue    padding word, header and footer
+    blocks
+    epilogue    header of size 0
+*/
+#define HEADP(i)        (heap_start + (i) * WSIZE)
+#define ROVERP(i)       (heap_start + (SIZE_CLASS_SIZE + (i)) * WSIZE)
+#define ROOTP(i)        (heap_start + (2 * SIZE_CLASS_SIZE + (i)) * WSIZE)
+#define ROOT_WORDS      8
+
+#define MAGIC           ROOTP(0)    // HEAP_MAGIC once the heap is initialized
+#define HANDLES         ROOTP(1)    // handle table
+#define HANDLE_CAPACITY ROOTP(2)    // entries in the handle table
+#define HANDLE_FREE     ROOTP(3)    // first unused handle table entry
+#define USER_ROOT       ROOTP(4)    // see mm_set_root
+#define CLASS_MAP       ROOTP(5)    // bit i is set while size class i has free blocks
+#define SKIP_HEADS      ROOTP(6)    // skip list heads, only in address order
+
+#define HEAP_MAGIC      0x6d6d3033  // "mm03", bump when the layout changes
+
+/* links are 32-bit word offsets, which limits the heap to 16 GB */
+#define MAX_HEAP_WORDS  0xffffffffUL
+
+/* most slack reserved for a block that keeps growing */
+#define MAX_REALLOC_SLACK (1 << 20)
+
+/* default placement policy: see mm_set_fit_policy and mm_set_split_policy */
+#define DEFAULT_BEST_FIT_K      8   // candidates inspected by bounded best-fit
+#define DEFAULT_BOUNDED_K       8   // blocks inspected per size class by good-fit
+#define DEFAULT_MIN_SPLIT       (2 * DSIZE) // smallest remainder split off a block
+#define DEFAULT_RIGHT_THRESHOLD 256 // remainders this large go to the left
+
+/* blocks inspected on either side of a hint by mm_malloc_hint */
+#define HINT_PROBES     16
+/* the heap grows at least this much for a cold block, see mm_malloc_hint */
+#define COLD_CHUNKSIZE  (1 << 12)
+
 extern int verbose;
 
 /* used to be an extern variable, initially declared in a modified version mdriver.c */
@@ -73,18 +164,71 @@ int heap_check_flag = 0;
 Segregated Free List:
 Since minimum block size is 16, size classes will look like:
     {16 ~ 31} {32 ~ 63}, {64 ~ 127}, ...,
+the list heads, and the next-fit roving pointers of each size class,
+are kept at the start of the heap. see HEADP and ROVERP
 */
-static char **heads;
+static char *heap_start;
+
+/*
+Placement policy:
+`fit_in_class` searches a single size class for a free block of at least
+`asize` bytes. `find_fit` calls it on the appropriate size class, then on
+every larger one that is not empty. `min_split` and `right_threshold`
+control how `place` splits the chosen block. Every free block a search
+inspects counts as a probe, see mm_fit_probes.
+*/
+static void *first_fit_class(size_t index, size_t asize);
+static void *next_fit_class(size_t index, size_t asize);
+static void *best_fit_class(size_t index, size_t asize);
+static void *bounded_fit_class(size_t index, size_t asize);
+
+static void *(*fit_in_class)(size_t index, size_t asize) = first_fit_class;
+static size_t best_fit_k = DEFAULT_BEST_FIT_K;
+static size_t bounded_k = DEFAULT_BOUNDED_K;
+static unsigned long fit_probes;
+static size_t min_split = DEFAULT_MIN_SPLIT;
+static size_t right_threshold = DEFAULT_RIGHT_THRESHOLD;
+static int order_policy = 0;    // mm_init keeps free lists in address order
+static int policy_set = 0;  // set once mm_set_*_policy has been called
+
+/* free lists of the current heap are in address order, see insert_ordered */
+static int address_order;
+static unsigned int skip_seed = 1;
 
 char *epilogue;
 char *heap_listp;
 
+/* free block the last cold block was split from, see mm_malloc_hint. */
+/* remove_node forgets it once the block is no longer free              */
+static char *cold_rover;
+
+/* total slack reserved by growing blocks, reclaimable under memory pressure */
+static size_t slack_bytes;
+
+/*
+Handle table:
+an array of HANDLE_CAPACITY entries allocated with mm_malloc itself.
+handles are 1-based indices into it, so 0 is never a valid handle.
+unused entries are chained through their pin count word from HANDLE_FREE.
+*/
+
 static void *coalesce(void *bp);
 static void *extend_heap(size_t words);
 static void *find_fit(size_t asize);
 static void *place(void *bp, size_t asize);
+static void *place_side(void *bp, size_t asize, int right);
+static void *near_fit(char *bp, size_t asize, int back);
+static void insert_node(void *bp);
 static void insert_first(void* bp);
+static void insert_ordered(void *bp);
+static size_t random_level(size_t size);
+static void order_free_lists();
 static void remove_node(void *bp);
+static void *resize_block(void *oldptr, size_t size);
+static size_t block_slack(void *bp);
+static void reclaim_slack();
+static int grow_handle_table();
+static int parse_k(const char *s, size_t *k);
 
 static void mm_check();
 static void check_blocks();
@@ -95,6 +239,9 @@ static int heap_check_free();
 static int heap_check_cross_free();
 static int heap_check_overlap();
 static int heap_check_size_class();
+static int heap_check_handles();
+static int heap_check_attach();
+static int heap_check_order(size_t index);
 
 static size_t get_size_class();
 
@@ -102,9 +249,25 @@ static size_t get_size_class();
  * mm_init - initialize the malloc package.
  */
 int mm_init(void) {
-    heads = (char**) mem_sbrk(SIZE_CLASS_SIZE * WSIZE);
-    for (size_t index = 0; index < SIZE_CLASS_SIZE; index++)
-        heads[index] = NULL;
+    /* without an explicit policy, fall back to the environment */
+    if (!policy_set) {
+        char *env;
+        if ((env = getenv("MM_FIT")) != NULL && mm_set_fit_policy(env) < 0)
+            return -1;
+        if ((env = getenv("MM_SPLIT")) != NULL && mm_set_split_policy(env) < 0)
+            return -1;
+        if ((env = getenv("MM_ORDER")) != NULL && mm_set_order_policy(env) < 0)
+            return -1;
+    }
+
+    if ((heap_start = mem_sbrk((2 * SIZE_CLASS_SIZE + ROOT_WORDS) * WSIZE)) == (void*)-1)
+        return -1;
+    for (size_t index = 0; index < SIZE_CLASS_SIZE; index++) {
+        PUTP(HEADP(index), NULL);
+        PUTP(ROVERP(index), NULL);
+    }
+    for (size_t index = 0; index < ROOT_WORDS; index++)
+        PUT(ROOTP(index), 0);
 
     if ((heap_listp = mem_sbrk(4 * WSIZE)) == (void*)-1)
         return -1;
@@ -116,15 +279,96 @@ int mm_init(void) {
 
     epilogue = heap_listp + 3 * WSIZE;
     heap_listp += (2 * WSIZE);
+    slack_bytes = 0;
+    fit_probes = 0;
+    cold_rover = NULL;
+    address_order = 0;
+    skip_seed = 1;
+
+    /* blocks sampled by the profiler went away with the old heap */
+    if (mm_prof_live)
+        mm_prof_drop_live();
 
     char *bp;
     /* Allocate CHUNKSIZE bytes ahead of time */
     if ((bp = extend_heap(CHUNKSIZE / WSIZE)) == NULL)
         return -1;
 
+    /* the skip list heads come from the heap itself, then the free */
+    /* blocks made so far are put in order                          */
+    if (order_policy) {
+        size_t size = SIZE_CLASS_SIZE * (SKIP_LEVELS - 1) * WSIZE;
+
+        if ((bp = mm_malloc(size)) == NULL)
+            return -1;
+        memset(bp, 0, size);
+        PUTP(SKIP_HEADS, bp);
+        address_order = 1;
+        order_free_lists();
+    }
+
+    /* the heap is only adopted by mm_attach once it is complete */
+    PUT(MAGIC, HEAP_MAGIC);
     return 0;
 }
 
+/*
+ * mm_attach - adopt the heap memlib holds instead of starting a new one,
+ *      typically one mapped back in from a file by mem_init_file.
+ *      every pointer in the heap is an offset from its start, so it does
+ *      not matter where it was mapped. the heap is checked before it is
+ *      adopted; returns -1 if it is not a complete and consistent mm heap,
+ *      in which case mm_init must be called instead. the heap keeps the
+ *      free list order it was created with
+ */
+int mm_attach(void) {
+    if (verbose)
+        printf("Entering mm_attach()\n");
+
+    heap_start = mem_heap_lo();
+    heap_listp = heap_start + (2 * SIZE_CLASS_SIZE + ROOT_WORDS + 2) * WSIZE;
+    epilogue = (char *)mem_heap_hi() + 1 - WSIZE;
+
+    if (mem_heapsize() < (size_t)(heap_listp + 2 * WSIZE - heap_start) ||
+            GET(MAGIC) != HEAP_MAGIC) {
+        if (verbose)
+            printf("-- No heap to attach to!\n");
+        return -1;
+    }
+
+    address_order = GET(SKIP_HEADS) != 0;
+
+    if (heap_check_attach()) {
+        if (verbose)
+            printf("-- Heap consistency check failed!\n");
+        return -1;
+    }
+
+    fit_probes = 0;
+    cold_rover = NULL;
+
+    /* blocks sampled by the profiler belong to the heap we left */
+    if (mm_prof_live)
+        mm_prof_drop_live();
+
+    return 0;
+}
+
+/*
+ * mm_set_root - remember `ptr` in the heap, so that the next process to
+ *      attach to it can find its data again with mm_get_root
+ */
+void mm_set_root(void *ptr) {
+    PUTP(USER_ROOT, ptr);
+}
+
+/*
+ * mm_get_root - return the pointer last passed to mm_set_root, or NULL
+ */
+void *mm_get_root(void) {
+    return GETP(USER_ROOT);
+}
+
 /*
  * mm_malloc - Allocate a block by incrementing the brk pointer.
  *     Always allocate a block whose size is a multiple of the alignment.
@@ -148,9 +392,23 @@ void *mm_malloc(size_t size) {
         bp = place(bp, newsize);
         if (verbose > 1)
             mm_check();
+        MM_PROF_MALLOC(bp, size);
         return bp;
     }
 
+    /* before growing the heap, give back the slack of growing blocks */
+    if (slack_bytes >= newsize) {
+        reclaim_slack();
+
+        if ((bp = find_fit(newsize)) != NULL) {
+            bp = place(bp, newsize);
+            if (verbose > 1)
+                mm_check();
+            MM_PROF_MALLOC(bp, size);
+            return bp;
+        }
+    }
+
     extendsize = MAX(newsize, CHUNKSIZE);
     if ((bp = extend_heap(extendsize / WSIZE)) == NULL)
         return NULL;
@@ -163,6 +421,68 @@ void *mm_malloc(size_t size) {
         if (heap_check() && verbose)
             printf("Heap compromised!\n");
 
+    MM_PROF_MALLOC(bp, size);
+    return bp;
+}
+
+/*
+ * mm_malloc_hint - mm_malloc with a placement hint.
+ *      with a `hint`, a block returned by mm_malloc that is still
+ *      allocated, the new block goes into the closest free block that
+ *      fits among the HINT_PROBES blocks on either side of the hint, at
+ *      the end facing it. objects allocated together then share cache
+ *      lines and pages. with MM_HINT_COLD, the new block goes to the top
+ *      of the heap instead, below the other cold blocks, so it stays out
+ *      from between the blocks first fit hands out lower down. without
+ *      either, or when no block near the hint fits, it is mm_malloc
+ */
+void *mm_malloc_hint(size_t size, const void *hint, int flags) {
+    if (verbose)
+        printf("Entering mm_malloc_hint()\n");
+
+    size_t newsize;
+    char *bp, *after, *before;
+    char *h = (char *)hint;
+
+    if (size == 0 || (h == NULL && !(flags & MM_HINT_COLD)))
+        return mm_malloc(size);
+
+    if (size <= DSIZE)
+        newsize = DSIZE + DSIZE;
+    else
+        newsize = DSIZE + ALIGN(size);
+
+    if (flags & MM_HINT_COLD) {
+        /* carry on below the last cold block, else start from the */
+        /* epilogue block, which ends the heap                      */
+        if (cold_rover != NULL && GET_SIZE(HDRP(cold_rover)) >= newsize)
+            bp = cold_rover;
+        else if ((bp = near_fit((char *)mem_heap_hi() + 1, newsize, 1)) == NULL &&
+                (bp = extend_heap(MAX(newsize, COLD_CHUNKSIZE) / WSIZE)) == NULL)
+            return NULL;
+
+        after = place_side(bp, newsize, 1);
+        cold_rover = after != bp ? bp : NULL;
+        bp = after;
+    } else {
+        after = near_fit(h, newsize, 0);
+        before = near_fit(h, newsize, 1);
+        if (after != NULL && (before == NULL || after - h <= h - FTRP(before)))
+            bp = place_side(after, newsize, 0);
+        else if (before != NULL)
+            bp = place_side(before, newsize, 1);
+        else
+            return mm_malloc(size);
+    }
+
+    if (verbose > 1)
+        mm_check();
+
+    if (heap_check_flag)
+        if (heap_check() && verbose)
+            printf("Heap compromised!\n");
+
+    MM_PROF_MALLOC(bp, size);
     return bp;
 }
 
@@ -175,6 +495,11 @@ void mm_free(void *bp) {
 
     size_t size = GET_SIZE(HDRP(bp));
 
+    MM_PROF_FREE(bp);
+
+    if (GET_SLACK(HDRP(bp)))
+        slack_bytes -= block_slack(bp);
+
     PUT(HDRP(bp), PACK(size, 0));
     PUT(FTRP(bp), PACK(size, 0));
     coalesce(bp);
@@ -188,31 +513,89 @@ void mm_free(void *bp) {
 }
 
 /*
- * mm_realloc - Implemented simply in terms of mm_malloc and mm_free
+ * mm_realloc - resize in place when possible, otherwise move the block.
+ *      a block that is grown more than once is predicted to keep growing,
+ *      so it is given geometric slack. the slack is given back when the
+ *      block is freed, or by `reclaim_slack` when the heap would grow.
  */
 void *mm_realloc(void *ptr, size_t size) {
     if (verbose)
         printf("Entering mm_realloc()\n");
 
-    void *oldptr = ptr;
     void *newptr;
-    size_t copy_size;
+    size_t reserve = size;
+    int grows;
 
     if (size == 0) {
         if (verbose)
             printf("realloc requested size is 0.\n");
 
-        mm_free(oldptr);
+        mm_free(ptr);
         return NULL;
     }
 
-    if (oldptr == NULL) {
+    if (ptr == NULL) {
         if (verbose)
             printf("old pointer value is NULL.\n");
 
         return mm_malloc(size);
     }
 
+    /* a block with slack may be resized within its slack */
+    if (GET_SLACK(HDRP(ptr))) {
+        size_t requested = GET(TAGP(ptr));
+
+        slack_bytes -= block_slack(ptr);
+        PUT(HDRP(ptr), GET(HDRP(ptr)) & ~SLACK_BIT);
+
+        if (size + WSIZE <= GET_SIZE(HDRP(ptr)) - DSIZE && size > requested / 2) {
+            if (verbose)
+                printf("Resizing within slack. Req size: %lu\n", size);
+
+            PUT(HDRP(ptr), GET(HDRP(ptr)) | SLACK_BIT);
+            PUT(TAGP(ptr), size);
+            slack_bytes += block_slack(ptr);
+            return ptr;
+        }
+    }
+
+    /* second and later growths reserve room for the next ones */
+    grows = ALIGN(size) + DSIZE > GET_SIZE(HDRP(ptr));
+    if (grows && GET_GROWN(HDRP(ptr))) {
+        size_t slack = size / 2;
+        if (slack > MAX_REALLOC_SLACK)
+            slack = MAX_REALLOC_SLACK;
+
+        /* one more word holds the requested size */
+        reserve = size + slack + WSIZE;
+    }
+
+    if ((newptr = resize_block(ptr, reserve)) == NULL)
+        return NULL;
+
+    /* moves that bypass mm_malloc and mm_free keep their profiler sample */
+    if (newptr != ptr)
+        MM_PROF_MOVE(ptr, newptr);
+
+    if (grows)
+        PUT(HDRP(newptr), GET(HDRP(newptr)) | GROWN_BIT);
+
+    if (reserve != size) {
+        PUT(HDRP(newptr), GET(HDRP(newptr)) | SLACK_BIT);
+        PUT(TAGP(newptr), size);
+        slack_bytes += block_slack(newptr);
+    }
+
+    return newptr;
+}
+
+/*
+ * resize_block - resize the allocated block at `oldptr` to hold `size` bytes,
+ *      searching its previous and next blocks before moving it
+ */
+static void *resize_block(void *oldptr, size_t size) {
+    void *newptr;
+    size_t copy_size;
     size_t original_size = GET_SIZE(HDRP((char*)oldptr));
     size_t aligned_size = ALIGN(size) + DSIZE;
 
@@ -317,7 +700,7 @@ void *mm_realloc(void *ptr, size_t size) {
             newptr = oldptr - additional_required_size;
             PUT(HDRP(newptr), PACK(aligned_size, 1));
             PUT(FTRP(newptr), PACK(aligned_size, 1));
-            memmove(newptr, oldptr, size);
+            memmove(newptr, oldptr, original_size - DSIZE);
 
             PUT(HDRP(prev_bp), PACK(prev_size - additional_required_size, 0));
             PUT(FTRP(prev_bp), PACK(prev_size - additional_required_size, 0));
@@ -334,13 +717,38 @@ void *mm_realloc(void *ptr, size_t size) {
 
             PUT(HDRP(prev_bp), PACK(prev_size + original_size, 1));
             PUT(FTRP(prev_bp), PACK(prev_size + original_size, 1));
-            memmove(prev_bp, oldptr, size);
+            memmove(prev_bp, oldptr, original_size - DSIZE);
 
             return prev_bp;
         }
 
         /* not enough space in the next block */
     }
+
+    /* no neighbor is large enough. if no free block fits either, the heap  */
+    /* has to grow anyway. when the block ends the heap, possibly followed */
+    /* by a single free block, grow the heap underneath it instead of      */
+    /* moving it                                                            */
+    next_bp = NEXT_BLKP(oldptr);
+    size_t next_free = GET_ALLOC(HDRP(next_bp)) ? 0 : GET_SIZE(HDRP(next_bp));
+    char *after = next_free ? NEXT_BLKP(next_bp) : next_bp;
+
+    if (GET_SIZE(HDRP(after)) == 0 && find_fit(aligned_size) == NULL) {
+        if (verbose)
+            printf("Extending heap under the last block.\n");
+
+        if ((next_bp = extend_heap((additional_required_size - next_free) / WSIZE)) == NULL)
+            return NULL;
+
+        /* the new space coalesced with the free block after oldptr, if any */
+        remove_node(next_bp);
+        size_t grown_size = original_size + GET_SIZE(HDRP(next_bp));
+        PUT(HDRP(oldptr), PACK(grown_size, 1));
+        PUT(FTRP(oldptr), PACK(grown_size, 1));
+
+        return oldptr;
+    }
+
     if (verbose)
         printf("Allocating new memory.\n");
 
@@ -348,7 +756,7 @@ void *mm_realloc(void *ptr, size_t size) {
     if (newptr == NULL)
         return NULL;
 
-    copy_size = GET_SIZE(HDRP(ptr)) - DSIZE;
+    copy_size = GET_SIZE(HDRP(oldptr)) - DSIZE;
 
     /* realloc request size is smaller than originally allocated */
     if (size < copy_size)
@@ -364,6 +772,208 @@ void *mm_realloc(void *ptr, size_t size) {
     return newptr;
 }
 
+/*
+ * mm_halloc - allocate a relocatable block of `size` bytes and return its handle.
+ *      the block may be moved by mm_compact whenever it is not pinned.
+ *      returns 0 if the allocation fails
+ */
+mm_handle_t mm_halloc(size_t size) {
+    if (verbose)
+        printf("Entering mm_halloc()\n");
+
+    mm_handle_t h;
+    char *bp;
+
+    if (GET(HANDLE_FREE) == 0 && grow_handle_table() < 0)
+        return 0;
+
+    /* one more word holds the handle, so compaction can find the entry */
+    if ((bp = mm_malloc(size + WSIZE)) == NULL)
+        return 0;
+
+    h = GET(HANDLE_FREE);
+    PUT(HANDLE_FREE, GET(HPINS(h)));
+
+    PUT(HDRP(bp), GET(HDRP(bp)) | HANDLE_BIT);
+    PUT(TAGP(bp), h);
+    PUTP(HENTRY(h), bp);
+    PUT(HPINS(h), 0);
+
+    return h;
+}
+
+/*
+ * mm_hfree - free the relocatable block of handle `h`
+ */
+void mm_hfree(mm_handle_t h) {
+    if (verbose)
+        printf("Entering mm_hfree()\n");
+
+    char *bp = HPTR(h);
+
+    /* the entry is released first, so the heap checker never sees it */
+    /* pointing to a free block                                        */
+    PUTP(HENTRY(h), NULL);
+    PUT(HPINS(h), GET(HANDLE_FREE));
+    PUT(HANDLE_FREE, h);
+
+    mm_free(bp);
+}
+
+/*
+ * mm_pin - return the current address of the block of handle `h`,
+ *      and keep it from moving until the matching mm_unpin
+ */
+void *mm_pin(mm_handle_t h) {
+    PUT(HPINS(h), GET(HPINS(h)) + 1);
+    return HPTR(h);
+}
+
+/*
+ * mm_unpin - let the block of handle `h` move again.
+ *      pointers returned by mm_pin must not be used afterwards
+ */
+void mm_unpin(mm_handle_t h) {
+    PUT(HPINS(h), GET(HPINS(h)) - 1);
+}
+
+/*
+ * mm_compact - slide unpinned handle blocks toward the start of the heap.
+ *      free space bubbles up past every movable block until it meets a block
+ *      that cannot move, and coalesces on the way. a free block left at the
+ *      end of the heap is given back to memlib.
+ *      returns the number of bytes the heap shrank by
+ */
+size_t mm_compact(void) {
+    if (verbose)
+        printf("Entering mm_compact()\n");
+
+    char *bp = NEXT_BLKP(heap_listp);
+    char *next;
+    size_t free_size, size, step;
+
+    while (GET_SIZE(HDRP(bp)) > 0) {
+        next = NEXT_BLKP(bp);
+
+        /* only a free block followed by an unpinned handle block changes */
+        if (GET_ALLOC(HDRP(bp)) || !GET_HANDLE(HDRP(next)) ||
+                GET(HPINS(GET(TAGP(next)))) > 0) {
+            bp = next;
+            continue;
+        }
+
+        free_size = GET_SIZE(HDRP(bp));
+        size = GET_SIZE(HDRP(next));
+        remove_node(bp);
+
+        /* move header, payload and footer down by `free_size` bytes */
+        memmove(HDRP(bp), HDRP(next), size);
+        PUTP(HENTRY(GET(TAGP(bp))), bp);
+        MM_PROF_MOVE(next, bp);
+
+        /* the free space now follows the moved block */
+        next = NEXT_BLKP(bp);
+        PUT(HDRP(next), PACK(free_size, 0));
+        PUT(FTRP(next), PACK(free_size, 0));
+        bp = coalesce(next);
+    }
+
+    /* bp is at the epilogue. trim a free block right before it */
+    size = 0;
+    if (!GET_ALLOC(HDRP(bp) - WSIZE)) {
+        bp = PREV_BLKP(bp);
+        size = GET_SIZE(HDRP(bp));
+        remove_node(bp);
+        PUT(HDRP(bp), PACK(0, 1));
+        epilogue = bp;
+
+        /* mem_sbrk takes an int, so a larger trim is done in steps */
+        for (free_size = size; free_size > 0; free_size -= step) {
+            step = free_size < INT_MAX ? free_size : INT_MAX;
+            mem_sbrk(-(int)step);
+        }
+    }
+
+    if (heap_check_flag)
+        if (heap_check() && verbose)
+            printf("Heap compromised!\n");
+
+    return size;
+}
+
+/*
+ * grow_handle_table - double the handle table and chain the new entries
+ *      returns -1 if the table cannot grow
+ */
+static int grow_handle_table() {
+    size_t old_capacity = GET(HANDLE_CAPACITY);
+    size_t capacity = old_capacity ? 2 * old_capacity : HANDLE_TABLE_MIN;
+    char *old_table = GETP(HANDLES);
+    char *table;
+
+    /* not mm_realloc: the old table stays valid until the new one is */
+    /* in place, so the heap checker can follow the handles meanwhile  */
+    if ((table = mm_malloc(capacity * DSIZE)) == NULL)
+        return -1;
+
+    if (old_table != NULL)
+        memcpy(table, old_table, old_capacity * DSIZE);
+    PUTP(HANDLES, table);
+    if (old_table != NULL)
+        mm_free(old_table);
+
+    for (size_t h = capacity; h > old_capacity; h--) {
+        PUTP(HENTRY(h), NULL);
+        PUT(HPINS(h), GET(HANDLE_FREE));
+        PUT(HANDLE_FREE, h);
+    }
+    PUT(HANDLE_CAPACITY, capacity);
+
+    return 0;
+}
+
+/*
+ * block_slack - bytes reserved beyond the requested size of a block with slack
+ */
+static size_t block_slack(void *bp) {
+    return GET_SIZE(HDRP(bp)) - (ALIGN(GET(TAGP(bp))) + DSIZE);
+}
+
+/*
+ * reclaim_slack - trim every block with slack down to its requested size,
+ *      returning the tails to the free lists
+ */
+static void reclaim_slack() {
+    if (verbose)
+        printf("Entering reclaim_slack()\n");
+
+    char *bp;
+
+    for (bp = NEXT_BLKP(heap_listp); GET_SIZE(HDRP(bp)) > 0; bp = NEXT_BLKP(bp)) {
+        if (!GET_ALLOC(HDRP(bp)) || !GET_SLACK(HDRP(bp)))
+            continue;
+
+        size_t size = GET_SIZE(HDRP(bp));
+        size_t used = MAX(ALIGN(GET(TAGP(bp))) + DSIZE, 2 * DSIZE);
+
+        /* too little slack to split off. just forget about it */
+        if (size - used < 2 * DSIZE) {
+            PUT(HDRP(bp), GET(HDRP(bp)) & ~SLACK_BIT);
+            continue;
+        }
+
+        PUT(HDRP(bp), PACK(used, 1) | GROWN_BIT);
+        PUT(FTRP(bp), PACK(used, 1));
+
+        char *tail = NEXT_BLKP(bp);
+        PUT(HDRP(tail), PACK(size - used, 0));
+        PUT(FTRP(tail), PACK(size - used, 0));
+        coalesce(tail);
+    }
+
+    slack_bytes = 0;
+}
+
 static void *coalesce(void *bp) {
     if (verbose)
         printf("Entering coalesce()\n");
@@ -417,7 +1027,7 @@ static void *coalesce(void *bp) {
         PUT(FTRP(bp), PACK(size, 0));
     }
 
-    insert_first(bp);
+    insert_node(bp);
 
     if (verbose)
         printf("After coalesce - size: %u\taddr: %p\n", GET_SIZE(HDRP(bp)), bp);
@@ -434,6 +1044,8 @@ static void *extend_heap(size_t words) {
 
     // we need an even number of words
     size = (words % 2) ? (words + 1) * WSIZE : words * WSIZE;
+    if ((mem_heapsize() + size) / WSIZE > MAX_HEAP_WORDS)
+        return NULL;
     if ((long)(bp = mem_sbrk(size)) == -1)
         return NULL;
 
@@ -455,51 +1067,306 @@ static void *find_fit(size_t asize) {
     if (verbose)
         printf("Entering find_fit()\n");
 
-    size_t size_class_index = get_size_class(asize);
+    /* inspect the appropriate size class first, then every larger size class */
+    /* that has free blocks, skipping the empty ones with the occupancy bitmap */
+    unsigned int map = GET(CLASS_MAP) & (~0u << get_size_class(asize));
+
+    while (map != 0) {
+        size_t index = __builtin_ctz(map);
+        void *bp = fit_in_class(index, asize);
+
+        if (bp != NULL) {
+            if (verbose)
+                printf("Fit found at size class %lu @ %p.\n", index, bp);
+
+            return bp;
+        }
+
+        /* no fitting size found. move onto next size class */
+        map &= map - 1;
+    }
 
-    /* now, size_class_index stores the index to the size class in `heads`  */
-    /*  and lower_bound stores the lower bound of the size class(inclusive) */
+    /* at this point, there is no fitting block in any of the size classes */
+    /* above the appropriate size class. so there is no fitting block */
+
+    return NULL;
+}
+
+/*
+ * near_fit - return the first free block of at least `asize` bytes
+ *      among the HINT_PROBES blocks after `bp` in the heap, or before it
+ *      when `back` is set. NULL if none of them fits
+ */
+static void *near_fit(char *bp, size_t asize, int back) {
+    if (verbose)
+        printf("Entering near_fit()\n");
 
-    /* here, we inspect the linked list at `size_class_index` in `heads` */
-    void *bp = heads[size_class_index];
+    for (size_t n = 0; n < HINT_PROBES; n++) {
+        /* stop at the prologue and at the epilogue */
+        if (back ? bp <= heap_listp : GET_SIZE(HDRP(bp)) == 0)
+            return NULL;
+        bp = back ? PREV_BLKP(bp) : NEXT_BLKP(bp);
+
+        fit_probes++;
+        if (!GET_ALLOC(HDRP(bp)) && GET_SIZE(HDRP(bp)) >= asize)
+            return bp;
+    }
+
+    return NULL;
+}
+
+/*
+ * first_fit_class - return the first block in size class `index` that fits `asize`
+ */
+static void *first_fit_class(size_t index, size_t asize) {
+    char *bp = GETP(HEADP(index));
 
     while (bp != NULL) {
+        fit_probes++;
+
         /* find the first node that fits `asize` */
-        if (!GET_ALLOC(HDRP(bp)) && (asize <= GET_SIZE(HDRP(bp)))) {
-            if (verbose)
-                printf("Fit found at appropriate size class %lu @ %p.\n", size_class_index, bp);
+        if (!GET_ALLOC(HDRP(bp)) && (asize <= GET_SIZE(HDRP(bp))))
+            return bp;
 
+        bp = GET_NEXTP(bp);
+    }
+
+    return NULL;
+}
+
+/*
+ * next_fit_class - like first_fit_class, but start where the previous search
+ *      in this size class left off, and wrap around to the head
+ */
+static void *next_fit_class(size_t index, size_t asize) {
+    char *rover = GETP(ROVERP(index));
+    char *bp;
+
+    if (rover == NULL)
+        rover = GETP(HEADP(index));
+
+    /* from the rover to the end of the list */
+    for (bp = rover; bp != NULL; bp = GET_NEXTP(bp)) {
+        fit_probes++;
+        if (asize <= GET_SIZE(HDRP(bp))) {
+            PUTP(ROVERP(index), bp);
             return bp;
         }
+    }
+
+    /* from the head up to the rover */
+    for (bp = GETP(HEADP(index)); bp != rover; bp = GET_NEXTP(bp)) {
+        fit_probes++;
+        if (asize <= GET_SIZE(HDRP(bp))) {
+            PUTP(ROVERP(index), bp);
+            return bp;
+        }
+    }
+
+    return NULL;
+}
+
+/*
+ * best_fit_class - return the smallest of the first `best_fit_k` blocks
+ *      in size class `index` that fit `asize`. an exact fit ends the search
+ */
+static void *best_fit_class(size_t index, size_t asize) {
+    char *bp = GETP(HEADP(index));
+    char *best = NULL;
+    size_t best_size = 0;
+    size_t candidates = 0;
+
+    while (bp != NULL && candidates < best_fit_k) {
+        size_t size = GET_SIZE(HDRP(bp));
+
+        fit_probes++;
+        if (asize <= size) {
+            if (best == NULL || size < best_size) {
+                best = bp;
+                best_size = size;
+                if (size == asize)
+                    break;
+            }
+            candidates += 1;
+        }
 
         bp = GET_NEXTP(bp);
     }
 
-    /* no fitting size at the size class. this can either be because the */
-    /* linked list is empty, or there really is no fitting free block    */
+    return best;
+}
 
-    /* here, we inspect the larger size classes for finding a fitting free block */
-    for (size_t index = size_class_index + 1; index < SIZE_CLASS_SIZE; index++) {
-        bp = heads[index];
+/*
+ * bounded_fit_class - return the smallest block that fits `asize` among
+ *      the first `bounded_k` blocks of size class `index`, fitting or not.
+ *      the search never inspects more than `bounded_k` blocks, however long
+ *      the list. any block of a larger size class fits, so when the home
+ *      class comes up empty, find_fit finds a block among the first
+ *      `bounded_k` of the next non-empty class: at most 2K probes in all
+ */
+static void *bounded_fit_class(size_t index, size_t asize) {
+    char *bp = GETP(HEADP(index));
+    char *best = NULL;
+    size_t best_size = 0;
+
+    for (size_t probes = 0; bp != NULL && probes < bounded_k; probes++) {
+        size_t size = GET_SIZE(HDRP(bp));
+
+        fit_probes++;
+        if (asize <= size && (best == NULL || size < best_size)) {
+            best = bp;
+            best_size = size;
+            if (size == asize)
+                break;
+        }
 
-        while (bp != NULL) {
-            if (!GET_ALLOC(HDRP(bp)) && (asize <= GET_SIZE(HDRP(bp)))) {
-                if (verbose)
-                    printf("Fit found at size class %lu.\n", index);
+        bp = GET_NEXTP(bp);
+    }
 
-                return bp;
-            }
+    return best;
+}
+
+/*
+ * mm_fit_probes - number of free blocks inspected by fit searches
+ *      since the heap was initialized or attached
+ */
+unsigned long mm_fit_probes(void) {
+    return fit_probes;
+}
 
-            bp = GET_NEXTP(bp);
+/*
+ * mm_stats - heap size, free bytes, largest free block and the length of
+ *      every free list, for watching fragmentation while a program runs.
+ *      walks every free list, so it costs time linear in the free blocks
+ */
+#if MM_STATS_CLASSES != SIZE_CLASS_SIZE
+#error "MM_STATS_CLASSES in mm.h must match SIZE_CLASS_SIZE"
+#endif
+void mm_stats(mm_stats_t *stats) {
+    memset(stats, 0, sizeof(*stats));
+    stats->heap_bytes = mem_heapsize();
+
+    for (size_t index = 0; index < SIZE_CLASS_SIZE; index++) {
+        for (char *bp = GETP(HEADP(index)); bp != NULL; bp = GET_NEXTP(bp)) {
+            size_t size = GET_SIZE(HDRP(bp));
+            stats->free_bytes += size;
+            if (size > stats->largest_free)
+                stats->largest_free = size;
+            stats->free_blocks[index]++;
         }
+    }
+}
 
-        /* no fitting size found. move onto next size class */
+/*
+ * mm_set_fit_policy - select how free blocks are searched
+ *      "first"  : first fit within each size class (default)
+ *      "next"   : next fit, with a roving pointer per size class
+ *      "best"   : best of the first K fitting blocks, "best:K" sets K
+ *      "bounded": good fit, best of the first K blocks of a size class,
+ *                 "bounded:K" sets K
+ *      returns 0 on success, -1 if `policy` is not recognized
+ */
+int mm_set_fit_policy(const char *policy) {
+    if (!strcmp(policy, "first")) {
+        fit_in_class = first_fit_class;
+    } else if (!strcmp(policy, "next")) {
+        fit_in_class = next_fit_class;
+    } else if (!strncmp(policy, "best", 4)) {
+        size_t k = DEFAULT_BEST_FIT_K;
+
+        if (parse_k(policy + 4, &k) < 0)
+            return -1;
+
+        best_fit_k = k;
+        fit_in_class = best_fit_class;
+    } else if (!strncmp(policy, "bounded", 7)) {
+        size_t k = DEFAULT_BOUNDED_K;
+
+        if (parse_k(policy + 7, &k) < 0)
+            return -1;
+
+        bounded_k = k;
+        fit_in_class = bounded_fit_class;
+    } else {
+        return -1;
     }
 
-    /* at this point, there is no fitting block in any of the size classes */
-    /* above the appropriate size class. so there is no fitting block */
+    policy_set = 1;
+    return 0;
+}
 
-    return NULL;
+/*
+ * parse_k - parse the ":K" that may follow a fit policy name into `k`.
+ *      `k` is left alone if `s` is empty
+ *      returns 0 on success, -1 unless K is a positive integer
+ */
+static int parse_k(const char *s, size_t *k) {
+    char *end;
+    long value;
+
+    if (*s == '\0')
+        return 0;
+
+    if (*s != ':')
+        return -1;
+
+    value = strtol(s + 1, &end, 10);
+    if (end == s + 1 || *end != '\0' || value < 1)
+        return -1;
+
+    *k = value;
+    return 0;
+}
+
+/*
+ * mm_set_split_policy - select how `place` splits a free block, as "MIN[:RIGHT]"
+ *      MIN   : smallest remainder split off into a new free block (at least 16)
+ *      RIGHT : remainders at least this large stay on the left, and the
+ *              allocation goes to the right end of the block (default 256)
+ *      returns 0 on success, -1 if `policy` is malformed
+ */
+int mm_set_split_policy(const char *policy) {
+    char *end;
+    long min = strtol(policy, &end, 10);
+    long right = DEFAULT_RIGHT_THRESHOLD;
+
+    if (end == policy || min < 2 * DSIZE)
+        return -1;
+
+    if (*end == ':') {
+        policy = end + 1;
+        right = strtol(policy, &end, 10);
+        if (end == policy || right < 0)
+            return -1;
+    }
+
+    if (*end != '\0')
+        return -1;
+
+    min_split = ALIGN(min);
+    right_threshold = right;
+    policy_set = 1;
+    return 0;
+}
+
+/*
+ * mm_set_order_policy - select where freed blocks go in their free list
+ *      "lifo"    : at the front (default)
+ *      "address" : in address order, so that blocks allocated one after
+ *                  the other tend to be close in memory
+ *      takes effect at the next mm_init; returns 0 on success, -1 if
+ *      `policy` is unknown
+ */
+int mm_set_order_policy(const char *policy) {
+    if (!strcmp(policy, "lifo"))
+        order_policy = 0;
+    else if (!strcmp(policy, "address"))
+        order_policy = 1;
+    else
+        return -1;
+
+    policy_set = 1;
+    return 0;
 }
 
 /*
@@ -511,22 +1378,31 @@ static void *place(void *bp, size_t asize) {
     if (verbose)
         printf("Entering place()\n");
 
+    /* attach larger size blocks to the right */
+    return place_side(bp, asize, GET_SIZE(HDRP(bp)) - asize >= right_threshold);
+}
+
+/*
+ * place_side - place does this, with the side chosen by the caller:
+ *      when `right` is set and the remainder can be split off, the block
+ *      is allocated at the right end of the free block, else at the left
+ */
+static void *place_side(void *bp, size_t asize, int right) {
     size_t csize = GET_SIZE(HDRP(bp));
     size_t size_difference = csize - asize;
     char* free_ptr;
 
-    /* attach larger size blocks to the right */
-    if (size_difference >= 256) {
+    if (right && size_difference >= min_split) {
         remove_node(bp);
 
         PUT(HDRP(bp), PACK(size_difference, 0));
         PUT(FTRP(bp), PACK(size_difference, 0));
-        insert_first(bp);
+        insert_node(bp);
 
         bp = NEXT_BLKP(bp);
         PUT(HDRP(bp), PACK(asize, 1));
         PUT(FTRP(bp), PACK(asize, 1));
-    } else if (size_difference >= (2 * DSIZE)) {
+    } else if (size_difference >= min_split) {
         /* first, remove the whole node at bp */
         remove_node(bp);
 
@@ -538,7 +1414,7 @@ static void *place(void *bp, size_t asize) {
         free_ptr = NEXT_BLKP(bp);
         PUT(HDRP(free_ptr), PACK(size_difference, 0));
         PUT(FTRP(free_ptr), PACK(size_difference, 0));
-        insert_first(free_ptr);
+        insert_node(free_ptr);
     } else {
         remove_node(bp);
         PUT(HDRP(bp), PACK(csize, 1));
@@ -548,6 +1424,17 @@ static void *place(void *bp, size_t asize) {
     return bp;
 }
 
+/*
+ * insert_node - insert node at bp into the linked list of its size class,
+ *      at the front or in address order
+ */
+static void insert_node(void *bp) {
+    if (address_order)
+        insert_ordered(bp);
+    else
+        insert_first(bp);
+}
+
 /*
  * insert_first - insert node at bp as first node of linked list of appropriate size class
  *      NOTE: the block sizes must be specified at the header and footer,
@@ -561,18 +1448,92 @@ static void insert_first(void* bp) {
     char* cur_pp = ADJ_PREVP(bp);
     size_t cur_size = GET_SIZE(HDRP(bp));
     size_t size_class_index = get_size_class(cur_size);
+    char* head = GETP(HEADP(size_class_index));
 
-    if (heads[size_class_index] == NULL) { // no element in linked list
+    if (head == NULL) { // no element in linked list
         /* modify only two links */
-        heads[size_class_index] = cur_np; // point to bp as first element
+        PUTP(HEADP(size_class_index), cur_np); // point to bp as first element
+        PUT(CLASS_MAP, GET(CLASS_MAP) | (1u << size_class_index));
         PUTP(cur_np, NULL);
         PUTP(cur_pp, NULL);
     } else { // at least a single element exists
-        char* head = heads[size_class_index];
         PUTP(cur_np, head);
         PUTP(cur_pp, NULL);
         PUTP(ADJ_PREVP(head), cur_pp);
-        heads[size_class_index] = cur_np;
+        PUTP(HEADP(size_class_index), cur_np);
+    }
+}
+
+/*
+ * insert_ordered - insert node at bp into the linked list of its size
+ *      class, after the last node at a lower address. searches the skip
+ *      list from its top level down, linking bp in on its lowest levels
+ *      NOTE: the block sizes must be specified at the header and footer,
+ *      as this function makes use of that to guess the size class
+ */
+static void insert_ordered(void *bp) {
+    if (verbose)
+        printf("Entering insert_ordered()\n");
+
+    size_t size = GET_SIZE(HDRP(bp));
+    size_t size_class_index = get_size_class(size);
+    size_t level = random_level(size);
+    char *x = NULL;
+    char *next;
+
+    if (size > 2 * DSIZE)
+        PUT(SKIP_LEVELP(bp), level);
+
+    for (size_t i = SKIP_LEVELS; i-- > 0; ) {
+        while ((next = GETP(SKIP_NEXTP(x, size_class_index, i))) != NULL && next < (char *)bp)
+            x = next;
+
+        if (i < level) {
+            PUTP(SKIP_LINKP(bp, i), next);
+            PUTP(SKIP_NEXTP(x, size_class_index, i), bp);
+        }
+    }
+
+    /* level 0 is doubly linked */
+    PUTP(ADJ_PREVP(bp), x ? ADJ_PREVP(x) : NULL);
+    if (next != NULL)
+        PUTP(ADJ_PREVP(next), ADJ_PREVP(bp));
+    PUT(CLASS_MAP, GET(CLASS_MAP) | (1u << size_class_index));
+}
+
+/*
+ * random_level - pick the skip list level of a block of `size` bytes:
+ *      one more level with probability 1/4, as far as the block has room
+ */
+static size_t random_level(size_t size) {
+    size_t room = (size - 2 * DSIZE) / WSIZE;   // level word and links
+    size_t level = 1;
+
+    skip_seed ^= skip_seed << 13;
+    skip_seed ^= skip_seed >> 17;
+    skip_seed ^= skip_seed << 5;
+
+    for (unsigned int bits = skip_seed; level < room && level < SKIP_LEVELS && (bits & 3) == 0; bits >>= 2)
+        level++;
+
+    return level;
+}
+
+/*
+ * order_free_lists - put the blocks of every free list in address order
+ */
+static void order_free_lists() {
+    for (size_t index = 0; index < SIZE_CLASS_SIZE; index++) {
+        char *bp = GETP(HEADP(index));
+
+        PUTP(HEADP(index), NULL);
+        PUT(CLASS_MAP, GET(CLASS_MAP) & ~(1u << index));
+        while (bp != NULL) {
+            char *next = GET_NEXTP(bp);
+
+            insert_ordered(bp);
+            bp = next;
+        }
     }
 }
 
@@ -591,14 +1552,37 @@ static void remove_node(void *bp) {
     char* next_bp = GET_NEXTP(bp);
     size_t size_class_index = get_size_class(GET_SIZE(HDRP(bp)));
 
+    if (bp == cold_rover)
+        cold_rover = NULL;
+
+    /* keep the next-fit rover on a block that is still in the list */
+    if (GETP(ROVERP(size_class_index)) == bp)
+        PUTP(ROVERP(size_class_index), next_bp);
+
+    /* unlink bp on the skip list levels above 0, which are singly linked */
+    size_t level = address_order ? GET_LEVEL(bp) : 1;
+    if (level > 1) {
+        char *x = NULL;
+        char *next;
+
+        for (size_t i = SKIP_LEVELS - 1; i > 0; i--) {
+            while ((next = GETP(SKIP_NEXTP(x, size_class_index, i))) != NULL && next < (char *)bp)
+                x = next;
+
+            if (i < level)
+                PUTP(SKIP_NEXTP(x, size_class_index, i), GETP(SKIP_LINKP(bp, i)));
+        }
+    }
+
     /* case 0: bp is only element */
     if (prev_pp == NULL && next_bp == NULL) {
-        heads[size_class_index] = NULL;
+        PUTP(HEADP(size_class_index), NULL);
+        PUT(CLASS_MAP, GET(CLASS_MAP) & ~(1u << size_class_index));
     }
     /* case 1: bp is first element */
     else if (prev_pp == NULL) {
         PUTP(ADJ_PREVP(next_bp), NULL); // set next's pp to NULL
-        heads[size_class_index] = next_bp;
+        PUTP(HEADP(size_class_index), next_bp);
     }
     /* case 2: bp is last element */
     else if (next_bp == NULL) {
@@ -634,7 +1618,7 @@ static void check_free_list() {
     printf("----- Iterating free list -----\n");
 
     for (size_t i = 0; i < SIZE_CLASS_SIZE; i++) {
-        char* ptr = heads[i];
+        char* ptr = GETP(HEADP(i));
 
         printf("ptr: %p\n", ptr);
         size_t count = 1;
@@ -686,6 +1670,14 @@ static int heap_check() {
         return 1;
     }
 
+    if (heap_check_handles()) {
+        if (verbose)
+            printf("-- Handle check failed!\n");
+
+        verbose = 0;
+        return 1;
+    }
+
     return 0;
 }
 
@@ -694,7 +1686,7 @@ static int heap_check() {
 /* - Do the pointers in the free list point to valid free blocks? */
 static int heap_check_free() {
     for (size_t i = 0; i < SIZE_CLASS_SIZE; i++) {
-        char* iter = heads[i];
+        char* iter = GETP(HEADP(i));
 
         if (iter != NULL && GET_PREVP(iter) != NULL) {
             if (verbose)
@@ -747,7 +1739,7 @@ static int heap_check_cross_free() {
             /* check size class at index `i` */
 
             // block_iter points to a free block
-            char *free_iter = heads[i];
+            char *free_iter = GETP(HEADP(i));
 
             // check if block_iter overlaps with free_iter
             while (free_iter != NULL) {
@@ -800,7 +1792,11 @@ static int heap_check_size_class() {
     size_t lower_bound = 2 * DSIZE;
 
     for (size_t index = 0; index < SIZE_CLASS_SIZE; index++) {
-        char* iter = heads[index];
+        char* iter = GETP(HEADP(index));
+
+        /* is the occupancy bit set exactly when the list has blocks? */
+        if ((iter != NULL) != ((GET(CLASS_MAP) >> index) & 1))
+            return 1;
 
         while (iter != NULL) {
             size_t size = GET_SIZE(HDRP(iter));
@@ -814,12 +1810,199 @@ static int heap_check_size_class() {
             iter = GET_NEXTP(iter);
         }
 
+        if (address_order && heap_check_order(index))
+            return 1;
+
         lower_bound <<= 1;
     }
 
     return 0;
 }
 
+/* - Does every live handle point to an allocated handle block tagged with it? */
+/* - Is every handle block the block of a live handle? */
+static int heap_check_handles() {
+    size_t live = 0;
+
+    for (mm_handle_t h = 1; h <= GET(HANDLE_CAPACITY); h++) {
+        char *bp = HPTR(h);
+
+        if (bp == NULL)
+            continue;
+
+        /* the block must lie in the heap before its tag can be read */
+        if (bp <= heap_listp || bp >= epilogue || (size_t)(bp - heap_start) % DSIZE != 0 ||
+                GET_SIZE(HDRP(bp)) < 2 * DSIZE || GET_SIZE(HDRP(bp)) > (size_t)(epilogue - HDRP(bp)) ||
+                !GET_ALLOC(HDRP(bp)) || !GET_HANDLE(HDRP(bp)) || GET(TAGP(bp)) != h)
+            return 1;
+
+        live++;
+    }
+
+    for (char *bp = NEXT_BLKP(heap_listp); GET_SIZE(HDRP(bp)) > 0; bp = NEXT_BLKP(bp)) {
+        if (GET_ALLOC(HDRP(bp)) && GET_HANDLE(HDRP(bp)) && live-- == 0)
+            return 1;
+    }
+
+    return live != 0;
+}
+
+/*
+ * heap_check_attach - check a heap before mm_attach adopts it, in time
+ *      linear in its size, and recompute `slack_bytes` on the way.
+ *      - Is the prologue intact, and does the last block end at the epilogue?
+ *      - Does every block have a sane size, and a footer matching its header?
+ *      - Are there any contiguous free blocks?
+ *      - Does every free list hold free blocks of its size class, with
+ *        consistent back links, and all free blocks between them?
+ *      - Do the rovers and the handle table point into the heap?
+ *      - Does every live handle point to its own handle block, and
+ *        every handle block belong to a live handle?
+ *      - In address order, are the free lists sorted, with every skip
+ *        list level linking exactly the blocks tall enough for it?
+ */
+static int heap_check_attach() {
+    size_t free_blocks = 0;
+    size_t listed = 0;
+    int prev_free = 0;
+    char *bp;
+
+    if (GET(HDRP(heap_listp)) != PACK(DSIZE, 1) || GET(FTRP(heap_listp)) != PACK(DSIZE, 1) ||
+            GET(epilogue) != PACK(0, 1)) {
+        if (verbose)
+            printf("\tPrologue or epilogue is broken!\n");
+        return 1;
+    }
+
+    slack_bytes = 0;
+    for (bp = NEXT_BLKP(heap_listp); bp != epilogue + WSIZE; bp = NEXT_BLKP(bp)) {
+        size_t size = GET_SIZE(HDRP(bp));
+
+        if (size < 2 * DSIZE || size % DSIZE != 0 || size > (size_t)(epilogue - HDRP(bp)) ||
+                GET_SIZE(FTRP(bp)) != size || GET_ALLOC(FTRP(bp)) != GET_ALLOC(HDRP(bp))) {
+            if (verbose)
+                printf("\tBlock @ %p is broken!\n", bp);
+            return 1;
+        }
+
+        if (!GET_ALLOC(HDRP(bp))) {
+            if (prev_free) {
+                if (verbose)
+                    printf("\tContiguous free blocks @ %p!\n", bp);
+                return 1;
+            }
+            free_blocks += 1;
+        } else if (GET_SLACK(HDRP(bp))) {
+            slack_bytes += block_slack(bp);
+        }
+        prev_free = !GET_ALLOC(HDRP(bp));
+    }
+
+    bp = GETP(SKIP_HEADS);
+    if (bp != NULL && (bp <= heap_listp || bp >= epilogue || !GET_ALLOC(HDRP(bp)) ||
+            bp + SIZE_CLASS_SIZE * (SKIP_LEVELS - 1) * WSIZE > FTRP(bp))) {
+        if (verbose)
+            printf("\tSkip list heads are broken!\n");
+        return 1;
+    }
+
+    for (size_t index = 0; index < SIZE_CLASS_SIZE; index++) {
+        char *pp = NULL;
+
+        for (bp = GETP(HEADP(index)); bp != NULL; bp = GET_NEXTP(bp)) {
+            /* a cycle would list more blocks than there are */
+            if (bp <= heap_listp || bp >= epilogue || (size_t)(bp - heap_start) % DSIZE != 0 ||
+                    GET_ALLOC(HDRP(bp)) || get_size_class(GET_SIZE(HDRP(bp))) != index ||
+                    GET_PREVP(bp) != pp || ++listed > free_blocks) {
+                if (verbose)
+                    printf("\tFree list %lu is broken @ %p!\n", (unsigned long)index, bp);
+                return 1;
+            }
+            pp = ADJ_PREVP(bp);
+        }
+
+        if (address_order && heap_check_order(index)) {
+            if (verbose)
+                printf("\tFree list %lu is out of order!\n", (unsigned long)index);
+            return 1;
+        }
+
+        if ((GETP(HEADP(index)) != NULL) != ((GET(CLASS_MAP) >> index) & 1)) {
+            if (verbose)
+                printf("\tOccupancy bit %lu is wrong!\n", (unsigned long)index);
+            return 1;
+        }
+
+        bp = GETP(ROVERP(index));
+        if (bp != NULL && (bp <= heap_listp || bp >= epilogue || GET_ALLOC(HDRP(bp)))) {
+            if (verbose)
+                printf("\tRover %lu is broken!\n", (unsigned long)index);
+            return 1;
+        }
+    }
+
+    if (listed != free_blocks) {
+        if (verbose)
+            printf("\tFree block does not exist in linked list!\n");
+        return 1;
+    }
+
+    bp = GETP(HANDLES);
+    if ((bp == NULL) != (GET(HANDLE_CAPACITY) == 0) || GET(HANDLE_FREE) > GET(HANDLE_CAPACITY) ||
+            (bp != NULL && (bp <= heap_listp || bp + GET(HANDLE_CAPACITY) * DSIZE > epilogue))) {
+        if (verbose)
+            printf("\tHandle table is broken!\n");
+        return 1;
+    }
+
+    if (heap_check_handles()) {
+        if (verbose)
+            printf("\tHandle entries and handle blocks do not match!\n");
+        return 1;
+    }
+
+    return 0;
+}
+
+/*
+ * heap_check_order - check that free list `index` is in address order and
+ *      that its skip list is consistent with it. only follows links to
+ *      blocks already on the free list, so it is safe on a heap that has
+ *      not been checked otherwise, as long as the free list itself is sane
+ */
+static int heap_check_order(size_t index) {
+    char *expect[SKIP_LEVELS];
+    char *prev = NULL;
+
+    /* the next block expected on each level */
+    for (size_t i = 1; i < SKIP_LEVELS; i++)
+        expect[i] = GETP(SKIP_HEADP(index, i));
+
+    for (char *bp = GETP(HEADP(index)); bp != NULL; bp = GET_NEXTP(bp)) {
+        size_t size = GET_SIZE(HDRP(bp));
+        size_t level = GET_LEVEL(bp);
+
+        if (bp <= prev || level < 1 || level > SKIP_LEVELS ||
+                (size > 2 * DSIZE && level > (size - 2 * DSIZE) / WSIZE))
+            return 1;
+
+        for (size_t i = 1; i < level; i++) {
+            if (expect[i] != bp)
+                return 1;
+            expect[i] = GETP(SKIP_LINKP(bp, i));
+        }
+
+        prev = bp;
+    }
+
+    /* every level ends where the free list does */
+    for (size_t i = 1; i < SKIP_LEVELS; i++)
+        if (expect[i] != NULL)
+            return 1;
+
+    return 0;
+}
+
 /* get_size_class: get size class of given block size
  *      this function returns the index of `heads`
  *      that the size class would fit in
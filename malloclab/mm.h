@@ -5,6 +5,43 @@ extern void *mm_malloc (size_t size);
 extern void mm_free (void *ptr);
 extern void *mm_realloc(void *ptr, size_t size);
 
+/* persistent heaps, see mm.c and mem_init_file */
+extern int mm_attach(void);
+extern void mm_set_root(void *ptr);
+extern void *mm_get_root(void);
+
+/* relocatable blocks, see mm.c. a handle of 0 is never valid */
+typedef unsigned int mm_handle_t;
+
+extern mm_handle_t mm_halloc(size_t size);
+extern void mm_hfree(mm_handle_t h);
+extern void *mm_pin(mm_handle_t h);
+extern void mm_unpin(mm_handle_t h);
+extern size_t mm_compact(void);
+
+/* placement policy, see mm.c. also read from $MM_FIT, $MM_SPLIT and $MM_ORDER */
+extern int mm_set_fit_policy(const char *policy);
+extern int mm_set_split_policy(const char *policy);
+extern int mm_set_order_policy(const char *policy);
+extern unsigned long mm_fit_probes(void);
+
+/* heap statistics, see mm_stats. one free list per size class */
+#define MM_STATS_CLASSES 10
+
+typedef struct {
+    size_t heap_bytes;      // bytes taken from memlib
+    size_t free_bytes;      // bytes in free blocks, headers included
+    size_t largest_free;    // largest free block
+    size_t free_blocks[MM_STATS_CLASSES];   // free list lengths
+} mm_stats_t;
+
+extern void mm_stats(mm_stats_t *stats);
+
+/* placement hints, see mm_malloc_hint */
+#define MM_HINT_COLD    0x1     // keep the block away from the hot blocks
+
+extern void *mm_malloc_hint(size_t size, const void *hint, int flags);
+
 
 /*
  * Students work in teams of one or two.  Teams enter their team name,
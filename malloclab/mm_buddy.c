@@ -0,0 +1,515 @@
+/*
+ * mm_buddy.c - binary buddy allocator, an alternative backend for mm.h
+ *
+ * The heap is a single arena of 2 ^ heap_order bytes that doubles whenever
+ * no free block is large enough. Every block is 2 ^ k bytes for some order
+ * k >= MIN_ORDER and starts at a multiple of its size, counting from the
+ * start of the arena, so the buddy of the block at offset `off` of order k
+ * is at `off ^ (1 << k)`.
+ *
+ * Blocks carry no header. Everything else lives in a metadata block that is
+ * allocated from the arena like any other block:
+ *   - one free list per order. free blocks link through 32-bit arena offsets
+ *     kept in their first two words
+ *   - one free bitmap per order, a bit per block of that order. coalescing
+ *     asks it whether the buddy is free instead of reading the buddy
+ *   - one split bitmap per order, set for blocks that are divided into two
+ *     halves. the order of an allocated block is the smallest order whose
+ *     parent block is split, so mm_free needs nothing but the pointer
+ * When the arena doubles, the metadata moves to the start of the new half.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "mm.h"
+#include "memlib.h"
+#include "mm_prof.h"
+
+#define MIN_ORDER   4       // smallest block, room for two free list links
+#define INIT_ORDER  12      // arena size after mm_init
+#define MAX_ORDER   30      // mem_sbrk takes an int
+#define NUM_ORDERS  (MAX_ORDER + 1)
+
+#define NIL         0xffffffffu     // end of a free list
+
+/* Read and write a word at address p */
+#define GET(p)          (*(unsigned int *)(p))
+#define PUT(p, val)     (*(unsigned int *)(p) = (val))
+
+/* free list links of the free block at offset `off` */
+#define NEXT_FREE(off)  (arena + (off))
+#define PREV_FREE(off)  (arena + (off) + 4)
+
+/* buddy of the block at offset `off` of order `k` */
+#define BUDDY(off, k)   ((off) ^ (1u << (k)))
+
+/*
+Bitmaps:
+the free bits of order k, one per block of 2 ^ k bytes, come after those of
+every smaller order, and the split bits of all orders after the free bits.
+the smallest blocks are never split. a region of 2 ^ n bits starts at a
+multiple of 2 ^ n, so every region of 32 bits or more is word aligned.
+*/
+#define FREE_BASE(K, k)     ((1u << ((K) - MIN_ORDER + 1)) - (1u << ((K) - (k) + 1)))
+#define SPLIT_BASE(K, k)    ((1u << ((K) - MIN_ORDER + 1)) + (1u << ((K) - MIN_ORDER)) - \
+                             (1u << ((K) - (k) + 1)))
+#define META_BITS(K)        SPLIT_BASE(K, (K) + 1)
+
+/* bits of the block at `off` of order `k` in the current arena */
+#define FREE_BIT(k, off)    (FREE_BASE(heap_order, k) + ((off) >> (k)))
+#define SPLIT_BIT(k, off)   (SPLIT_BASE(heap_order, k) + ((off) >> (k)))
+
+#define GET_BIT(i)      ((bits[(i) >> 5] >> ((i) & 31)) & 1)
+#define SET_BIT(i)      (bits[(i) >> 5] |= 1u << ((i) & 31))
+#define CLEAR_BIT(i)    (bits[(i) >> 5] &= ~(1u << ((i) & 31)))
+
+extern int verbose;
+
+int heap_check_flag = 0;
+
+static char *arena;                 // start of the arena
+static unsigned int heap_order;     // the arena is 2 ^ heap_order bytes
+
+/* metadata block, and the free list heads and bitmaps inside it */
+static unsigned int meta_off;
+static unsigned int meta_order;
+static unsigned int *heads;
+static unsigned int *bits;
+
+static size_t meta_size(unsigned int K);
+static unsigned int size_order(size_t size);
+static unsigned int block_order(unsigned int off);
+static unsigned int alloc_block(unsigned int k);
+static void free_block(unsigned int off, unsigned int k);
+static void carve(unsigned int off, unsigned int from, unsigned int to);
+static int grow_arena();
+static void copy_bits(unsigned int to, unsigned int *src, unsigned int from, unsigned int n);
+static void push_free(unsigned int off, unsigned int k);
+static unsigned int pop_free(unsigned int k);
+static void remove_free(unsigned int off, unsigned int k);
+
+static int heap_check();
+
+/*
+ * mm_init - initialize the malloc package.
+ */
+int mm_init(void) {
+    if ((arena = mem_sbrk(1 << INIT_ORDER)) == (void *)-1)
+        return -1;
+
+    heap_order = INIT_ORDER;
+    meta_off = 0;
+    meta_order = size_order(meta_size(heap_order));
+
+    heads = (unsigned int *)(arena + meta_off);
+    bits = heads + NUM_ORDERS;
+    memset(heads, 0, meta_size(heap_order));
+    for (int k = 0; k < NUM_ORDERS; k++)
+        heads[k] = NIL;
+
+    /* the metadata is the first block, everything after it is free */
+    carve(meta_off, heap_order, meta_order);
+
+    return 0;
+}
+
+/*
+ * mm_malloc - Allocate the smallest block of 2 ^ k bytes that holds `size`,
+ *      splitting a larger free block or doubling the arena if needed.
+ */
+void *mm_malloc(size_t size) {
+    if (verbose)
+        printf("Entering mm_malloc()\n");
+
+    unsigned int off;
+    void *bp;
+
+    if (size == 0 || size > (1u << MAX_ORDER))
+        return NULL;
+
+    while ((off = alloc_block(size_order(size))) == NIL)
+        if (grow_arena() < 0)
+            return NULL;
+
+    bp = arena + off;
+
+    if (heap_check_flag)
+        if (heap_check() && verbose)
+            printf("Heap compromised!\n");
+
+    MM_PROF_MALLOC(bp, size);
+    return bp;
+}
+
+/*
+ * mm_free - Give the block back and merge it with its free buddies.
+ */
+void mm_free(void *bp) {
+    if (verbose)
+        printf("Entering mm_free()\n");
+
+    unsigned int off = (char *)bp - arena;
+
+    MM_PROF_FREE(bp);
+    free_block(off, block_order(off));
+
+    if (heap_check_flag)
+        if (heap_check() && verbose)
+            printf("Heap compromised!\n");
+}
+
+/*
+ * mm_realloc - shrink in place by splitting off the upper halves, grow in
+ *      place while the block is a lower half with a free buddy, and move
+ *      the block otherwise.
+ */
+void *mm_realloc(void *ptr, size_t size) {
+    if (verbose)
+        printf("Entering mm_realloc()\n");
+
+    unsigned int off, k, new_k, j;
+    void *newptr;
+
+    if (size == 0) {
+        mm_free(ptr);
+        return NULL;
+    }
+
+    if (ptr == NULL)
+        return mm_malloc(size);
+
+    /* no block is that large; the old one is left as it is */
+    if (size > (1u << MAX_ORDER))
+        return NULL;
+
+    off = (char *)ptr - arena;
+    k = block_order(off);
+    new_k = size_order(size);
+
+    if (new_k <= k) {
+        carve(off, k, new_k);
+        return ptr;
+    }
+
+    /* every buddy up to the new order must be an upper half and free */
+    for (j = k; j < new_k && j < heap_order; j++)
+        if ((off & (1u << j)) || !GET_BIT(FREE_BIT(j, BUDDY(off, j))))
+            break;
+
+    if (j == new_k) {
+        if (verbose)
+            printf("Merging free buddies. order: %u -> %u\n", k, new_k);
+
+        for (j = k; j < new_k; j++) {
+            remove_free(BUDDY(off, j), j);
+            CLEAR_BIT(SPLIT_BIT(j + 1, off));
+        }
+        return ptr;
+    }
+
+    if ((newptr = mm_malloc(size)) == NULL)
+        return NULL;
+
+    memcpy(newptr, ptr, 1u << k);
+    mm_free(ptr);
+
+    return newptr;
+}
+
+/*
+ * mm_set_fit_policy - the buddy system has a single fit policy
+ */
+int mm_set_fit_policy(const char *policy) {
+    return -1;
+}
+
+/*
+ * mm_set_split_policy - the buddy system always splits in halves
+ */
+int mm_set_split_policy(const char *policy) {
+    return -1;
+}
+
+/*
+ * mm_set_order_policy - the buddy system keeps its free lists unordered
+ */
+int mm_set_order_policy(const char *policy) {
+    return -1;
+}
+
+/*
+ * mm_fit_probes - the buddy system takes the head of a free list by order
+ *      and never searches a free list
+ */
+unsigned long mm_fit_probes(void) {
+    return 0;
+}
+
+/*
+ * mm_malloc_hint - a buddy block has only one place it can go, its
+ *      buddy, so hints are ignored
+ */
+void *mm_malloc_hint(size_t size, const void *hint, int flags) {
+    return mm_malloc(size);
+}
+
+/*
+ * mm_halloc - buddy blocks are found by their offset and cannot move,
+ *      so there are no relocatable blocks. always fails
+ */
+mm_handle_t mm_halloc(size_t size) {
+    return 0;
+}
+
+/*
+ * mm_hfree, mm_pin, mm_unpin - no handle is ever valid
+ */
+void mm_hfree(mm_handle_t h) {
+}
+
+void *mm_pin(mm_handle_t h) {
+    return NULL;
+}
+
+void mm_unpin(mm_handle_t h) {
+}
+
+/*
+ * mm_compact - nothing can move, so the heap never shrinks
+ */
+size_t mm_compact(void) {
+    return 0;
+}
+
+/*
+ * alloc_block - take a block of order `k` from the smallest free block
+ *      that can hold it. returns its offset, or NIL if there is none
+ */
+static unsigned int alloc_block(unsigned int k) {
+    unsigned int i, off;
+
+    for (i = k; i <= heap_order; i++)
+        if (heads[i] != NIL)
+            break;
+
+    if (i > heap_order)
+        return NIL;
+
+    off = pop_free(i);
+    carve(off, i, k);
+
+    return off;
+}
+
+/*
+ * free_block - free the block at `off` of order `k`, merging it with its
+ *      buddy for as long as the buddy is free
+ */
+static void free_block(unsigned int off, unsigned int k) {
+    while (k < heap_order && GET_BIT(FREE_BIT(k, BUDDY(off, k)))) {
+        remove_free(BUDDY(off, k), k);
+        off &= ~(1u << k);
+        k++;
+        CLEAR_BIT(SPLIT_BIT(k, off));
+    }
+
+    push_free(off, k);
+}
+
+/*
+ * carve - split the block at `off`, which is on no free list, from order
+ *      `from` down to order `to`, freeing every upper half on the way
+ */
+static void carve(unsigned int off, unsigned int from, unsigned int to) {
+    unsigned int k;
+
+    for (k = from; k > to; k--) {
+        SET_BIT(SPLIT_BIT(k, off));
+        push_free(off + (1u << (k - 1)), k - 1);
+    }
+}
+
+/*
+ * block_order - order of the allocated block at `off`: the smallest order
+ *      whose parent block is split
+ */
+static unsigned int block_order(unsigned int off) {
+    unsigned int k;
+
+    for (k = MIN_ORDER; k < heap_order; k++)
+        if (GET_BIT(SPLIT_BIT(k + 1, off)))
+            return k;
+
+    return heap_order;
+}
+
+/*
+ * grow_arena - double the arena. the old arena becomes the lower half of
+ *      the new one, and the metadata for the new size is allocated at the
+ *      start of the upper half, after which the old metadata is freed.
+ *      returns -1 if the heap cannot grow
+ */
+static int grow_arena() {
+    if (verbose)
+        printf("Entering grow_arena()\n");
+
+    unsigned int old_order = heap_order;
+    unsigned int old_off = meta_off, old_meta_order = meta_order;
+    unsigned int *old_bits = bits;
+    unsigned int *new_heads;
+    unsigned int k;
+
+    if (heap_order == MAX_ORDER || mem_sbrk(1 << heap_order) == (void *)-1)
+        return -1;
+
+    /* lay out the metadata for the doubled arena in the new upper half */
+    new_heads = (unsigned int *)(arena + (1u << old_order));
+    memset(new_heads, 0, meta_size(old_order + 1));
+    memcpy(new_heads, heads, NUM_ORDERS * sizeof(unsigned int));
+
+    heap_order = old_order + 1;
+    meta_off = 1u << old_order;
+    meta_order = size_order(meta_size(heap_order));
+    heads = new_heads;
+    bits = heads + NUM_ORDERS;
+
+    /* copy the bits of every block in the lower half */
+    for (k = MIN_ORDER; k <= old_order; k++) {
+        copy_bits(FREE_BASE(heap_order, k), old_bits, FREE_BASE(old_order, k),
+                1u << (old_order - k));
+        if (k > MIN_ORDER)
+            copy_bits(SPLIT_BASE(heap_order, k), old_bits, SPLIT_BASE(old_order, k),
+                    1u << (old_order - k));
+    }
+
+    /* the new root is split, and its upper half holds the new metadata */
+    SET_BIT(SPLIT_BIT(heap_order, 0));
+    carve(meta_off, old_order, meta_order);
+
+    free_block(old_off, old_meta_order);
+
+    return 0;
+}
+
+/*
+ * copy_bits - copy `n` bits, a power of two, from bit `from` of `src`
+ *      to bit `to` of the current bitmaps
+ */
+static void copy_bits(unsigned int to, unsigned int *src, unsigned int from, unsigned int n) {
+    unsigned int i;
+
+    if (n >= 32) {
+        memcpy(bits + to / 32, src + from / 32, n / 8);
+        return;
+    }
+
+    for (i = 0; i < n; i++)
+        if ((src[(from + i) >> 5] >> ((from + i) & 31)) & 1)
+            SET_BIT(to + i);
+}
+
+/*
+ * meta_size - bytes of metadata for an arena of 2 ^ K bytes
+ */
+static size_t meta_size(unsigned int K) {
+    return (NUM_ORDERS + (META_BITS(K) + 31) / 32) * sizeof(unsigned int);
+}
+
+/*
+ * size_order - smallest order whose blocks hold `size` bytes.
+ *      `size` must be at most 2 ^ MAX_ORDER
+ */
+static unsigned int size_order(size_t size) {
+    unsigned int k = MIN_ORDER;
+
+    while ((1ul << k) < size)
+        k++;
+
+    return k;
+}
+
+/*
+ * push_free - put the block at `off` on the free list of order `k`
+ */
+static void push_free(unsigned int off, unsigned int k) {
+    PUT(NEXT_FREE(off), heads[k]);
+    PUT(PREV_FREE(off), NIL);
+    if (heads[k] != NIL)
+        PUT(PREV_FREE(heads[k]), off);
+    heads[k] = off;
+
+    SET_BIT(FREE_BIT(k, off));
+}
+
+/*
+ * pop_free - take the first block off the free list of order `k`
+ */
+static unsigned int pop_free(unsigned int k) {
+    unsigned int off = heads[k];
+
+    remove_free(off, k);
+    return off;
+}
+
+/*
+ * remove_free - take the block at `off` off the free list of order `k`
+ */
+static void remove_free(unsigned int off, unsigned int k) {
+    unsigned int next = GET(NEXT_FREE(off));
+    unsigned int prev = GET(PREV_FREE(off));
+
+    if (prev == NIL)
+        heads[k] = next;
+    else
+        PUT(NEXT_FREE(prev), next);
+
+    if (next != NIL)
+        PUT(PREV_FREE(next), prev);
+
+    CLEAR_BIT(FREE_BIT(k, off));
+}
+
+/*
+ * heap_check - check that the free lists and the free bitmaps agree,
+ *      and that no free block is split or has a free buddy.
+ *      returns nonzero if the heap is inconsistent
+ */
+static int heap_check() {
+    unsigned int k, off, listed, marked, i;
+    int errors = 0;
+
+    for (k = MIN_ORDER; k <= heap_order; k++) {
+        listed = 0;
+        for (off = heads[k]; off != NIL; off = GET(NEXT_FREE(off))) {
+            listed++;
+            if (off & ((1u << k) - 1)) {
+                printf("Free block %u of order %u is misaligned\n", off, k);
+                errors++;
+            }
+            if (!GET_BIT(FREE_BIT(k, off))) {
+                printf("Free block %u of order %u is not marked free\n", off, k);
+                errors++;
+            }
+            if (k > MIN_ORDER && GET_BIT(SPLIT_BIT(k, off))) {
+                printf("Free block %u of order %u is split\n", off, k);
+                errors++;
+            }
+            if (k < heap_order && GET_BIT(FREE_BIT(k, BUDDY(off, k)))) {
+                printf("Free block %u of order %u has a free buddy\n", off, k);
+                errors++;
+            }
+        }
+
+        marked = 0;
+        for (i = 0; i < (1u << (heap_order - k)); i++)
+            marked += GET_BIT(FREE_BIT(k, i << k));
+
+        if (listed != marked) {
+            printf("Order %u lists %u free blocks but marks %u\n", k, listed, marked);
+            errors++;
+        }
+    }
+
+    return errors;
+}
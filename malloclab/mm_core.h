@@ -0,0 +1,392 @@
+#ifndef MM_CORE_H
+#define MM_CORE_H
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+extern "C" {
+#include "memlib.h"
+}
+
+/*
+ * mm_core - the segregated fit allocator of mm.c as a header-only template.
+ *
+ * Everything mm.c hard-codes as a macro comes from a policy instead, so a
+ * variant is a new policy and an instantiation rather than an edited copy:
+ *
+ *   alignment        payload alignment, a power of two of at least 8
+ *   chunk_size       least number of bytes the heap grows by
+ *   split_threshold  remainders at least this large stay on the left of a
+ *                    split block, and the allocation goes to the right
+ *   class_count      number of size classes, at most 64
+ *   class_limit(i)   block sizes below this go to size class i or lower.
+ *                    the last size class takes every larger block
+ *   pow2_classes     class_limit(i) is class_limit(0) << i
+ *
+ * The size class of a block is computed from a table the compiler fills
+ * in from class_limit, or from a shift when the classes are powers of two.
+ *
+ * Blocks have a 4-byte header and footer holding the size and allocated
+ * bit, like mm.c. Free blocks are kept in LIFO lists per size class, found
+ * by first fit, and the next non-empty larger class is found through an
+ * occupancy bitmap. Links are plain pointers, so unlike mm.c the heap
+ * cannot be mapped back in by another process. It allocates from memlib
+ * like mm.c, and is not thread-safe either.
+ */
+
+namespace mm_core_detail {
+
+constexpr std::size_t floor_log2(std::size_t n) {
+    return n <= 1 ? 0 : 1 + floor_log2(n >> 1);
+}
+
+constexpr std::size_t round_up(std::size_t n, std::size_t to) {
+    return (n + to - 1) / to * to;
+}
+
+/*
+ * class_table - entry k is the size class of a block of k * alignment
+ *      bytes, for blocks below the limit of the next to last class
+ */
+template <class Policy>
+constexpr std::size_t class_table_size = Policy::class_limit(Policy::class_count - 2) / Policy::alignment;
+
+template <class Policy>
+constexpr std::array<std::uint8_t, class_table_size<Policy>> make_class_table() {
+    std::array<std::uint8_t, class_table_size<Policy>> table{};
+    std::size_t index = 0;
+
+    for (std::size_t k = 0; k < table.size(); k++) {
+        while (k * Policy::alignment >= Policy::class_limit(index))
+            index++;
+        table[k] = index;
+    }
+    return table;
+}
+
+template <class Policy>
+constexpr std::array<std::uint8_t, class_table_size<Policy>> class_table = make_class_table<Policy>();
+
+}
+
+template <class Policy>
+class mm_core {
+    using word = std::uint32_t;
+
+    static constexpr std::size_t WSIZE = sizeof(word);     // header and footer size
+    static constexpr std::size_t ALIGNMENT = Policy::alignment;
+    static constexpr std::size_t CLASSES = Policy::class_count;
+
+    /* a free block holds its header, links and footer */
+    static constexpr std::size_t MIN_BLOCK =
+        mm_core_detail::round_up(2 * WSIZE + 2 * sizeof(void *), ALIGNMENT);
+
+    static_assert(ALIGNMENT >= 8 && (ALIGNMENT & (ALIGNMENT - 1)) == 0,
+            "alignment must be a power of two of at least 8");
+    static_assert(CLASSES >= 2 && CLASSES <= 64, "between 2 and 64 size classes");
+    static_assert(Policy::class_limit(0) > MIN_BLOCK,
+            "the first size class must hold the smallest block");
+    static_assert(Policy::chunk_size % ALIGNMENT == 0,
+            "chunk size must be a multiple of the alignment");
+
+public:
+    /*
+     * size_class - size class of a block of `size` bytes
+     */
+    static constexpr std::size_t size_class(std::size_t size) {
+        if constexpr (Policy::pow2_classes) {
+            constexpr std::size_t shift = mm_core_detail::floor_log2(Policy::class_limit(0));
+            std::size_t index;
+
+            if (size < Policy::class_limit(0))
+                return 0;
+            index = (sizeof(unsigned long) * 8 - 1 - __builtin_clzl(size)) - shift + 1;
+            return index < CLASSES ? index : CLASSES - 1;
+        } else {
+            constexpr auto &table = mm_core_detail::class_table<Policy>;
+
+            return size / ALIGNMENT < table.size() ? table[size / ALIGNMENT] : CLASSES - 1;
+        }
+    }
+
+    /*
+     * init - start a new heap at the current brk of memlib
+     */
+    int init() {
+        char *p;
+
+        /* padding that aligns the first payload, and the epilogue header */
+        if ((p = static_cast<char *>(mem_sbrk(ALIGNMENT))) == (char *)-1)
+            return -1;
+        first = p + ALIGNMENT;
+        epilogue = first - WSIZE;
+        put(epilogue, pack(0, 1));
+
+        heads.fill(nullptr);
+        class_map = 0;
+        return extend(Policy::chunk_size) == nullptr ? -1 : 0;
+    }
+
+    void *malloc(std::size_t size) {
+        std::size_t asize;
+        char *bp;
+
+        if (size == 0)
+            return nullptr;
+        asize = adjust(size);
+
+        if ((bp = find_fit(asize)) == nullptr &&
+                (bp = extend(asize > Policy::chunk_size ? asize : Policy::chunk_size)) == nullptr)
+            return nullptr;
+        return place(bp, asize);
+    }
+
+    void free(void *ptr) {
+        char *bp = static_cast<char *>(ptr);
+
+        if (bp == nullptr)
+            return;
+        put(hdrp(bp), pack(get_size(hdrp(bp)), 0));
+        put(ftrp(bp), pack(get_size(hdrp(bp)), 0));
+        coalesce(bp);
+    }
+
+    /*
+     * realloc - shrink in place, grow into a free next block or the end
+     *      of the heap, or else move the block
+     */
+    void *realloc(void *ptr, std::size_t size) {
+        char *bp = static_cast<char *>(ptr);
+        std::size_t asize, csize;
+        char *next, *newp;
+
+        if (bp == nullptr)
+            return malloc(size);
+        if (size == 0) {
+            free(bp);
+            return nullptr;
+        }
+
+        asize = adjust(size);
+        csize = get_size(hdrp(bp));
+        if (asize <= csize) {
+            shrink(bp, asize);
+            return bp;
+        }
+
+        next = bp + csize;
+        if (next - WSIZE == epilogue) {
+            if (extend(asize - csize) == nullptr)
+                return nullptr;
+        }
+        if (!get_alloc(hdrp(next)) && csize + get_size(hdrp(next)) >= asize) {
+            remove(next);
+            csize += get_size(hdrp(next));
+            put(hdrp(bp), pack(csize, 1));
+            put(ftrp(bp), pack(csize, 1));
+            shrink(bp, asize);
+            return bp;
+        }
+
+        if ((newp = static_cast<char *>(malloc(size))) == nullptr)
+            return nullptr;
+        std::memcpy(newp, bp, get_size(hdrp(bp)) - 2 * WSIZE);
+        free(bp);
+        return newp;
+    }
+
+private:
+    char *first = nullptr;      // payload of the first block
+    char *epilogue = nullptr;   // header of size 0 after the last block
+    std::array<char *, CLASSES> heads{};
+    std::uint64_t class_map = 0;    // bit i is set while size class i has free blocks
+
+    static word get(const char *p) { return *reinterpret_cast<const word *>(p); }
+    static void put(char *p, std::size_t val) { *reinterpret_cast<word *>(p) = static_cast<word>(val); }
+    static std::size_t pack(std::size_t size, std::size_t alloc) { return size | alloc; }
+    static std::size_t get_size(const char *p) { return get(p) & ~static_cast<word>(0x7); }
+    static bool get_alloc(const char *p) { return get(p) & 0x1; }
+
+    static char *hdrp(char *bp) { return bp - WSIZE; }
+    static char *ftrp(char *bp) { return bp + get_size(hdrp(bp)) - 2 * WSIZE; }
+
+    static char *&nextp(char *bp) { return reinterpret_cast<char **>(bp)[0]; }
+    static char *&prevp(char *bp) { return reinterpret_cast<char **>(bp)[1]; }
+
+    /* block size for a payload of `size` bytes */
+    static std::size_t adjust(std::size_t size) {
+        std::size_t asize = mm_core_detail::round_up(size + 2 * WSIZE, ALIGNMENT);
+        return asize < MIN_BLOCK ? MIN_BLOCK : asize;
+    }
+
+    /*
+     * extend - grow the heap by at least `bytes`, and return the free
+     *      block at its end. the block is never too small to hold its
+     *      links, even when it cannot be coalesced
+     */
+    char *extend(std::size_t bytes) {
+        std::size_t size = mm_core_detail::round_up(bytes < MIN_BLOCK ? MIN_BLOCK : bytes, ALIGNMENT);
+        char *bp;
+
+        if ((bp = static_cast<char *>(mem_sbrk(size))) == (char *)-1)
+            return nullptr;
+
+        /* the old epilogue becomes the header of the new block */
+        bp = epilogue + WSIZE;
+        put(hdrp(bp), pack(size, 0));
+        put(ftrp(bp), pack(size, 0));
+        epilogue = bp + size - WSIZE;
+        put(epilogue, pack(0, 1));
+        return coalesce(bp);
+    }
+
+    char *find_fit(std::size_t asize) {
+        std::uint64_t map = class_map & (~static_cast<std::uint64_t>(0) << size_class(asize));
+
+        while (map != 0) {
+            for (char *bp = heads[__builtin_ctzll(map)]; bp != nullptr; bp = nextp(bp))
+                if (asize <= get_size(hdrp(bp)))
+                    return bp;
+            map &= map - 1;
+        }
+        return nullptr;
+    }
+
+    /*
+     * place - allocate `asize` bytes of free block bp, splitting off the
+     *      rest if it makes a block of its own
+     */
+    char *place(char *bp, std::size_t asize) {
+        std::size_t csize = get_size(hdrp(bp));
+        std::size_t rest = csize - asize;
+
+        remove(bp);
+        if (rest < MIN_BLOCK) {
+            put(hdrp(bp), pack(csize, 1));
+            put(ftrp(bp), pack(csize, 1));
+            return bp;
+        }
+
+        if (rest >= Policy::split_threshold) {
+            put(hdrp(bp), pack(rest, 0));
+            put(ftrp(bp), pack(rest, 0));
+            insert(bp);
+            bp += rest;
+            put(hdrp(bp), pack(asize, 1));
+            put(ftrp(bp), pack(asize, 1));
+        } else {
+            put(hdrp(bp), pack(asize, 1));
+            put(ftrp(bp), pack(asize, 1));
+            put(hdrp(bp + asize), pack(rest, 0));
+            put(ftrp(bp + asize), pack(rest, 0));
+            insert(bp + asize);
+        }
+        return bp;
+    }
+
+    /*
+     * shrink - cut allocated block bp down to `asize` bytes, freeing the
+     *      rest if it makes a block of its own
+     */
+    void shrink(char *bp, std::size_t asize) {
+        std::size_t rest = get_size(hdrp(bp)) - asize;
+
+        if (rest < MIN_BLOCK)
+            return;
+        put(hdrp(bp), pack(asize, 1));
+        put(ftrp(bp), pack(asize, 1));
+        put(hdrp(bp + asize), pack(rest, 0));
+        put(ftrp(bp + asize), pack(rest, 0));
+        coalesce(bp + asize);
+    }
+
+    /*
+     * coalesce - merge free block bp with its free neighbours, and put
+     *      the result on its free list
+     */
+    char *coalesce(char *bp) {
+        std::size_t size = get_size(hdrp(bp));
+        char *next = bp + size;
+
+        if (!get_alloc(hdrp(next))) {
+            remove(next);
+            size += get_size(hdrp(next));
+        }
+        if (bp != first && !get_alloc(bp - 2 * WSIZE)) {
+            char *prev = bp - get_size(bp - 2 * WSIZE);
+
+            remove(prev);
+            size += get_size(hdrp(prev));
+            bp = prev;
+        }
+
+        put(hdrp(bp), pack(size, 0));
+        put(ftrp(bp), pack(size, 0));
+        insert(bp);
+        return bp;
+    }
+
+    void insert(char *bp) {
+        std::size_t index = size_class(get_size(hdrp(bp)));
+
+        nextp(bp) = heads[index];
+        prevp(bp) = nullptr;
+        if (heads[index] != nullptr)
+            prevp(heads[index]) = bp;
+        heads[index] = bp;
+        class_map |= static_cast<std::uint64_t>(1) << index;
+    }
+
+    void remove(char *bp) {
+        std::size_t index = size_class(get_size(hdrp(bp)));
+
+        if (prevp(bp) != nullptr)
+            nextp(prevp(bp)) = nextp(bp);
+        else
+            heads[index] = nextp(bp);
+        if (nextp(bp) != nullptr)
+            prevp(nextp(bp)) = prevp(bp);
+        if (heads[index] == nullptr)
+            class_map &= ~(static_cast<std::uint64_t>(1) << index);
+    }
+};
+
+/*
+ * Prebuilt policies
+ */
+
+/* mm.c's own constants: 10 power of two classes from 16 bytes */
+struct mm_pow2_policy {
+    static constexpr std::size_t alignment = 8;
+    static constexpr std::size_t chunk_size = 1 << 6;
+    static constexpr std::size_t split_threshold = 256;
+    static constexpr std::size_t class_count = 10;
+    static constexpr bool pow2_classes = true;
+    static constexpr std::size_t class_limit(std::size_t i) { return (std::size_t)32 << i; }
+};
+
+/* 16 classes 8 bytes apart up to 152 bytes, then four per power of two */
+struct mm_fine_policy {
+    static constexpr std::size_t alignment = 8;
+    static constexpr std::size_t chunk_size = 4096;
+    static constexpr std::size_t split_threshold = 128;
+    static constexpr std::size_t class_count = 40;
+    static constexpr bool pow2_classes = false;
+    static constexpr std::size_t class_limit(std::size_t i) {
+        return i < 16 ? 32 + 8 * i : ((std::size_t)32 << ((i - 16) / 4)) * (5 + (i - 16) % 4);
+    }
+};
+
+/* 16-byte alignment, for SSE payloads, with power of two classes */
+struct mm_align16_policy {
+    static constexpr std::size_t alignment = 16;
+    static constexpr std::size_t chunk_size = 4096;
+    static constexpr std::size_t split_threshold = 512;
+    static constexpr std::size_t class_count = 16;
+    static constexpr bool pow2_classes = true;
+    static constexpr std::size_t class_limit(std::size_t i) { return (std::size_t)64 << i; }
+};
+
+#endif
@@ -0,0 +1,37 @@
+/*
+ * mm_cores.cc - prebuilt instantiations of mm_core, with C entry points
+ */
+#include "mm_core.h"
+
+extern "C" {
+#include "mm_cores.h"
+}
+
+namespace {
+
+mm_core<mm_pow2_policy> pow2_core;
+mm_core<mm_fine_policy> fine_core;
+mm_core<mm_align16_policy> align16_core;
+
+/* C entry points of one instantiation */
+template <class Core, Core &core>
+struct entry {
+    static int init(void) { return core.init(); }
+    static void *malloc(size_t size) { return core.malloc(size); }
+    static void free(void *ptr) { core.free(ptr); }
+    static void *realloc(void *ptr, size_t size) { return core.realloc(ptr, size); }
+};
+
+#define CORE(name, core) \
+    {name, entry<decltype(core), core>::init, entry<decltype(core), core>::malloc, \
+        entry<decltype(core), core>::free, entry<decltype(core), core>::realloc}
+
+}
+
+const mm_core_t mm_cores[] = {
+    CORE("pow2 (mm.c constants)", pow2_core),
+    CORE("fine (40 classes)", fine_core),
+    CORE("align16", align16_core),
+};
+
+const int mm_num_cores = sizeof(mm_cores) / sizeof(mm_cores[0]);
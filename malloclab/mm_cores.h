@@ -0,0 +1,19 @@
+#include <stdio.h>
+
+/*
+ * Prebuilt instantiations of the templated allocator core in mm_core.h,
+ * for C programs like mdriver. Each one has its own policy of size
+ * classes, alignment, chunk size and split threshold, see mm_cores.cc.
+ * Only one of them can own the memlib heap at a time; init starts a
+ * new heap at the current brk.
+ */
+typedef struct {
+    const char *name;
+    int (*init)(void);
+    void *(*malloc)(size_t size);
+    void (*free)(void *ptr);
+    void *(*realloc)(void *ptr, size_t size);
+} mm_core_t;
+
+extern const mm_core_t mm_cores[];
+extern const int mm_num_cores;
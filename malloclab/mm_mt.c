@@ -0,0 +1,243 @@
+/*
+ * mm_mt.c - thread-aware front end to mm.c with remote-free queues
+ *
+ * Every block gets one extra word in front of its payload naming the cache
+ * of the thread that allocated it. Blocks freed by their owner go straight
+ * back to mm.c under the heap lock. Blocks freed by any other thread are
+ * pushed onto the owner's remote-free queue instead, a multi-producer,
+ * single-consumer stack linked through the first word of the freed payload:
+ *   - producers push with a compare-and-swap on the head
+ *   - the owner takes the whole stack with one atomic exchange, so it never
+ *     pops single nodes and the stack cannot suffer from ABA
+ * The owner drains its queue in one batch whenever it takes the heap lock to
+ * allocate, so a cross-thread free costs one CAS and no lock at all.
+ *
+ * Caches are never freed. A detached cache is recycled by the next thread
+ * to attach, which also drains any frees that arrived after the detach.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "mm.h"
+#include "mm_mt.h"
+
+#define MT_HDR          8       // owner word in front of the payload, keeps 8-byte alignment
+#define CACHE_LINE      64
+
+/* cache of the thread that allocated the payload at p */
+#define OWNER(p)        (*(mt_cache_t **)((char *)(p) - MT_HDR))
+
+/* next block on a remote-free queue, kept in the freed payload */
+#define NEXT_REMOTE(p)  (*(char **)(p))
+
+typedef struct {
+    char *remote;               // head of the remote-free queue
+    int in_use;                 // attached to a thread
+
+    /* statistics, written by the attached thread only */
+    unsigned long locks;
+    unsigned long contended;
+    unsigned long queued;
+    unsigned long drained;
+} __attribute__((aligned(CACHE_LINE))) mt_cache_t;
+
+static mt_cache_t caches[MM_MT_MAX_CACHES];
+static pthread_mutex_t heap_lock = PTHREAD_MUTEX_INITIALIZER;
+static int remote_queues;
+
+static __thread mt_cache_t *self;
+
+static void lock_heap(void);
+static void drain_remote(void);
+
+/*
+ * mm_mt_init - initialize mm.c and forget every cache. threads must attach
+ *      again afterwards. with `remote_queues` off, cross-thread frees take
+ *      the heap lock like any other free.
+ */
+int mm_mt_init(int remote_queues_on) {
+    pthread_mutex_lock(&heap_lock);
+    memset(caches, 0, sizeof(caches));
+    remote_queues = remote_queues_on;
+    self = NULL;
+
+    if (mm_init() < 0) {
+        pthread_mutex_unlock(&heap_lock);
+        return -1;
+    }
+
+    pthread_mutex_unlock(&heap_lock);
+    return 0;
+}
+
+/*
+ * mm_mt_attach - give the calling thread a cache. the allocation routines
+ *      attach on first use, so calling this is only needed to fail early.
+ *      returns -1 if all caches are taken
+ */
+int mm_mt_attach(void) {
+    int i, free_cache;
+
+    if (self != NULL)
+        return 0;
+
+    for (i = 0; i < MM_MT_MAX_CACHES; i++) {
+        free_cache = 0;
+        if (__atomic_compare_exchange_n(&caches[i].in_use, &free_cache, 1, 0,
+                    __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+            self = &caches[i];
+            return 0;
+        }
+    }
+
+    return -1;
+}
+
+/*
+ * mm_mt_detach - free what other threads queued for us and give up the cache
+ */
+void mm_mt_detach(void) {
+    if (self == NULL)
+        return;
+
+    lock_heap();
+    drain_remote();
+    pthread_mutex_unlock(&heap_lock);
+
+    __atomic_store_n(&self->in_use, 0, __ATOMIC_RELEASE);
+    self = NULL;
+}
+
+/*
+ * mm_mt_malloc - allocate under the heap lock, first freeing the blocks
+ *      other threads queued for us since we last held it
+ */
+void *mm_mt_malloc(size_t size) {
+    char *bp;
+
+    if (self == NULL && mm_mt_attach() < 0)
+        return NULL;
+
+    lock_heap();
+    drain_remote();
+    bp = mm_malloc(size + MT_HDR);
+    pthread_mutex_unlock(&heap_lock);
+
+    if (bp == NULL)
+        return NULL;
+
+    bp += MT_HDR;
+    OWNER(bp) = self;
+    return bp;
+}
+
+/*
+ * mm_mt_free - free our own blocks under the heap lock, and queue other
+ *      threads' blocks for their owner without taking it
+ */
+void mm_mt_free(void *ptr) {
+    mt_cache_t *owner;
+    char *head;
+
+    if (ptr == NULL)
+        return;
+
+    if (self == NULL && mm_mt_attach() < 0)
+        return;
+
+    owner = OWNER(ptr);
+
+    if (remote_queues && owner != self) {
+        head = __atomic_load_n(&owner->remote, __ATOMIC_RELAXED);
+        do {
+            NEXT_REMOTE(ptr) = head;
+        } while (!__atomic_compare_exchange_n(&owner->remote, &head, (char *)ptr,
+                    1, __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+
+        self->queued++;
+        return;
+    }
+
+    lock_heap();
+    mm_free((char *)ptr - MT_HDR);
+    pthread_mutex_unlock(&heap_lock);
+}
+
+/*
+ * mm_mt_realloc - resize under the heap lock. the block then belongs to the
+ *      calling thread, whoever allocated it
+ */
+void *mm_mt_realloc(void *ptr, size_t size) {
+    char *bp;
+
+    if (ptr == NULL)
+        return mm_mt_malloc(size);
+
+    if (size == 0) {
+        mm_mt_free(ptr);
+        return NULL;
+    }
+
+    if (self == NULL && mm_mt_attach() < 0)
+        return NULL;
+
+    lock_heap();
+    drain_remote();
+    bp = mm_realloc((char *)ptr - MT_HDR, size + MT_HDR);
+    pthread_mutex_unlock(&heap_lock);
+
+    if (bp == NULL)
+        return NULL;
+
+    bp += MT_HDR;
+    OWNER(bp) = self;
+    return bp;
+}
+
+/*
+ * mm_mt_stats - add up the statistics of every cache since mm_mt_init.
+ *      only exact while no thread is allocating or freeing
+ */
+void mm_mt_stats(mm_mt_stats_t *stats) {
+    int i;
+
+    memset(stats, 0, sizeof(*stats));
+    for (i = 0; i < MM_MT_MAX_CACHES; i++) {
+        stats->locks += caches[i].locks;
+        stats->contended += caches[i].contended;
+        stats->queued += caches[i].queued;
+        stats->drained += caches[i].drained;
+    }
+}
+
+/*
+ * lock_heap - take the heap lock, counting whether we had to wait for it
+ */
+static void lock_heap(void) {
+    if (pthread_mutex_trylock(&heap_lock) != 0) {
+        self->contended++;
+        pthread_mutex_lock(&heap_lock);
+    }
+    self->locks++;
+}
+
+/*
+ * drain_remote - free every block on our remote-free queue.
+ *      the heap lock must be held
+ */
+static void drain_remote(void) {
+    char *bp, *next;
+
+    if (__atomic_load_n(&self->remote, __ATOMIC_RELAXED) == NULL)
+        return;
+
+    bp = __atomic_exchange_n(&self->remote, NULL, __ATOMIC_ACQUIRE);
+    while (bp != NULL) {
+        next = NEXT_REMOTE(bp);
+        mm_free(bp - MT_HDR);
+        self->drained++;
+        bp = next;
+    }
+}
@@ -0,0 +1,26 @@
+#include <stdio.h>
+
+/*
+ * Thread-aware front end to mm.c. The mm package itself runs under one
+ * lock. Each thread attaches a cache, and every block remembers the cache
+ * of the thread that allocated it. A thread that frees another thread's
+ * block does not take the lock: it pushes the block onto the owner's
+ * lock-free remote-free queue, and the owner frees the whole queue the
+ * next time it holds the lock to allocate.
+ */
+#define MM_MT_MAX_CACHES    256     // threads attached at the same time
+
+typedef struct {
+    unsigned long locks;        // heap lock acquisitions
+    unsigned long contended;    // acquisitions that had to wait
+    unsigned long queued;       // frees pushed onto another thread's queue
+    unsigned long drained;      // queued frees carried out by the owner
+} mm_mt_stats_t;
+
+extern int mm_mt_init(int remote_queues);
+extern int mm_mt_attach(void);
+extern void mm_mt_detach(void);
+extern void *mm_mt_malloc(size_t size);
+extern void mm_mt_free(void *ptr);
+extern void *mm_mt_realloc(void *ptr, size_t size);
+extern void mm_mt_stats(mm_mt_stats_t *stats);
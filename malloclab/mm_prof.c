@@ -0,0 +1,386 @@
+/*
+ * mm_prof.c - sampling heap profiler for mm.c
+ *
+ * Sampling points are a Poisson process over allocated bytes with a mean
+ * spacing of `rate` bytes: mm_prof_countdown holds the bytes left until the
+ * next point, and a block that crosses it is sampled. A block of `size`
+ * bytes is then sampled with probability 1 - exp(-size / rate), so each
+ * sample stands for 1 / (1 - exp(-size / rate)) blocks of its size.
+ *
+ * A sample records the call stack of the allocation. Identical stacks share
+ * one entry of `stacks`, which accumulates sampled and estimated totals.
+ * Sampled blocks that are still allocated live in `live`, keyed by address,
+ * so mm_free can take them off their stack's in-use totals.
+ *
+ * Both tables are fixed arrays outside the heap, so profiling never changes
+ * the heap it measures. Samples that find a table full are counted and
+ * dropped. The profiler is not thread-safe; it relies on mm.c callers
+ * serializing mm_malloc and mm_free.
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <math.h>
+#include <execinfo.h>
+#include <dlfcn.h>
+#include <link.h>
+
+#include "mm_prof.h"
+
+#define PROF_MAX_DEPTH  32      // frames kept per stack
+#define PROF_SKIP       2       // mm_prof_sample and mm_malloc frames
+#define PROF_STACKS     1024    // distinct stacks, power of two
+#define PROF_LIVE       8192    // live sampled blocks, power of two
+#define PROF_OFF        LLONG_MAX   // countdown while not sampling
+
+typedef struct {
+    void *pcs[PROF_MAX_DEPTH];
+    int depth;                  // 0 if the entry is unused
+    unsigned long long hash;
+    size_t live_count;          // sampled blocks still allocated
+    size_t live_bytes;
+    size_t alloc_count;         // every sampled block
+    size_t alloc_bytes;
+    double live_estimate;       // estimated bytes still allocated
+    double alloc_estimate;      // estimated bytes allocated
+} prof_stack_t;
+
+typedef struct {
+    void *bp;                   // NULL if the entry is unused
+    prof_stack_t *stack;
+    size_t size;
+    double estimate;            // estimated bytes this sample stands for
+} prof_live_t;
+
+long long mm_prof_countdown = PROF_OFF;
+size_t mm_prof_live;
+size_t mm_prof_dropped;
+
+static prof_stack_t stacks[PROF_STACKS];
+static prof_live_t live[PROF_LIVE];
+
+static size_t prof_rate;
+static int prof_on;             // between mm_prof_start and mm_prof_stop
+static unsigned long long prof_seed = 88172645463325252ULL;
+
+static long long next_interval(void);
+static prof_stack_t *find_stack(void **pcs, int depth);
+static prof_live_t *find_live(void *bp);
+static void remove_live(prof_live_t *entry);
+static void dump_folded(FILE *fp, int alloc);
+
+/*
+ * mm_prof_start - start sampling about one byte in every `rate`, or
+ *      MM_PROF_RATE if `rate` is 0. earlier samples are discarded
+ */
+void mm_prof_start(size_t rate) {
+    memset(stacks, 0, sizeof(stacks));
+    memset(live, 0, sizeof(live));
+    mm_prof_live = 0;
+    mm_prof_dropped = 0;
+
+    prof_rate = rate ? rate : MM_PROF_RATE;
+    prof_on = 1;
+    mm_prof_countdown = next_interval();
+}
+
+/*
+ * mm_prof_stop - stop taking samples. the samples taken so far can still be dumped
+ */
+void mm_prof_stop(void) {
+    prof_on = 0;
+    mm_prof_countdown = PROF_OFF;
+}
+
+/*
+ * mm_prof_sample - record the block `bp` of `size` bytes, which crossed
+ *      a sampling point, and pick the next point
+ */
+void mm_prof_sample(void *bp, size_t size) {
+    void *pcs[PROF_MAX_DEPTH + PROF_SKIP];
+    prof_stack_t *stack;
+    prof_live_t *entry;
+    double estimate;
+    int depth;
+
+    /* even PROF_OFF runs out eventually; that is no sampling point */
+    if (!prof_on) {
+        mm_prof_countdown = PROF_OFF;
+        return;
+    }
+
+    mm_prof_countdown = next_interval();
+
+    if (bp == NULL)
+        return;
+
+    depth = backtrace(pcs, PROF_MAX_DEPTH + PROF_SKIP) - PROF_SKIP;
+    if (depth <= 0 || (stack = find_stack(pcs + PROF_SKIP, depth)) == NULL ||
+            (entry = find_live(bp)) == NULL) {
+        mm_prof_dropped++;
+        return;
+    }
+
+    estimate = size / (1 - exp(-(double)size / prof_rate));
+
+    stack->live_count++;
+    stack->live_bytes += size;
+    stack->alloc_count++;
+    stack->alloc_bytes += size;
+    stack->live_estimate += estimate;
+    stack->alloc_estimate += estimate;
+
+    /* a stale sample of an earlier block at bp cannot be left behind */
+    if (entry->bp == NULL)
+        mm_prof_live++;
+    else {
+        entry->stack->live_count--;
+        entry->stack->live_bytes -= entry->size;
+        entry->stack->live_estimate -= entry->estimate;
+    }
+
+    entry->bp = bp;
+    entry->stack = stack;
+    entry->size = size;
+    entry->estimate = estimate;
+}
+
+/*
+ * mm_prof_free - forget `bp` if it was sampled
+ */
+void mm_prof_free(void *bp) {
+    prof_live_t *entry = find_live(bp);
+
+    if (entry == NULL || entry->bp == NULL)
+        return;
+
+    entry->stack->live_count--;
+    entry->stack->live_bytes -= entry->size;
+    entry->stack->live_estimate -= entry->estimate;
+    remove_live(entry);
+}
+
+/*
+ * mm_prof_move - a sampled block moved from `oldbp` to `newbp` without
+ *      going through mm_malloc and mm_free
+ */
+void mm_prof_move(void *oldbp, void *newbp) {
+    prof_live_t *entry = find_live(oldbp);
+    prof_live_t saved;
+
+    if (entry == NULL || entry->bp == NULL)
+        return;
+
+    saved = *entry;
+    remove_live(entry);
+
+    if ((entry = find_live(newbp)) == NULL || entry->bp != NULL) {
+        saved.stack->live_count--;
+        saved.stack->live_bytes -= saved.size;
+        saved.stack->live_estimate -= saved.estimate;
+        mm_prof_dropped++;
+        return;
+    }
+
+    *entry = saved;
+    entry->bp = newbp;
+    mm_prof_live++;
+}
+
+/*
+ * mm_prof_drop_live - forget every live sample. called when the heap is
+ *      reinitialized and the sampled blocks no longer exist
+ */
+void mm_prof_drop_live(void) {
+    int i;
+
+    for (i = 0; i < PROF_STACKS; i++) {
+        stacks[i].live_count = 0;
+        stacks[i].live_bytes = 0;
+        stacks[i].live_estimate = 0;
+    }
+
+    memset(live, 0, sizeof(live));
+    mm_prof_live = 0;
+}
+
+/*
+ * mm_prof_dump - write the samples to `fp` in `format`, one of MM_PROF_*
+ *      returns -1 if writing fails
+ */
+int mm_prof_dump(FILE *fp, int format) {
+    size_t live_count = 0, live_bytes = 0, alloc_count = 0, alloc_bytes = 0;
+    prof_stack_t *stack;
+    FILE *maps;
+    char line[512];
+    int i, j;
+
+    if (format != MM_PROF_PPROF) {
+        dump_folded(fp, format == MM_PROF_FOLDED_ALLOC);
+        return ferror(fp) ? -1 : 0;
+    }
+
+    for (i = 0; i < PROF_STACKS; i++) {
+        live_count += stacks[i].live_count;
+        live_bytes += stacks[i].live_bytes;
+        alloc_count += stacks[i].alloc_count;
+        alloc_bytes += stacks[i].alloc_bytes;
+    }
+
+    /* pprof unsamples the raw counts itself, given the rate */
+    fprintf(fp, "heap profile: %6lu: %8lu [%6lu: %8lu] @ heap_v2/%lu\n",
+            live_count, live_bytes, alloc_count, alloc_bytes, prof_rate);
+
+    for (i = 0; i < PROF_STACKS; i++) {
+        stack = &stacks[i];
+        if (stack->depth == 0)
+            continue;
+
+        fprintf(fp, "%6lu: %8lu [%6lu: %8lu] @",
+                stack->live_count, stack->live_bytes,
+                stack->alloc_count, stack->alloc_bytes);
+        for (j = 0; j < stack->depth; j++)
+            fprintf(fp, " %p", stack->pcs[j]);
+        fprintf(fp, "\n");
+    }
+
+    /* lets pprof map the addresses back to the binary and its libraries */
+    fprintf(fp, "\nMAPPED_LIBRARIES:\n");
+    if ((maps = fopen("/proc/self/maps", "r")) != NULL) {
+        while (fgets(line, sizeof(line), maps) != NULL)
+            fputs(line, fp);
+        fclose(maps);
+    }
+
+    return ferror(fp) ? -1 : 0;
+}
+
+/*
+ * dump_folded - write one "outermost;...;innermost bytes" line per stack,
+ *      with the estimated live bytes, or allocated bytes if `alloc` is set
+ */
+static void dump_folded(FILE *fp, int alloc) {
+    prof_stack_t *stack;
+    ElfW(Sym) *sym;
+    Dl_info info;
+    char *pc;
+    double bytes;
+    int i, j;
+
+    for (i = 0; i < PROF_STACKS; i++) {
+        stack = &stacks[i];
+        bytes = alloc ? stack->alloc_estimate : stack->live_estimate;
+        if (stack->depth == 0 || bytes < 0.5)
+            continue;
+
+        for (j = stack->depth - 1; j >= 0; j--) {
+            /* look up the call, not the return address, which may lie past the function */
+            pc = (char *)stack->pcs[j] - 1;
+
+            /* only exported symbols are known. anything else would get the */
+            /* name of the closest symbol before it, so print the address   */
+            if (dladdr1(pc, &info, (void **)&sym, RTLD_DL_SYMENT) && sym != NULL &&
+                    info.dli_sname != NULL && pc < (char *)info.dli_saddr + sym->st_size)
+                fprintf(fp, "%s", info.dli_sname);
+            else
+                fprintf(fp, "%p", stack->pcs[j]);
+            fprintf(fp, j ? ";" : " ");
+        }
+        fprintf(fp, "%.0f\n", bytes);
+    }
+}
+
+/*
+ * next_interval - draw the bytes until the next sampling point from an
+ *      exponential distribution with mean `prof_rate`
+ */
+static long long next_interval(void) {
+    double u;
+
+    /* xorshift64, uniform in (0, 1] */
+    prof_seed ^= prof_seed << 13;
+    prof_seed ^= prof_seed >> 7;
+    prof_seed ^= prof_seed << 17;
+    u = ((prof_seed >> 11) + 1) * (1.0 / 9007199254740992.0);
+
+    return (long long)(-log(u) * prof_rate);
+}
+
+/*
+ * find_stack - find or add the entry for a call stack.
+ *      returns NULL if the stack is new and the table is full
+ */
+static prof_stack_t *find_stack(void **pcs, int depth) {
+    unsigned long long hash = 14695981039346656037ULL;
+    prof_stack_t *stack;
+    int i;
+
+    /* FNV-1a over the return addresses */
+    for (i = 0; i < depth; i++) {
+        hash ^= (unsigned long)pcs[i];
+        hash *= 1099511628211ULL;
+    }
+
+    for (i = 0; i < PROF_STACKS; i++) {
+        stack = &stacks[(hash + i) & (PROF_STACKS - 1)];
+
+        if (stack->depth == 0) {
+            memcpy(stack->pcs, pcs, depth * sizeof(void *));
+            stack->depth = depth;
+            stack->hash = hash;
+            return stack;
+        }
+
+        if (stack->hash == hash && stack->depth == depth &&
+                memcmp(stack->pcs, pcs, depth * sizeof(void *)) == 0)
+            return stack;
+    }
+
+    return NULL;
+}
+
+/*
+ * find_live - find the entry of `bp`, or the unused entry it would go in.
+ *      returns NULL if `bp` is not there and the table is full
+ */
+static prof_live_t *find_live(void *bp) {
+    unsigned long slot = ((unsigned long)bp >> 3) * 2654435761UL;
+    prof_live_t *entry;
+    int i;
+
+    for (i = 0; i < PROF_LIVE; i++) {
+        entry = &live[(slot + i) & (PROF_LIVE - 1)];
+        if (entry->bp == bp || entry->bp == NULL)
+            return entry;
+    }
+
+    return NULL;
+}
+
+/*
+ * remove_live - empty an entry of `live`, shifting later entries of its
+ *      probe sequence back so that lookups never stop at a hole
+ */
+static void remove_live(prof_live_t *entry) {
+    size_t hole = entry - live;
+    size_t i = hole, home;
+
+    for (;;) {
+        i = (i + 1) & (PROF_LIVE - 1);
+        if (live[i].bp == NULL)
+            break;
+
+        /* entries whose home slot lies cyclically in (hole, i] stay put */
+        home = (((unsigned long)live[i].bp >> 3) * 2654435761UL) & (PROF_LIVE - 1);
+        if (((i - home) & (PROF_LIVE - 1)) < ((i - hole) & (PROF_LIVE - 1)))
+            continue;
+
+        live[hole] = live[i];
+        hole = i;
+    }
+
+    live[hole].bp = NULL;
+    mm_prof_live--;
+}
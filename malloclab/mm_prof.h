@@ -0,0 +1,36 @@
+#include <stdio.h>
+
+/*
+ * Sampling heap profiler for mm.c. Once started, a stack trace is taken for
+ * roughly one allocated byte in every `rate`; the sampled blocks are tracked
+ * until they are freed, and the call stacks that allocated them can be
+ * dumped at any time. The hooks below cost one subtraction per malloc and
+ * one load per free while nothing is being sampled.
+ */
+#define MM_PROF_RATE        (512 * 1024)    // default mean bytes between samples
+
+/* output formats of mm_prof_dump */
+#define MM_PROF_PPROF       0   // gperftools heap profile, read by pprof
+#define MM_PROF_FOLDED      1   // "f1;f2;f3 bytes" lines of estimated live bytes
+#define MM_PROF_FOLDED_ALLOC 2  // same, with every byte allocated since start
+
+extern long long mm_prof_countdown; // bytes left until the next sample
+extern size_t mm_prof_live;     // sampled blocks not yet freed
+extern size_t mm_prof_dropped;  // samples lost to full tables
+
+extern void mm_prof_start(size_t rate);
+extern void mm_prof_stop(void);
+extern int mm_prof_dump(FILE *fp, int format);
+
+extern void mm_prof_sample(void *bp, size_t size);
+extern void mm_prof_free(void *bp);
+extern void mm_prof_move(void *oldbp, void *newbp);
+extern void mm_prof_drop_live(void);
+
+/* hooks called by mm.c */
+#define MM_PROF_MALLOC(bp, size) \
+    do { if ((mm_prof_countdown -= (long long)(size)) < 0) mm_prof_sample(bp, size); } while (0)
+#define MM_PROF_FREE(bp) \
+    do { if (mm_prof_live) mm_prof_free(bp); } while (0)
+#define MM_PROF_MOVE(oldbp, newbp) \
+    do { if (mm_prof_live) mm_prof_move(oldbp, newbp); } while (0)
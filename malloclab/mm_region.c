@@ -0,0 +1,153 @@
+/*
+ * mm_region.c - region (arena) allocator layered on top of mm.c
+ *
+ * A region hands out memory by bumping a pointer through a chunk it got
+ * from mm_malloc. Objects have no header and cannot be freed one by one;
+ * resetting or destroying the region frees every chunk, so the cost of
+ * releasing a whole request's worth of objects is O(chunks).
+ *
+ * Chunks are kept in a singly linked list, newest first. Requests larger
+ * than a quarter of a chunk get a chunk of their own, linked behind the
+ * current one so the current chunk keeps being used.
+ */
+#include <stdio.h>
+
+#include "mm.h"
+#include "mm_region.h"
+
+#define ALIGNMENT           8
+#define ALIGN(size)         (((size) + (ALIGNMENT - 1)) & ~0x7)
+
+#define REGION_CHUNK_SIZE   4096    // default payload bytes of a chunk
+
+/* header at the start of every chunk */
+typedef struct region_chunk {
+    struct region_chunk *prev;      // next older chunk
+    size_t size;                    // payload bytes following the header
+} region_chunk_t;
+
+#define CHUNK_HDR           ALIGN(sizeof(region_chunk_t))
+#define CHUNK_START(c)      ((char *)(c) + CHUNK_HDR)
+#define CHUNK_END(c)        (CHUNK_START(c) + (c)->size)
+
+struct mm_region {
+    region_chunk_t *chunks;         // current chunk, head of the chunk list
+    char *cur;                      // next free byte in the current chunk
+    char *end;                      // end of the current chunk
+    size_t chunk_size;              // payload bytes of a regular chunk
+};
+
+static region_chunk_t *new_chunk(size_t size);
+
+/*
+ * mm_region_create - create an empty region whose chunks hold `chunk_size`
+ *      bytes, or REGION_CHUNK_SIZE bytes if `chunk_size` is 0
+ */
+mm_region_t *mm_region_create(size_t chunk_size) {
+    mm_region_t *region;
+
+    if ((region = mm_malloc(sizeof(mm_region_t))) == NULL)
+        return NULL;
+
+    region->chunks = NULL;
+    region->cur = NULL;
+    region->end = NULL;
+    region->chunk_size = chunk_size ? ALIGN(chunk_size) : REGION_CHUNK_SIZE;
+
+    return region;
+}
+
+/*
+ * mm_region_alloc - bump-allocate `size` bytes, aligned to ALIGNMENT
+ */
+void *mm_region_alloc(mm_region_t *region, size_t size) {
+    region_chunk_t *chunk;
+    char *bp;
+
+    size = size ? ALIGN(size) : ALIGNMENT;
+
+    /* fast path: the current chunk has room */
+    if (size <= (size_t)(region->end - region->cur)) {
+        bp = region->cur;
+        region->cur += size;
+        return bp;
+    }
+
+    /* large requests get their own chunk, behind the current one */
+    if (size > region->chunk_size / 4) {
+        if ((chunk = new_chunk(size)) == NULL)
+            return NULL;
+
+        if (region->chunks == NULL) {
+            region->chunks = chunk;
+            region->cur = region->end = CHUNK_END(chunk);
+        } else {
+            chunk->prev = region->chunks->prev;
+            region->chunks->prev = chunk;
+        }
+
+        return CHUNK_START(chunk);
+    }
+
+    /* start a new regular chunk. the rest of the old one is abandoned */
+    if ((chunk = new_chunk(region->chunk_size)) == NULL)
+        return NULL;
+
+    chunk->prev = region->chunks;
+    region->chunks = chunk;
+    region->cur = CHUNK_START(chunk) + size;
+    region->end = CHUNK_END(chunk);
+
+    return CHUNK_START(chunk);
+}
+
+/*
+ * mm_region_reset - free every object in the region at once.
+ *      the current chunk is kept for reuse, all older chunks are freed
+ */
+void mm_region_reset(mm_region_t *region) {
+    region_chunk_t *chunk = region->chunks;
+    region_chunk_t *prev;
+
+    if (chunk == NULL)
+        return;
+
+    for (prev = chunk->prev; prev != NULL; prev = chunk->prev) {
+        chunk->prev = prev->prev;
+        mm_free(prev);
+    }
+
+    region->cur = CHUNK_START(chunk);
+    region->end = CHUNK_END(chunk);
+}
+
+/*
+ * mm_region_destroy - free every chunk and the region itself
+ */
+void mm_region_destroy(mm_region_t *region) {
+    region_chunk_t *chunk = region->chunks;
+    region_chunk_t *prev;
+
+    while (chunk != NULL) {
+        prev = chunk->prev;
+        mm_free(chunk);
+        chunk = prev;
+    }
+
+    mm_free(region);
+}
+
+/*
+ * new_chunk - get a chunk with `size` payload bytes from mm_malloc
+ */
+static region_chunk_t *new_chunk(size_t size) {
+    region_chunk_t *chunk;
+
+    if ((chunk = mm_malloc(CHUNK_HDR + size)) == NULL)
+        return NULL;
+
+    chunk->prev = NULL;
+    chunk->size = size;
+
+    return chunk;
+}
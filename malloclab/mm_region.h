@@ -0,0 +1,13 @@
+#include <stdio.h>
+
+/*
+ * Regions: bump-pointer allocation for objects that share one lifetime.
+ * Chunks come from mm_malloc, objects carry no header, and everything in
+ * a region is released at once by mm_region_reset or mm_region_destroy.
+ */
+typedef struct mm_region mm_region_t;
+
+extern mm_region_t *mm_region_create(size_t chunk_size);
+extern void *mm_region_alloc(mm_region_t *region, size_t size);
+extern void mm_region_reset(mm_region_t *region);
+extern void mm_region_destroy(mm_region_t *region);
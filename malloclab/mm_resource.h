@@ -0,0 +1,125 @@
+#ifndef MM_RESOURCE_H
+#define MM_RESOURCE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <new>
+#include <memory_resource>
+
+extern "C" {
+#include "mm.h"
+}
+
+/*
+ * C++ adapters over mm.c, for containers that should allocate from the
+ * mm heap without replacing the global operator new:
+ *
+ *   mm_resource        a std::pmr::memory_resource, for pmr containers
+ *   mm_allocator<T>    an STL allocator, for containers with an allocator
+ *                      template argument
+ *
+ * Neither owns the heap: mem_init and mm_init must have been called, and
+ * everything allocated must be freed before the next mm_init. Like mm.c
+ * itself, they are not thread-safe. Failures throw std::bad_alloc.
+ */
+
+namespace mm_detail {
+
+/* mm_malloc aligns every block to this */
+constexpr std::size_t mm_alignment = 8;
+
+/*
+ * allocate - mm_malloc `bytes` bytes aligned to `alignment`. a stronger
+ *      alignment than mm_malloc's is met by allocating `alignment` more
+ *      bytes and keeping the block pointer in the word before the result
+ */
+inline void *allocate(std::size_t bytes, std::size_t alignment) {
+    if (alignment <= mm_alignment) {
+        void *p = mm_malloc(bytes ? bytes : 1);
+        if (p == nullptr)
+            throw std::bad_alloc();
+        return p;
+    }
+
+    if (bytes > std::numeric_limits<std::size_t>::max() - alignment)
+        throw std::bad_alloc();
+    char *block = static_cast<char *>(mm_malloc(bytes + alignment));
+    if (block == nullptr)
+        throw std::bad_alloc();
+
+    std::uintptr_t addr = reinterpret_cast<std::uintptr_t>(block) + alignment;
+    char *p = reinterpret_cast<char *>(addr & ~(std::uintptr_t)(alignment - 1));
+    reinterpret_cast<void **>(p)[-1] = block;
+    return p;
+}
+
+/*
+ * deallocate - free what allocate returned for the same `alignment`.
+ *      mm_free finds the size of a block in its header, so the size
+ *      callers pass for sized deallocation is not needed
+ */
+inline void deallocate(void *p, std::size_t alignment) {
+    if (p == nullptr)
+        return;
+    if (alignment > mm_alignment)
+        p = static_cast<void **>(p)[-1];
+    mm_free(p);
+}
+
+}
+
+/*
+ * mm_resource - memory resource on the mm heap. every mm_resource
+ *      allocates from the same heap, so any two of them compare equal
+ */
+class mm_resource : public std::pmr::memory_resource {
+protected:
+    void *do_allocate(std::size_t bytes, std::size_t alignment) override {
+        return mm_detail::allocate(bytes, alignment);
+    }
+
+    void do_deallocate(void *p, std::size_t, std::size_t alignment) override {
+        mm_detail::deallocate(p, alignment);
+    }
+
+    bool do_is_equal(const std::pmr::memory_resource &other) const noexcept override {
+        return dynamic_cast<const mm_resource *>(&other) != nullptr;
+    }
+};
+
+/*
+ * mm_allocator - stateless STL allocator on the mm heap
+ */
+template <class T>
+class mm_allocator {
+public:
+    using value_type = T;
+
+    mm_allocator() noexcept = default;
+
+    template <class U>
+    mm_allocator(const mm_allocator<U> &) noexcept {}
+
+    T *allocate(std::size_t n) {
+        if (n > std::numeric_limits<std::size_t>::max() / sizeof(T))
+            throw std::bad_array_new_length();
+        return static_cast<T *>(mm_detail::allocate(n * sizeof(T), alignof(T)));
+    }
+
+    void deallocate(T *p, std::size_t) noexcept {
+        mm_detail::deallocate(p, alignof(T));
+    }
+};
+
+template <class T, class U>
+bool operator==(const mm_allocator<T> &, const mm_allocator<U> &) noexcept {
+    return true;
+}
+
+template <class T, class U>
+bool operator!=(const mm_allocator<T> &, const mm_allocator<U> &) noexcept {
+    return false;
+}
+
+#endif
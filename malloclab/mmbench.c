@@ -0,0 +1,454 @@
+/*
+ * mmbench.c - microbenchmarks of the internal primitives of mm.c
+ *
+ * mdriver only times whole traces. mmbench times get_size_class,
+ * find_fit, place and coalesce one at a time, on a synthetic heap whose
+ * shape is set on the command line: the number of blocks, the share of
+ * them that is free, and the range of block sizes, which decides the size
+ * classes the free lists are spread over.
+ *
+ * The primitives are static, so mm.c is compiled into this file.
+ *
+ * fcyc's K-best scheme runs the test function again on whatever state the
+ * last run left behind, and place and coalesce change the heap. So every
+ * sample rebuilds the heap and then times one batch of operations with
+ * the cycle counter in clock.c. The best of all samples is reported, in
+ * cycles and ns per operation. Where the kernel allows it, the L1 data
+ * cache and last level cache misses of that batch are counted as well.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <math.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+
+#include "mm.c"
+#include "clock.h"
+
+/**********************
+ * Constants and macros
+ **********************/
+#define DEFAULT_BLOCKS   100000  /* blocks in the synthetic heap */
+#define DEFAULT_FREE     25      /* percent of them that is free, at most 50 */
+#define DEFAULT_MINSIZE  16      /* smallest request, in bytes */
+#define DEFAULT_MAXSIZE  4096    /* largest request, in bytes */
+#define DEFAULT_OPS      10000   /* operations per sample */
+#define DEFAULT_SAMPLES  10      /* samples per primitive */
+
+/* Hardware counters, see open_counters */
+#define NCOUNTERS        2
+
+/* Operands of one batch, prepared while the heap is built */
+typedef struct {
+    size_t *sizes;               /* block sizes, as mm_malloc computes them */
+    char **blocks;               /* blocks to place or coalesce */
+    int n;                       /* operations in the batch */
+} batch_t;
+
+/* A primitive under test */
+typedef struct {
+    char *name;
+    void (*prepare)(batch_t *b); /* pick the operands on a fresh heap */
+    void (*run)(batch_t *b);     /* the timed batch */
+} prim_t;
+
+/* mm.c prints debug output when this is set */
+int verbose = 0;
+
+/* heap shape */
+static int nblocks = DEFAULT_BLOCKS;
+static int free_percent = DEFAULT_FREE;
+static size_t minsize = DEFAULT_MINSIZE;
+static size_t maxsize = DEFAULT_MAXSIZE;
+static int ops = DEFAULT_OPS;
+
+static unsigned int seed;
+static char **blocks;            /* the blocks build_heap allocated, in address order */
+static volatile size_t sink;     /* keeps the pure primitives from being optimized out */
+static int counter_fds[NCOUNTERS] = {-1, -1};
+
+/*********************
+ * Function prototypes
+ *********************/
+static void build_heap(void);
+static size_t request_size(void);
+static int cmp_addr(const void *a, const void *b);
+static void prepare_sizes(batch_t *b);
+static void prepare_place(batch_t *b);
+static void prepare_coalesce(batch_t *b);
+static void run_get_size_class(batch_t *b);
+static void run_find_fit(batch_t *b);
+static void run_place(batch_t *b);
+static void run_coalesce(batch_t *b);
+static void print_lists(void);
+static void open_counters(void);
+static void usage(void);
+static void app_error(char *msg);
+
+static prim_t prims[] = {
+    {"get_size_class", prepare_sizes, run_get_size_class},
+    {"find_fit", prepare_sizes, run_find_fit},
+    {"place", prepare_place, run_place},
+    {"coalesce", prepare_coalesce, run_coalesce},
+};
+
+#define NPRIMS ((int)(sizeof(prims) / sizeof(prims[0])))
+
+/**************
+ * Main routine
+ **************/
+int main(int argc, char **argv)
+{
+    int samples = DEFAULT_SAMPLES;
+    char *fit = NULL;
+    char *order = NULL;
+    batch_t b;
+    double cycles, best, ns_per_cycle;
+    long long counts[NCOUNTERS], best_counts[NCOUNTERS];
+    int c, i, j, s;
+
+    while ((c = getopt(argc, argv, "n:f:r:o:s:p:O:h")) != EOF) {
+        switch (c) {
+            case 'n': /* Blocks in the heap */
+                nblocks = atoi(optarg);
+                break;
+            case 'f': /* Percent of the blocks that is free */
+                free_percent = atoi(optarg);
+                break;
+            case 'r': /* Range of request sizes */
+                if (sscanf(optarg, "%zu:%zu", &minsize, &maxsize) != 2) {
+                    usage();
+                    exit(1);
+                }
+                break;
+            case 'o': /* Operations per sample */
+                ops = atoi(optarg);
+                break;
+            case 's': /* Samples per primitive */
+                samples = atoi(optarg);
+                break;
+            case 'p': /* Fit policy */
+                fit = optarg;
+                break;
+            case 'O': /* Free list order */
+                order = optarg;
+                break;
+            case 'h': /* Print this message */
+                usage();
+                exit(0);
+            default:
+                usage();
+                exit(1);
+        }
+    }
+    if (nblocks <= 0 || free_percent < 0 || free_percent > 50 || minsize == 0 ||
+            minsize > maxsize || ops <= 0 || samples <= 0) {
+        usage();
+        exit(1);
+    }
+    if (fit != NULL && mm_set_fit_policy(fit) < 0)
+        app_error("invalid fit policy");
+    if (order != NULL && mm_set_order_policy(order) < 0)
+        app_error("invalid free list order");
+
+    if ((b.sizes = calloc(ops, sizeof(size_t))) == NULL ||
+            (b.blocks = calloc(ops, sizeof(char *))) == NULL)
+        app_error("calloc failed in main");
+
+    mem_init();
+    open_counters();
+    ns_per_cycle = 1e3 / mhz(0);
+    pin_counter();
+
+    seed = 1;
+    build_heap();
+    printf("%d blocks, %d%% free, requests of %zu..%zu bytes, %s fit, %s order\n",
+            nblocks, free_percent, minsize, maxsize, fit ? fit : "default",
+            order ? order : "default");
+    print_lists();
+    printf("%-16s%8s%10s%10s%14s%14s\n", "primitive", "ops", "cyc/op",
+            "ns/op", "L1D miss/op", "LLC miss/op");
+
+    for (i = 0; i < NPRIMS; i++) {
+        best = -1;
+        for (s = 0; s < samples; s++) {
+            /* every sample sees the same heap */
+            seed = 1;
+            build_heap();
+            prims[i].prepare(&b);
+            if (b.n == 0)
+                break;
+
+            for (j = 0; j < NCOUNTERS; j++)
+                if (counter_fds[j] >= 0) {
+                    ioctl(counter_fds[j], PERF_EVENT_IOC_RESET, 0);
+                    ioctl(counter_fds[j], PERF_EVENT_IOC_ENABLE, 0);
+                }
+            start_counter();
+            prims[i].run(&b);
+            cycles = get_counter();
+            for (j = 0; j < NCOUNTERS; j++) {
+                counts[j] = -1;
+                if (counter_fds[j] >= 0) {
+                    ioctl(counter_fds[j], PERF_EVENT_IOC_DISABLE, 0);
+                    if (read(counter_fds[j], &counts[j], sizeof(counts[j])) != sizeof(counts[j]))
+                        counts[j] = -1;
+                }
+            }
+
+            if (best < 0 || cycles < best) {
+                best = cycles;
+                memcpy(best_counts, counts, sizeof(counts));
+            }
+        }
+
+        if (best < 0) {
+            printf("%-16s%8d%10s%10s%14s%14s\n", prims[i].name, 0, "-", "-", "-", "-");
+            continue;
+        }
+        printf("%-16s%8d%10.1f%10.1f", prims[i].name, b.n, best / b.n,
+                best * ns_per_cycle / b.n);
+        for (j = 0; j < NCOUNTERS; j++) {
+            if (best_counts[j] < 0)
+                printf("%14s", "-");
+            else
+                printf("%14.2f", (double)best_counts[j] / b.n);
+        }
+        printf("\n");
+    }
+
+    mem_deinit();
+    exit(0);
+}
+
+/*
+ * build_heap - Build the synthetic heap from scratch: allocate nblocks
+ *     blocks, then free free_percent of them. Only blocks between two
+ *     allocated blocks are freed, so no free blocks are coalesced and the
+ *     sizes of the free blocks follow the request sizes. Blocks mm_init
+ *     allocated for itself, like the skip list heads, are never freed.
+ */
+static void build_heap(void)
+{
+    static char **victims;
+    char *bp;
+    int i, n = 0;
+
+    if (blocks == NULL) {
+        if ((blocks = malloc(nblocks * sizeof(char *))) == NULL ||
+                (victims = malloc(nblocks * sizeof(char *))) == NULL)
+            app_error("malloc failed in build_heap");
+    }
+
+    mem_reset_brk();
+    if (mm_init() < 0)
+        app_error("mm_init failed");
+    for (i = 0; i < nblocks; i++)
+        if ((blocks[i] = mm_malloc(request_size())) == NULL)
+            app_error("mm_malloc failed");
+    qsort(blocks, nblocks, sizeof(char *), cmp_addr);
+
+    /* pick the blocks in address order, no two next to each other, then free them */
+    for (i = 0; i < nblocks; i++) {
+        bp = blocks[i];
+        if (GET_ALLOC(HDRP(NEXT_BLKP(bp))) && GET_ALLOC(FTRP(PREV_BLKP(bp))) &&
+                (n == 0 || NEXT_BLKP(victims[n - 1]) != bp) &&
+                rand_r(&seed) % 100 < 2 * free_percent)
+            victims[n++] = bp;
+    }
+    for (i = 0; i < n; i++)
+        mm_free(victims[i]);
+}
+
+/*
+ * cmp_addr - qsort comparison of block pointers by address
+ */
+static int cmp_addr(const void *a, const void *b)
+{
+    char *x = *(char * const *)a, *y = *(char * const *)b;
+
+    return x < y ? -1 : x > y;
+}
+
+/*
+ * request_size - Draw a request size between minsize and maxsize, with
+ *     every power of two range equally likely, like the size classes
+ */
+static size_t request_size(void)
+{
+    double u = (double)rand_r(&seed) / RAND_MAX;
+
+    return (size_t)(minsize * pow((double)maxsize / minsize, u));
+}
+
+/*
+ * prepare_sizes - Draw block sizes for get_size_class and find_fit
+ */
+static void prepare_sizes(batch_t *b)
+{
+    size_t size;
+    int i;
+
+    for (i = 0; i < ops; i++) {
+        size = request_size();
+        b->sizes[i] = size <= DSIZE ? 2 * DSIZE : DSIZE + ALIGN(size);
+    }
+    b->n = ops;
+}
+
+/*
+ * prepare_place - Take blocks from the free lists, each with a block
+ *     size to place in it that the block can hold
+ */
+static void prepare_place(batch_t *b)
+{
+    size_t index, size;
+    char *bp;
+
+    prepare_sizes(b);
+    b->n = 0;
+    for (index = 0; index < SIZE_CLASS_SIZE; index++) {
+        for (bp = GETP(HEADP(index)); bp != NULL && b->n < ops; bp = GET_NEXTP(bp)) {
+            size = GET_SIZE(HDRP(bp));
+            if (b->sizes[b->n] > size)
+                b->sizes[b->n] = size;
+            b->blocks[b->n++] = bp;
+        }
+    }
+}
+
+/*
+ * prepare_coalesce - Take every third block build_heap left allocated,
+ *     in address order, so no two of them are next to each other
+ */
+static void prepare_coalesce(batch_t *b)
+{
+    int i, k = 0;
+
+    b->n = 0;
+    for (i = 0; i < nblocks && b->n < ops; i++)
+        if (GET_ALLOC(HDRP(blocks[i])) && k++ % 3 == 0)
+            b->blocks[b->n++] = blocks[i];
+}
+
+static void run_get_size_class(batch_t *b)
+{
+    size_t sum = 0;
+    int i;
+
+    for (i = 0; i < b->n; i++)
+        sum += get_size_class(b->sizes[i]);
+    sink = sum;
+}
+
+static void run_find_fit(batch_t *b)
+{
+    size_t found = 0;
+    int i;
+
+    for (i = 0; i < b->n; i++)
+        found += find_fit(b->sizes[i]) != NULL;
+    sink = found;
+}
+
+static void run_place(batch_t *b)
+{
+    int i;
+
+    for (i = 0; i < b->n; i++)
+        place(b->blocks[i], b->sizes[i]);
+}
+
+/* the part of mm_free that is not coalescing is marking the block free */
+static void run_coalesce(batch_t *b)
+{
+    size_t size;
+    int i;
+
+    for (i = 0; i < b->n; i++) {
+        size = GET_SIZE(HDRP(b->blocks[i]));
+        PUT(HDRP(b->blocks[i]), PACK(size, 0));
+        PUT(FTRP(b->blocks[i]), PACK(size, 0));
+        coalesce(b->blocks[i]);
+    }
+}
+
+/*
+ * print_lists - Print the length of every free list
+ */
+static void print_lists(void)
+{
+    size_t index, length;
+    char *bp;
+
+    printf("free list lengths:");
+    for (index = 0; index < SIZE_CLASS_SIZE; index++) {
+        length = 0;
+        for (bp = GETP(HEADP(index)); bp != NULL; bp = GET_NEXTP(bp))
+            length++;
+        printf(" %zu", length);
+    }
+    printf("\n");
+}
+
+/*
+ * open_counters - Open the L1 data cache read miss and last level cache
+ *     miss counters of this thread. A counter the kernel refuses stays
+ *     closed, and its column is printed as "-".
+ */
+static void open_counters(void)
+{
+    struct perf_event_attr attr;
+    int j;
+
+    for (j = 0; j < NCOUNTERS; j++) {
+        memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.disabled = 1;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        if (j == 0) {
+            attr.type = PERF_TYPE_HW_CACHE;
+            attr.config = PERF_COUNT_HW_CACHE_L1D |
+                (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+                (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+        } else {
+            attr.type = PERF_TYPE_HARDWARE;
+            attr.config = PERF_COUNT_HW_CACHE_MISSES;
+        }
+        counter_fds[j] = syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+    }
+}
+
+/*
+ * usage - Explain the command line arguments
+ */
+static void usage(void)
+{
+    fprintf(stderr, "Usage: mmbench [-h] [-n <blocks>] [-f <percent>] [-r <min>:<max>]\n");
+    fprintf(stderr, "               [-o <ops>] [-s <samples>] [-p <fit>] [-O <order>]\n");
+    fprintf(stderr, "Options\n");
+    fprintf(stderr, "\t-f <percent>    Percent of the blocks that is free, at most 50 (default %d).\n",
+            DEFAULT_FREE);
+    fprintf(stderr, "\t-h              Print this message.\n");
+    fprintf(stderr, "\t-n <blocks>     Blocks in the heap (default %d).\n", DEFAULT_BLOCKS);
+    fprintf(stderr, "\t-O <order>      Free list order, as for mdriver -O.\n");
+    fprintf(stderr, "\t-o <ops>        Operations per sample (default %d).\n", DEFAULT_OPS);
+    fprintf(stderr, "\t-p <fit>        Fit policy, as for mdriver -p.\n");
+    fprintf(stderr, "\t-r <min>:<max>  Range of request sizes in bytes (default %d:%d).\n",
+            DEFAULT_MINSIZE, DEFAULT_MAXSIZE);
+    fprintf(stderr, "\t-s <samples>    Samples per primitive, the best is reported (default %d).\n",
+            DEFAULT_SAMPLES);
+}
+
+/*
+ * app_error - Report an arbitrary application error and terminate
+ */
+static void app_error(char *msg)
+{
+    printf("%s\n", msg);
+    exit(1);
+}
@@ -0,0 +1,254 @@
+/*
+ * pcbench.c - producer/consumer benchmark for cross-thread frees
+ *
+ * Each producer thread allocates objects with mm_mt_malloc and hands them
+ * to its consumer thread through a single-producer, single-consumer ring.
+ * The consumer checks the contents and frees every object, so every free
+ * is a cross-thread free. The benchmark runs once with cross-thread frees
+ * taking the heap lock, and once with mm_mt's remote-free queues, and
+ * reports the heap lock traffic of both runs.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <sched.h>
+#include <pthread.h>
+
+#include "mm_mt.h"
+#include "memlib.h"
+
+/**********************
+ * Constants and macros
+ **********************/
+#define DEFAULT_PAIRS    2       /* producer/consumer pairs */
+#define DEFAULT_OBJECTS  200000  /* objects per producer */
+#define DEFAULT_MAXSIZE  256     /* largest object, in bytes */
+#define RING_SIZE        1024    /* slots in a handoff ring, power of two */
+
+/* Handoff from one producer to one consumer */
+typedef struct {
+    char *slots[RING_SIZE];
+    unsigned long head;          /* next slot the consumer reads */
+    unsigned long tail;          /* next slot the producer writes */
+} ring_t;
+
+/* Per-pair state */
+typedef struct {
+    pthread_t producer, consumer;
+    ring_t *ring;
+    int id;
+    int objects;
+    int maxsize;
+    int failed;                  /* allocation failure or corrupted object */
+    int done;                    /* the consumer freed every object */
+} pair_t;
+
+/* mm.c prints debug output when this is set */
+int verbose = 0;
+
+/*********************
+ * Function prototypes
+ *********************/
+static double run(pair_t *pairs, int npairs, int remote_queues,
+        mm_mt_stats_t *stats);
+static void *producer(void *vargp);
+static void *consumer(void *vargp);
+static void usage(void);
+static void unix_error(char *msg);
+
+/**************
+ * Main routine
+ **************/
+int main(int argc, char **argv)
+{
+    int npairs = DEFAULT_PAIRS;
+    int objects = DEFAULT_OBJECTS;
+    int maxsize = DEFAULT_MAXSIZE;
+    pair_t *pairs;
+    mm_mt_stats_t stats;
+    double secs, ops;
+    int c, i, remote_queues;
+
+    while ((c = getopt(argc, argv, "p:n:s:h")) != EOF) {
+        switch (c) {
+            case 'p': /* Number of producer/consumer pairs */
+                npairs = atoi(optarg);
+                break;
+            case 'n': /* Objects allocated by each producer */
+                objects = atoi(optarg);
+                break;
+            case 's': /* Largest object size */
+                maxsize = atoi(optarg);
+                break;
+            case 'h': /* Print this message */
+                usage();
+                exit(0);
+            default:
+                usage();
+                exit(1);
+        }
+    }
+    if (npairs <= 0 || objects <= 0 || maxsize < 8) {
+        usage();
+        exit(1);
+    }
+
+    if ((pairs = calloc(npairs, sizeof(pair_t))) == NULL)
+        unix_error("calloc failed in main");
+    for (i = 0; i < npairs; i++) {
+        if ((pairs[i].ring = calloc(1, sizeof(ring_t))) == NULL)
+            unix_error("calloc failed in main");
+        pairs[i].id = i;
+        pairs[i].objects = objects;
+        pairs[i].maxsize = maxsize;
+    }
+
+    mem_init();
+
+    printf("%d producer/consumer pairs, %d objects each, 8..%d bytes\n",
+            npairs, objects, maxsize);
+    printf("%-16s%8s%10s%10s%10s%10s%10s\n", "remote frees",
+            "secs", "Kops", "locks", "contended", "queued", "drained");
+
+    for (remote_queues = 0; remote_queues <= 1; remote_queues++) {
+        secs = run(pairs, npairs, remote_queues, &stats);
+        ops = 2.0 * npairs * objects;
+        printf("%-16s%8.3f%10.0f%10lu%10lu%10lu%10lu\n",
+                remote_queues ? "queued" : "heap lock",
+                secs, ops / 1e3 / secs, stats.locks, stats.contended,
+                stats.queued, stats.drained);
+    }
+
+    for (i = 0; i < npairs; i++)
+        free(pairs[i].ring);
+    free(pairs);
+    mem_deinit();
+    exit(0);
+}
+
+/*
+ * run - Run every pair once on a fresh heap and return the wall clock
+ *     time. The statistics are taken after all threads are done.
+ */
+static double run(pair_t *pairs, int npairs, int remote_queues,
+        mm_mt_stats_t *stats)
+{
+    struct timespec start, end;
+    int i;
+
+    mem_reset_brk();
+    if (mm_mt_init(remote_queues) < 0)
+        unix_error("mm_mt_init failed in run");
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (i = 0; i < npairs; i++) {
+        pairs[i].ring->head = pairs[i].ring->tail = 0;
+        pairs[i].failed = 0;
+        pairs[i].done = 0;
+        if (pthread_create(&pairs[i].producer, NULL, producer, &pairs[i]) != 0 ||
+                pthread_create(&pairs[i].consumer, NULL, consumer, &pairs[i]) != 0)
+            unix_error("pthread_create failed in run");
+    }
+    for (i = 0; i < npairs; i++) {
+        pthread_join(pairs[i].producer, NULL);
+        pthread_join(pairs[i].consumer, NULL);
+        if (pairs[i].failed) {
+            fprintf(stderr, "pair %d failed\n", i);
+            exit(1);
+        }
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    mm_mt_stats(stats);
+    return (end.tv_sec - start.tv_sec) + 1e-9 * (end.tv_nsec - start.tv_nsec);
+}
+
+/*
+ * producer - Allocate objects, stamp them, and hand them to the consumer.
+ *     The producer keeps its cache attached until the consumer has freed
+ *     everything, so the last queued frees are drained by their owner.
+ */
+static void *producer(void *vargp)
+{
+    pair_t *pair = (pair_t *)vargp;
+    ring_t *ring = pair->ring;
+    unsigned int seed = pair->id + 1;
+    int i, size;
+    char *p;
+
+    for (i = 0; i < pair->objects; i++) {
+        size = 8 + rand_r(&seed) % (pair->maxsize - 7);
+        if ((p = mm_mt_malloc(size)) == NULL) {
+            pair->failed = 1;
+            size = 0;
+        } else {
+            memset(p, i & 0xFF, size);
+        }
+
+        while (ring->tail - __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE) == RING_SIZE)
+            sched_yield();
+        ring->slots[ring->tail % RING_SIZE] = p;
+        __atomic_store_n(&ring->tail, ring->tail + 1, __ATOMIC_RELEASE);
+    }
+
+    while (!__atomic_load_n(&pair->done, __ATOMIC_ACQUIRE))
+        sched_yield();
+    mm_mt_detach();
+    return NULL;
+}
+
+/*
+ * consumer - Check and free every object the producer hands over
+ */
+static void *consumer(void *vargp)
+{
+    pair_t *pair = (pair_t *)vargp;
+    ring_t *ring = pair->ring;
+    int i;
+    char *p;
+
+    for (i = 0; i < pair->objects; i++) {
+        while (__atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE) == ring->head)
+            sched_yield();
+        p = ring->slots[ring->head % RING_SIZE];
+        __atomic_store_n(&ring->head, ring->head + 1, __ATOMIC_RELEASE);
+
+        if (p == NULL)
+            continue;
+        if ((unsigned char)p[0] != (i & 0xFF) || (unsigned char)p[7] != (i & 0xFF))
+            pair->failed = 1;
+        mm_mt_free(p);
+    }
+
+    __atomic_store_n(&pair->done, 1, __ATOMIC_RELEASE);
+    mm_mt_detach();
+    return NULL;
+}
+
+/*
+ * usage - Explain the command line arguments
+ */
+static void usage(void)
+{
+    fprintf(stderr, "Usage: pcbench [-h] [-p <pairs>] [-n <objects>] [-s <maxsize>]\n");
+    fprintf(stderr, "Options\n");
+    fprintf(stderr, "\t-h            Print this message.\n");
+    fprintf(stderr, "\t-n <objects>  Objects allocated by each producer (default %d).\n",
+            DEFAULT_OBJECTS);
+    fprintf(stderr, "\t-p <pairs>    Producer/consumer thread pairs (default %d).\n",
+            DEFAULT_PAIRS);
+    fprintf(stderr, "\t-s <maxsize>  Largest object size in bytes (default %d).\n",
+            DEFAULT_MAXSIZE);
+}
+
+/*
+ * unix_error - Report Unix-style error and terminate
+ */
+static void unix_error(char *msg)
+{
+    printf("%s: %s\n", msg, strerror(errno));
+    exit(1);
+}
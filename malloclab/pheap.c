@@ -0,0 +1,218 @@
+/*
+ * pheap.c - warm restart benchmark for file-backed heaps
+ *
+ * The first run finds no heap in the heap file. It builds one: a list of
+ * objects, with every third object freed again so that the heap has free
+ * lists to check, and it records the head of the list with mm_set_root.
+ * Every later run maps the heap back in with mem_init_file, adopts it with
+ * mm_attach, and walks the list to make sure every object survived. Both
+ * runs report how long it took to get to a usable heap.
+ *
+ * Objects link to each other by offset from the start of the heap, like
+ * mm.c does internally, since the heap may be mapped at a different address.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <time.h>
+
+#include "mm.h"
+#include "memlib.h"
+
+/**********************
+ * Constants and macros
+ **********************/
+#define DEFAULT_FILE     "pheap.heap"
+#define DEFAULT_OBJECTS  1000000 /* objects kept in the heap */
+#define DEFAULT_MAXSIZE  256     /* largest object, in bytes */
+
+/* An object in the heap */
+typedef struct {
+    unsigned long next;          /* offset of the next object, 0 at the end */
+    unsigned long seq;           /* position in the list */
+    unsigned long sum;           /* check on next and seq */
+} node_t;
+
+#define OFFSET(p)   ((unsigned long)((char *)(p) - (char *)mem_heap_lo()))
+#define NODE(off)   ((node_t *)((char *)mem_heap_lo() + (off)))
+#define SUM(n)      (((n)->next * 31 + (n)->seq) ^ 0x5bd1e995UL)
+
+/* mm.c prints debug output when this is set */
+int verbose = 0;
+
+/*********************
+ * Function prototypes
+ *********************/
+static long build(long objects, int maxsize);
+static long walk(void);
+static double now(void);
+static void usage(void);
+
+/**************
+ * Main routine
+ **************/
+int main(int argc, char **argv)
+{
+    char *file = DEFAULT_FILE;
+    long objects = DEFAULT_OBJECTS;
+    int maxsize = DEFAULT_MAXSIZE;
+    int rebuild = 0;
+    double start, secs;
+    long count;
+    int c;
+
+    while ((c = getopt(argc, argv, "f:n:s:ch")) != EOF) {
+        switch (c) {
+            case 'f': /* Heap file */
+                file = optarg;
+                break;
+            case 'n': /* Objects to build the heap with */
+                objects = atol(optarg);
+                break;
+            case 's': /* Largest object size */
+                maxsize = atoi(optarg);
+                break;
+            case 'c': /* Build a new heap even if the file holds one */
+                rebuild = 1;
+                break;
+            case 'h': /* Print this message */
+                usage();
+                exit(0);
+            default:
+                usage();
+                exit(1);
+        }
+    }
+    if (objects <= 0 || maxsize < (int)sizeof(node_t)) {
+        usage();
+        exit(1);
+    }
+
+    start = now();
+    if (mem_init_file(file) && !rebuild) {
+        if (mm_attach() < 0) {
+            fprintf(stderr, "%s: heap failed the consistency check\n", file);
+            exit(1);
+        }
+        secs = now() - start;
+        printf("attached to %lu byte heap in %.3f ms\n",
+                (unsigned long)mem_heapsize(), secs * 1e3);
+
+        if ((count = walk()) < 0) {
+            fprintf(stderr, "%s: object list is corrupted\n", file);
+            exit(1);
+        }
+        printf("walked %ld objects\n", count);
+    } else {
+        mem_reset_brk();
+        if (mm_init() < 0) {
+            fprintf(stderr, "mm_init failed\n");
+            exit(1);
+        }
+        count = build(objects, maxsize);
+        if (mem_sync() < 0) {
+            fprintf(stderr, "%s: mem_sync failed\n", file);
+            exit(1);
+        }
+        secs = now() - start;
+        printf("built %lu byte heap with %ld objects in %.3f ms\n",
+                (unsigned long)mem_heapsize(), count, secs * 1e3);
+    }
+
+    mem_deinit();
+    exit(0);
+}
+
+/*
+ * build - Allocate `objects` objects, free every third one again, and
+ *     link the rest into the list mm_get_root returns. Returns the
+ *     length of the list.
+ */
+static long build(long objects, int maxsize)
+{
+    unsigned int seed = 1;
+    node_t *n, *prev = NULL, *hole = NULL;
+    long i, count = 0;
+    int size;
+
+    for (i = 0; i < objects; i++) {
+        size = sizeof(node_t) + rand_r(&seed) % (maxsize - sizeof(node_t) + 1);
+        if ((n = mm_malloc(size)) == NULL) {
+            fprintf(stderr, "mm_malloc failed after %ld objects\n", i);
+            exit(1);
+        }
+
+        /* a freed object leaves a hole once the next one is allocated */
+        if (hole != NULL) {
+            mm_free(hole);
+            hole = NULL;
+        }
+        if (i % 3 == 2) {
+            hole = n;
+            continue;
+        }
+
+        n->next = 0;
+        n->seq = count++;
+        n->sum = SUM(n);
+        if (prev == NULL) {
+            mm_set_root(n);
+        } else {
+            prev->next = OFFSET(n);
+            prev->sum = SUM(prev);
+        }
+        prev = n;
+    }
+
+    if (hole != NULL)
+        mm_free(hole);
+    return count;
+}
+
+/*
+ * walk - Check every object on the list mm_get_root returns. Returns
+ *     the length of the list, or -1 if an object is corrupted.
+ */
+static long walk(void)
+{
+    node_t *n = mm_get_root();
+    long count = 0;
+
+    while (n != NULL) {
+        if (n->seq != (unsigned long)count || n->sum != SUM(n) ||
+                n->next >= mem_heapsize())
+            return -1;
+        count++;
+        n = n->next ? NODE(n->next) : NULL;
+    }
+
+    return count;
+}
+
+/*
+ * now - Wall clock time in seconds
+ */
+static double now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + 1e-9 * ts.tv_nsec;
+}
+
+/*
+ * usage - Explain the command line arguments
+ */
+static void usage(void)
+{
+    fprintf(stderr, "Usage: pheap [-hc] [-f <file>] [-n <objects>] [-s <maxsize>]\n");
+    fprintf(stderr, "Options\n");
+    fprintf(stderr, "\t-c            Build a new heap even if <file> holds one.\n");
+    fprintf(stderr, "\t-f <file>     Heap file (default %s).\n", DEFAULT_FILE);
+    fprintf(stderr, "\t-h            Print this message.\n");
+    fprintf(stderr, "\t-n <objects>  Objects to build a new heap with (default %d).\n",
+            DEFAULT_OBJECTS);
+    fprintf(stderr, "\t-s <maxsize>  Largest object size in bytes (default %d).\n",
+            DEFAULT_MAXSIZE);
+}
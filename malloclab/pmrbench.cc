@@ -0,0 +1,308 @@
+/*
+ * pmrbench.cc - STL container workloads on mm and on the standard resources
+ *
+ * Runs the same container workloads on pmr containers backed by
+ * new_delete_resource, by a monotonic_buffer_resource, and by mm_resource,
+ * and on ordinary containers with mm_allocator. Every workload starts on a
+ * fresh mm heap and a fresh monotonic buffer. The best of several runs is
+ * reported in ms, with the speedup over new_delete_resource.
+ */
+#include <cstdio>
+#include <cstdlib>
+#include <chrono>
+#include <map>
+#include <memory_resource>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <unistd.h>
+
+#include "mm_resource.h"
+
+extern "C" {
+#include "memlib.h"
+}
+
+/**********************
+ * Constants and macros
+ **********************/
+#define DEFAULT_ELEMS    100000  /* elements per workload */
+#define DEFAULT_RUNS     3       /* runs per workload, the best is reported */
+
+/* mm.c prints debug output when this is set */
+extern "C" {
+int verbose = 0;
+}
+
+/* Keeps the workloads from being optimized away */
+volatile long sink;
+
+/* How a workload gets its allocator */
+enum alloc_kind { NEW_DELETE, MONOTONIC, MM_RESOURCE, MM_ALLOCATOR, NKINDS };
+
+static const char *kind_names[NKINDS] = {
+    "new_delete", "monotonic", "mm_resource", "mm_allocator"
+};
+
+/*
+ * Workloads are templated on a byte allocator, std::pmr::polymorphic_allocator
+ * or mm_allocator, and rebind it to the element types of their containers
+ */
+template <class A, class T>
+using rebind = typename std::allocator_traits<A>::template rebind_alloc<T>;
+
+template <class A>
+using string_t = std::basic_string<char, std::char_traits<char>, rebind<A, char>>;
+
+/*********************
+ * Function prototypes
+ *********************/
+template <class A> static long vector_workload(A alloc, int elems);
+template <class A> static long map_workload(A alloc, int elems);
+template <class A> static long unordered_map_workload(A alloc, int elems);
+template <class A> static long string_workload(A alloc, int elems);
+static void usage(void);
+
+/* A workload, instantiated for both kinds of allocator */
+struct workload {
+    const char *name;
+    long (*pmr)(std::pmr::polymorphic_allocator<std::byte>, int);
+    long (*mm)(mm_allocator<std::byte>, int);
+};
+
+static const workload workloads[] = {
+    {"vector", vector_workload, vector_workload},
+    {"map", map_workload, map_workload},
+    {"unordered_map", unordered_map_workload, unordered_map_workload},
+    {"string", string_workload, string_workload},
+};
+
+/*
+ * run - Run workload `w` on allocator `kind` once, and return the time it
+ *     took in ms, including tearing down its containers
+ */
+static double run(const workload &w, alloc_kind kind, int elems)
+{
+    using clock = std::chrono::steady_clock;
+    clock::time_point start;
+    mm_resource mm;
+
+    if (kind == MM_RESOURCE || kind == MM_ALLOCATOR) {
+        mem_reset_brk();
+        if (mm_init() < 0) {
+            fprintf(stderr, "mm_init failed\n");
+            exit(1);
+        }
+    }
+
+    /* the monotonic buffer is created and released inside the timing */
+    start = clock::now();
+    switch (kind) {
+        case NEW_DELETE:
+            sink = w.pmr(std::pmr::new_delete_resource(), elems);
+            break;
+        case MONOTONIC: {
+            std::pmr::monotonic_buffer_resource mono(std::pmr::new_delete_resource());
+            sink = w.pmr(&mono, elems);
+            break;
+        }
+        case MM_RESOURCE:
+            sink = w.pmr(&mm, elems);
+            break;
+        case MM_ALLOCATOR:
+            sink = w.mm(mm_allocator<std::byte>(), elems);
+            break;
+        default:
+            break;
+    }
+
+    return std::chrono::duration<double, std::milli>(clock::now() - start).count();
+}
+
+/**************
+ * Main routine
+ **************/
+int main(int argc, char **argv)
+{
+    int elems = DEFAULT_ELEMS;
+    int runs = DEFAULT_RUNS;
+    char *fit = NULL;
+    char *order = NULL;
+    double ms[NKINDS];
+    int c, i, k, r;
+
+    while ((c = getopt(argc, argv, "n:r:p:O:h")) != EOF) {
+        switch (c) {
+            case 'n': /* Elements per workload */
+                elems = atoi(optarg);
+                break;
+            case 'r': /* Runs per workload */
+                runs = atoi(optarg);
+                break;
+            case 'p': /* Fit policy */
+                fit = optarg;
+                break;
+            case 'O': /* Free list order */
+                order = optarg;
+                break;
+            case 'h': /* Print this message */
+                usage();
+                exit(0);
+            default:
+                usage();
+                exit(1);
+        }
+    }
+    if (elems <= 0 || runs <= 0 ||
+            (fit != NULL && mm_set_fit_policy(fit) < 0) ||
+            (order != NULL && mm_set_order_policy(order) < 0)) {
+        usage();
+        exit(1);
+    }
+
+    mem_init();
+
+    printf("%d elements, best of %d runs, %s fit, %s order\n", elems, runs,
+            fit ? fit : "default", order ? order : "default");
+    printf("ms (speedup over new_delete)\n");
+    printf("%-16s", "workload");
+    for (k = 0; k < NKINDS; k++)
+        printf("%20s", kind_names[k]);
+    printf("\n");
+
+    for (i = 0; i < (int)(sizeof(workloads) / sizeof(workloads[0])); i++) {
+        for (k = 0; k < NKINDS; k++) {
+            ms[k] = 0;
+            for (r = 0; r < runs; r++) {
+                double t = run(workloads[i], (alloc_kind)k, elems);
+                if (r == 0 || t < ms[k])
+                    ms[k] = t;
+            }
+        }
+
+        printf("%-16s", workloads[i].name);
+        for (k = 0; k < NKINDS; k++)
+            printf("%11.2f (%5.2fx)", ms[k], ms[NEW_DELETE] / ms[k]);
+        printf("\n");
+    }
+
+    mem_deinit();
+    exit(0);
+}
+
+/*
+ * vector_workload - Grow many vectors of random length element by element,
+ *     so that every one reallocates its storage a few times
+ */
+template <class A>
+static long vector_workload(A alloc, int elems)
+{
+    using vec = std::vector<int, rebind<A, int>>;
+    std::vector<vec, rebind<A, vec>> vecs(alloc);
+    unsigned int seed = 1;
+    long sum = 0;
+    int n;
+
+    for (int done = 0; done < elems; done += n) {
+        n = 1 + rand_r(&seed) % 256;
+        vecs.emplace_back();
+        for (int j = 0; j < n; j++)
+            vecs.back().push_back(j);
+    }
+
+    for (const vec &v : vecs)
+        sum += v.size();
+    return sum;
+}
+
+/*
+ * map_workload - Insert random keys into a map, erase every other one,
+ *     then look all of them up
+ */
+template <class A>
+static long map_workload(A alloc, int elems)
+{
+    using value = std::pair<const int, int>;
+    std::map<int, int, std::less<int>, rebind<A, value>> m(alloc);
+    unsigned int seed = 1;
+    long sum = 0;
+
+    for (int i = 0; i < elems; i++)
+        m[rand_r(&seed)] = i;
+    for (auto it = m.begin(); it != m.end(); ) {
+        it = m.erase(it);
+        if (it != m.end())
+            ++it;
+    }
+
+    seed = 1;
+    for (int i = 0; i < elems; i++)
+        sum += m.count(rand_r(&seed));
+    return sum;
+}
+
+/*
+ * unordered_map_workload - Like map_workload, on a hash table
+ */
+template <class A>
+static long unordered_map_workload(A alloc, int elems)
+{
+    using value = std::pair<const int, int>;
+    std::unordered_map<int, int, std::hash<int>, std::equal_to<int>,
+        rebind<A, value>> m(alloc);
+    unsigned int seed = 1;
+    long sum = 0;
+
+    for (int i = 0; i < elems; i++)
+        m[rand_r(&seed)] = i;
+    for (auto it = m.begin(); it != m.end(); ) {
+        it = m.erase(it);
+        if (it != m.end())
+            ++it;
+    }
+
+    seed = 1;
+    for (int i = 0; i < elems; i++)
+        sum += m.count(rand_r(&seed));
+    return sum;
+}
+
+/*
+ * string_workload - Build strings of random length, most of them too long
+ *     for the small string buffer, by appending to them piece by piece
+ */
+template <class A>
+static long string_workload(A alloc, int elems)
+{
+    using str = string_t<A>;
+    std::vector<str, rebind<A, str>> strs(alloc);
+    unsigned int seed = 1;
+    long sum = 0;
+
+    for (int i = 0; i < elems; i++) {
+        str s(alloc);
+        int n = 8 + rand_r(&seed) % 120;
+        while ((int)s.size() < n)
+            s.append("0123456789abcdef", 1 + rand_r(&seed) % 16);
+        strs.push_back(std::move(s));
+    }
+
+    for (const str &s : strs)
+        sum += s.size();
+    return sum;
+}
+
+/*
+ * usage - Explain the command line arguments
+ */
+static void usage(void)
+{
+    fprintf(stderr, "Usage: pmrbench [-h] [-n <elems>] [-r <runs>] [-p <fit>] [-O <order>]\n");
+    fprintf(stderr, "Options\n");
+    fprintf(stderr, "\t-h            Print this message.\n");
+    fprintf(stderr, "\t-n <elems>    Elements per workload (default %d).\n", DEFAULT_ELEMS);
+    fprintf(stderr, "\t-O <order>    mm free list order, as for mdriver -O.\n");
+    fprintf(stderr, "\t-p <fit>      mm fit policy, as for mdriver -p.\n");
+    fprintf(stderr, "\t-r <runs>     Runs per workload, the best is reported (default %d).\n",
+            DEFAULT_RUNS);
+}
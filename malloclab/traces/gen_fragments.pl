@@ -0,0 +1,77 @@
+#!/usr/bin/perl
+#!/usr/local/bin/perl
+
+# An adversarial heap for free list searches: thousands of small free
+# fragments, kept apart by live separators so they cannot coalesce, all
+# in the same size class as the requests that follow. A fragment holds
+# a 40 byte payload and every request asks for 48 bytes, so no fragment
+# ever fits. A search that walks the whole size class inspects every
+# fragment on every request.
+
+$out_filename = $argv[0];
+$out_filename = "fragments.rep" unless $out_filename;
+$num_fragments = 4000;
+$num_requests = 2000;
+$fragment_size = 40;
+$request_size = 48;
+$separator_size = 8;
+
+srand(239);
+
+$seq = 0;
+
+# fragments with a separator after each one
+for ($i = 0;  $i < $num_fragments; $i += 1) {
+    push @fragments, $seq;
+    push @trace, "a $seq $fragment_size";
+    $seq++;
+    push @separators, $seq;
+    push @trace, "a $seq $separator_size";
+    $seq++;
+    $total_block_size += $fragment_size + $separator_size;
+}
+
+# free the fragments in random order
+while (@fragments) {
+    $j = int(rand(@fragments));
+    push @trace, "f $fragments[$j]";
+    splice @fragments, $j, 1;
+}
+
+# requests that fit none of the fragments, a few freed again right away
+for ($i = 0;  $i < $num_requests; $i += 1) {
+    push @trace, "a $seq $request_size";
+    if (rand() < 0.25) {
+        push @trace, "f $seq";
+    } else {
+        push @live, $seq;
+        $total_block_size += $request_size;
+    }
+    $seq++;
+}
+
+# free everything that is left
+push @live, @separators;
+while (@live) {
+    $j = int(rand(@live));
+    push @trace, "f $live[$j]";
+    splice @live, $j, 1;
+}
+
+# Open output file
+open OUTFILE, ">$out_filename" or die "Cannot create $out_filename\n";
+
+# Calculate misc parameters
+$suggested_heap_size = $total_block_size + 100;
+$num_ops = @trace;
+
+print OUTFILE "$suggested_heap_size\n";
+print OUTFILE "$seq\n";
+print OUTFILE "$num_ops\n";
+print OUTFILE "1\n";
+
+foreach $line (@trace) {
+    print OUTFILE "$line\n";
+}
+
+close OUTFILE;
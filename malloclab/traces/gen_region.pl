@@ -0,0 +1,68 @@
+#!/usr/bin/perl
+#!/usr/local/bin/perl
+
+# Request-scoped allocations: every "request" allocates a burst of small
+# objects (and grows one buffer with realloc), then frees all of them
+# before the next request starts. This is the lifetime pattern regions
+# are made for.
+
+$out_filename = $argv[0];
+$out_filename = "region.rep" unless $out_filename;
+$num_requests = 400;
+$min_objs = 10;
+$max_objs = 50;
+$max_obj_size = 256;
+
+srand(230);
+
+$seq = 0;
+for ($r = 0;  $r < $num_requests; $r += 1) {
+    @live = ();
+
+    # a growing buffer, like a response being assembled
+    $buf = $seq++;
+    $buf_size = 64;
+    push @trace, "a $buf $buf_size";
+    push @live, $buf;
+
+    $num_objs = $min_objs + int(rand($max_objs - $min_objs + 1));
+    for ($i = 0;  $i < $num_objs; $i += 1) {
+        # mostly small objects, a few larger ones
+        $size = 1 + int(rand(rand() < 0.9 ? 64 : $max_obj_size));
+        push @trace, "a $seq $size";
+        push @live, $seq;
+        $seq++;
+        $total_block_size += $size;
+
+        if ($i % 8 == 7) {
+            $buf_size *= 2;
+            push @trace, "r $buf $buf_size";
+        }
+    }
+    $total_block_size += $buf_size;
+
+    # end of request: free everything in random order
+    while (@live) {
+        $j = int(rand(@live));
+        push @trace, "f $live[$j]";
+        splice @live, $j, 1;
+    }
+}
+
+# Open output file
+open OUTFILE, ">$out_filename" or die "Cannot create $out_filename\n";
+
+# Calculate misc parameters
+$suggested_heap_size = $total_block_size + 100;
+$num_ops = @trace;
+
+print OUTFILE "$suggested_heap_size\n";
+print OUTFILE "$seq\n";
+print OUTFILE "$num_ops\n";
+print OUTFILE "1\n";
+
+foreach $line (@trace) {
+    print OUTFILE "$line\n";
+}
+
+close OUTFILE;
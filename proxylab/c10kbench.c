@@ -0,0 +1,303 @@
+/*
+ * c10kbench.c - many concurrent, mostly idle clients against the proxy
+ *
+ * Opens <conns> connections to the proxy at once and holds all of them
+ * idle for a while, the way keep-alive clients sit on their connections,
+ * then sends a GET for <url> on every one that is still open and waits
+ * for the responses. A single epoll loop drives all of the connections.
+ *
+ * Reports how many connections were established, how many requests were
+ * answered 200, how many were turned away with 503 and how many failed
+ * or timed out, the rate at which requests were answered, and the
+ * latency of the answers. Run it against the threaded and the event
+ * mode of the proxy to compare them; fetch an object the proxy has
+ * cached so the origin server is not what is measured.
+ *
+ * usage: c10kbench [-h] [-c <conns>] [-i <secs>] [-T <secs>] <proxy port> <url>
+ */
+#include "csapp.h"
+#include <sys/epoll.h>
+#include <sys/resource.h>
+
+#define DEFAULT_CONNS 10000
+#define DEFAULT_IDLE 2.0
+#define DEFAULT_TIMEOUT 30.0
+#define MAX_EVENTS 256
+
+typedef enum { CONNECTING, IDLE, WAITING, DONE, NSTATES } client_state_t;
+
+typedef struct {
+    int fd;
+    client_state_t state;
+    char head[16];              /* start of the response, for the status */
+    int head_len;
+    double sent;                /* when the request was sent */
+} client_t;
+
+static client_t *clients;
+static int nclients;
+static int nstate[NSTATES];     /* clients in each state */
+static int epfd;
+static double *latencies;       /* of the 200s, in seconds */
+static int nok, nrejected, nother, nfailed;
+
+static void open_clients(struct addrinfo *ai);
+static void send_requests(char *request, int len);
+static void run_events(double until, client_state_t settle);
+static void on_event(client_t *c);
+static void set_state(client_t *c, client_state_t state);
+static void finish(client_t *c, int failed);
+static int cmp_double(const void *a, const void *b);
+static double now(void);
+static void usage(void);
+
+int main(int argc, char **argv) {
+    double idle = DEFAULT_IDLE, timeout = DEFAULT_TIMEOUT;
+    double start, elapsed;
+    struct addrinfo hints, *ai;
+    struct rlimit rl;
+    char request[MAXLINE];
+    int c, len, i;
+
+    nclients = DEFAULT_CONNS;
+    while ((c = getopt(argc, argv, "hc:i:T:")) != EOF) {
+        switch (c) {
+        case 'c':
+            nclients = atoi(optarg);
+            break;
+        case 'i':
+            idle = atof(optarg);
+            break;
+        case 'T':
+            timeout = atof(optarg);
+            break;
+        case 'h':
+            usage();
+            return 0;
+        default:
+            usage();
+            return 1;
+        }
+    }
+    if (optind != argc - 2 || nclients <= 0 || idle < 0 || timeout <= 0) {
+        usage();
+        return 1;
+    }
+
+    /* a descriptor per client, and a few to spare */
+    if (getrlimit(RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur < rl.rlim_max) {
+        rl.rlim_cur = rl.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &rl);
+    }
+    if (getrlimit(RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur < (rlim_t)nclients + 16) {
+        fprintf(stderr, "%d connections need more than the %ld descriptors allowed\n",
+                nclients, (long)rl.rlim_cur);
+        return 1;
+    }
+
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = AI_NUMERICSERV;
+    Getaddrinfo("localhost", argv[optind], &hints, &ai);
+    len = snprintf(request, sizeof(request), "GET %s HTTP/1.0\r\n\r\n", argv[optind + 1]);
+
+    clients = Calloc(nclients, sizeof(client_t));
+    latencies = Calloc(nclients, sizeof(double));
+    if ((epfd = epoll_create1(0)) < 0)
+        unix_error("epoll_create1 error");
+
+    /* connect everyone, then let them all sit idle */
+    start = now();
+    open_clients(ai);
+    run_events(start + timeout, CONNECTING);
+    printf("%d of %d connections established in %.2f s\n",
+            nstate[IDLE] + nrejected, nclients, now() - start);
+    run_events(now() + idle, NSTATES);
+
+    /* then have every client still connected ask at once */
+    start = now();
+    send_requests(request, len);
+    run_events(start + timeout, WAITING);
+    elapsed = now() - start;
+    for (i = 0; i < nclients; i++) {
+        if (clients[i].state != DONE)
+            finish(&clients[i], 1);
+    }
+
+    printf("%d ok, %d rejected (503), %d other status, %d failed or timed out\n",
+            nok, nrejected, nother, nfailed);
+    printf("%.0f responses/s over %.2f s\n", nok / elapsed, elapsed);
+    if (nok) {
+        qsort(latencies, nok, sizeof(double), cmp_double);
+        printf("latency ms: p50 %.2f  p90 %.2f  p99 %.2f  max %.2f\n",
+                1e3 * latencies[nok / 2], 1e3 * latencies[nok * 9 / 10],
+                1e3 * latencies[nok * 99 / 100], 1e3 * latencies[nok - 1]);
+    }
+
+    freeaddrinfo(ai);
+    return 0;
+}
+
+/*
+ * open_clients - start a non-blocking connect for every client
+ */
+static void open_clients(struct addrinfo *ai) {
+    struct epoll_event ev;
+    client_t *c;
+    int i;
+
+    for (i = 0; i < nclients; i++) {
+        c = &clients[i];
+        nstate[c->state = CONNECTING]++;
+        if ((c->fd = socket(ai->ai_family, ai->ai_socktype | SOCK_NONBLOCK, 0)) < 0)
+            unix_error("socket error");
+        if (connect(c->fd, ai->ai_addr, ai->ai_addrlen) < 0 && errno != EINPROGRESS) {
+            finish(c, 1);
+            continue;
+        }
+        ev.events = EPOLLOUT;
+        ev.data.ptr = c;
+        if (epoll_ctl(epfd, EPOLL_CTL_ADD, c->fd, &ev) < 0)
+            unix_error("epoll_ctl error");
+    }
+}
+
+/*
+ * send_requests - send the request on every idle connection
+ */
+static void send_requests(char *request, int len) {
+    client_t *c;
+    int i;
+
+    for (i = 0; i < nclients; i++) {
+        c = &clients[i];
+        if (c->state != IDLE)
+            continue;
+        c->sent = now();
+        if (write(c->fd, request, len) != len)
+            finish(c, 1);
+        else
+            set_state(c, WAITING);
+    }
+}
+
+/*
+ * run_events - handle events until time `until`, or, unless `settle` is
+ *   NSTATES, until no client is left in state `settle`
+ */
+static void run_events(double until, client_state_t settle) {
+    struct epoll_event events[MAX_EVENTS];
+    double left;
+    int n, i;
+
+    while ((left = until - now()) > 0 && (settle == NSTATES || nstate[settle] > 0)) {
+        if ((n = epoll_wait(epfd, events, MAX_EVENTS, (int)(left * 1000) + 1)) < 0) {
+            if (errno == EINTR)
+                continue;
+            unix_error("epoll_wait error");
+        }
+        for (i = 0; i < n; i++)
+            on_event(events[i].data.ptr);
+    }
+}
+
+/*
+ * on_event - a client's connect finished, or its socket became readable:
+ *   a response, a 503 for an idle connection, or the proxy closing it
+ */
+static void on_event(client_t *c) {
+    struct epoll_event ev;
+    char buf[MAXBUF];
+    socklen_t errlen = sizeof(int);
+    int err = 0;
+    ssize_t n;
+
+    if (c->state == CONNECTING) {
+        if (getsockopt(c->fd, SOL_SOCKET, SO_ERROR, &err, &errlen) < 0 || err) {
+            finish(c, 1);
+            return;
+        }
+        set_state(c, IDLE);
+        ev.events = EPOLLIN;
+        ev.data.ptr = c;
+        if (epoll_ctl(epfd, EPOLL_CTL_MOD, c->fd, &ev) < 0)
+            unix_error("epoll_ctl error");
+        return;
+    }
+
+    while ((n = read(c->fd, buf, sizeof(buf))) > 0) {
+        if (c->head_len < (int)sizeof(c->head) - 1) {
+            int keep = sizeof(c->head) - 1 - c->head_len;
+            if (keep > n)
+                keep = n;
+            memcpy(c->head + c->head_len, buf, keep);
+            c->head_len += keep;
+        }
+    }
+    if (n == 0)
+        finish(c, 0);
+    else if (errno != EAGAIN && errno != EINTR)
+        finish(c, 1);
+}
+
+/*
+ * set_state - move client `c` to `state`
+ */
+static void set_state(client_t *c, client_state_t state) {
+    nstate[c->state]--;
+    nstate[c->state = state]++;
+}
+
+/*
+ * finish - close client `c` and count it by the status of its response,
+ *   or as failed if `failed` and there was no response to speak of
+ */
+static void finish(client_t *c, int failed) {
+    int status = 0;
+
+    close(c->fd);
+    c->head[c->head_len] = '\0';
+    sscanf(c->head, "%*s %d", &status);
+
+    if (status == 200 && !failed && c->sent > 0)
+        latencies[nok++] = now() - c->sent;
+    else if (status == 503)
+        nrejected++;
+    else if (failed || status == 0 || status == 200)
+        nfailed++;
+    else
+        nother++;
+    set_state(c, DONE);
+}
+
+/*
+ * cmp_double - qsort comparison of doubles
+ */
+static int cmp_double(const void *a, const void *b) {
+    double x = *(const double *)a, y = *(const double *)b;
+
+    return x < y ? -1 : x > y;
+}
+
+/*
+ * now - the time in seconds
+ */
+static double now(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/*
+ * usage - explain the command line arguments
+ */
+static void usage(void) {
+    fprintf(stderr, "usage: c10kbench [-h] [-c <conns>] [-i <secs>] [-T <secs>] <proxy port> <url>\n");
+    fprintf(stderr, "\t-c <conns>    Concurrent connections (default %d).\n", DEFAULT_CONNS);
+    fprintf(stderr, "\t-h            Print this message.\n");
+    fprintf(stderr, "\t-i <secs>     Seconds all connections sit idle (default %.1f).\n", DEFAULT_IDLE);
+    fprintf(stderr, "\t-T <secs>     Seconds to wait for connects, and for responses (default %.1f).\n",
+            DEFAULT_TIMEOUT);
+}
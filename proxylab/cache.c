@@ -0,0 +1,329 @@
+/*
+ * cache.c - in-memory web object cache for the proxy
+ *
+ * Objects are hashed by their normalized uri into NSHARDS shards, each a
+ * chained hash table with its own lock and its own share of the byte
+ * budget. The lock only serializes inserts and evictions within a shard;
+ * lookups take no lock at all.
+ *
+ * A lookup walks the bucket chain with atomic loads and takes a reference
+ * on the object it finds. Inserts and evictions publish and unlink
+ * objects with atomic stores, so a concurrent walk sees the chain either
+ * before or after the change. An evicted object can still be being walked
+ * or have a reference taken on it, so the last reference doesn't free it
+ * but retires it, and retired objects are freed by epoch based
+ * reclamation: every thread announces the global epoch while it walks a
+ * chain, the epoch only advances once every walking thread has seen it,
+ * and an object retired in epoch e is freed once the epoch reaches e + 2,
+ * by when no walk can still hold it.
+ *
+ * Eviction is least recently used within the shard, accounted in bytes of
+ * cached data against MAX_CACHE_SIZE / NSHARDS. Hits would contend on a
+ * clock bumped by every one of them, so the shard clock only ticks on
+ * inserts, and a hit stamps the object with it when the stamp is stale.
+ * An insert that needs room scans its shard for the oldest stamp.
+ */
+#include "csapp.h"
+#include "cache.h"
+
+#define NSHARDS 8
+#define NBUCKETS 256            /* per shard */
+#define SHARD_SIZE (MAX_CACHE_SIZE / NSHARDS)
+#define CACHE_LINE 64
+
+#if SHARD_SIZE < MAX_OBJECT_SIZE
+#error "a shard must have room for the largest object"
+#endif
+
+typedef struct {
+    pthread_mutex_t lock;               /* serializes inserts and evictions */
+    size_t bytes;                       /* bytes of data cached */
+    unsigned long clock;                /* bumped on every insert */
+    cache_obj_t *buckets[NBUCKETS];
+} shard_t;
+
+/* a thread's announcement of the epoch it is walking a chain in */
+typedef struct epoch_rec {
+    unsigned long epoch;
+    int active;                         /* walking a chain */
+    int in_use;                         /* owned by a live thread */
+    struct epoch_rec *next;
+} __attribute__((aligned(CACHE_LINE))) epoch_rec_t;
+
+/* an object waiting for the epoch to move on before it is freed */
+typedef struct retired {
+    cache_obj_t *obj;
+    unsigned long epoch;
+    struct retired *next;
+} retired_t;
+
+static shard_t shards[NSHARDS];
+
+static unsigned long global_epoch;
+static epoch_rec_t *epoch_recs;         /* never shrinks, records are reused */
+static __thread epoch_rec_t *my_rec;
+static pthread_key_t rec_key;           /* gives the record back at thread exit */
+static retired_t *retired;
+static pthread_mutex_t retired_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static unsigned int hash(const char *key);
+static void evict(shard_t *s);
+static void epoch_enter(void);
+static void epoch_exit(void);
+static void release_rec(void *rec);
+static void retire(cache_obj_t *obj);
+static void reclaim(void);
+
+/*
+ * cache_init - start with an empty cache. call it before any threads are
+ *   created.
+ */
+void cache_init(void) {
+    int i;
+
+    for (i = 0; i < NSHARDS; i++) {
+        pthread_mutex_init(&shards[i].lock, NULL);
+        shards[i].bytes = 0;
+        shards[i].clock = 0;
+        memset(shards[i].buckets, 0, sizeof(shards[i].buckets));
+    }
+    pthread_key_create(&rec_key, release_rec);
+}
+
+/*
+ * cache_key - build the cache key for a request from its parsed uri.
+ *   the host is case insensitive, so it is lowercased, and the port is
+ *   always spelled out, so `http://Host/x` and `http://host:80/x` share an
+ *   object. `key` must hold 3 * MAXLINE bytes.
+ */
+void cache_key(char *key, const char *host, const char *port, const char *path) {
+    char *p = key;
+
+    while (*host)
+        *p++ = tolower((unsigned char)*host++);
+    sprintf(p, ":%s%s", port, path);
+}
+
+/*
+ * cache_get - look up `key`, without locking. on a hit, returns the object
+ *   with a reference taken for the caller, who must drop it with cache_put.
+ *   returns NULL on a miss.
+ */
+cache_obj_t *cache_get(const char *key) {
+    unsigned int h = hash(key);
+    shard_t *s = &shards[h % NSHARDS];
+    cache_obj_t *obj;
+    int refs;
+
+    epoch_enter();
+    obj = __atomic_load_n(&s->buckets[h / NSHARDS % NBUCKETS], __ATOMIC_ACQUIRE);
+    for (; obj; obj = __atomic_load_n(&obj->next, __ATOMIC_ACQUIRE)) {
+        if (strcmp(obj->key, key))
+            continue;
+
+        /* an object whose last reference is gone is on its way out */
+        refs = __atomic_load_n(&obj->refcnt, __ATOMIC_RELAXED);
+        do {
+            if (refs == 0)
+                break;
+        } while (!__atomic_compare_exchange_n(&obj->refcnt, &refs, refs + 1,
+                    0, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED));
+        if (refs == 0)
+            obj = NULL;
+        break;
+    }
+
+    if (obj) {
+        unsigned long now = __atomic_load_n(&s->clock, __ATOMIC_RELAXED);
+        if (__atomic_load_n(&obj->stamp, __ATOMIC_RELAXED) != now)
+            __atomic_store_n(&obj->stamp, now, __ATOMIC_RELAXED);
+    }
+    epoch_exit();
+    return obj;
+}
+
+/*
+ * cache_put - drop a reference to `obj`, retiring it with the last one
+ */
+void cache_put(cache_obj_t *obj) {
+    if (__atomic_sub_fetch(&obj->refcnt, 1, __ATOMIC_ACQ_REL) == 0)
+        retire(obj);
+}
+
+/*
+ * cache_insert - cache a copy of the response `data` for `key`, evicting
+ *   the least recently used objects of its shard until it fits. objects
+ *   larger than MAX_OBJECT_SIZE are not cached. an object already cached
+ *   under the same key, fetched by a concurrent miss, is replaced.
+ */
+void cache_insert(const char *key, const char *data, size_t size) {
+    unsigned int h = hash(key);
+    shard_t *s = &shards[h % NSHARDS];
+    cache_obj_t *obj, **pp, **bucket = &s->buckets[h / NSHARDS % NBUCKETS];
+
+    if (size > MAX_OBJECT_SIZE)
+        return;
+
+    /* copy outside of the lock */
+    obj = Malloc(sizeof(cache_obj_t));
+    obj->key = Malloc(strlen(key) + 1);
+    strcpy(obj->key, key);
+    obj->data = Malloc(size);
+    memcpy(obj->data, data, size);
+    obj->size = size;
+    obj->refcnt = 1;
+
+    pthread_mutex_lock(&s->lock);
+    for (pp = bucket; *pp; pp = &(*pp)->next) {
+        if (!strcmp((*pp)->key, key)) {
+            cache_obj_t *old = *pp;
+            __atomic_store_n(pp, old->next, __ATOMIC_RELEASE);
+            s->bytes -= old->size;
+            cache_put(old);
+            break;
+        }
+    }
+    while (s->bytes + size > SHARD_SIZE)
+        evict(s);
+
+    obj->stamp = __atomic_add_fetch(&s->clock, 1, __ATOMIC_RELAXED);
+    obj->next = *bucket;
+    __atomic_store_n(bucket, obj, __ATOMIC_RELEASE);
+    s->bytes += size;
+    pthread_mutex_unlock(&s->lock);
+}
+
+/*
+ * evict - unlink the object of shard `s` with the oldest stamp. called with
+ *   the shard locked, on a shard that is not empty
+ */
+static void evict(shard_t *s) {
+    cache_obj_t **pp, **victim = NULL;
+    cache_obj_t *obj;
+    int b;
+
+    for (b = 0; b < NBUCKETS; b++) {
+        for (pp = &s->buckets[b]; *pp; pp = &(*pp)->next) {
+            if (!victim || __atomic_load_n(&(*pp)->stamp, __ATOMIC_RELAXED) <
+                    __atomic_load_n(&(*victim)->stamp, __ATOMIC_RELAXED))
+                victim = pp;
+        }
+    }
+
+    obj = *victim;
+    __atomic_store_n(victim, obj->next, __ATOMIC_RELEASE);
+    s->bytes -= obj->size;
+    cache_put(obj);
+}
+
+/*
+ * hash - FNV-1a hash of `key`. the low bits pick the shard, the rest the
+ *   bucket within it
+ */
+static unsigned int hash(const char *key) {
+    unsigned int h = 2166136261u;
+
+    while (*key) {
+        h ^= (unsigned char)*key++;
+        h *= 16777619u;
+    }
+    return h;
+}
+
+/*
+ * epoch_enter - announce that this thread is walking a chain, in the
+ *   current epoch. a thread's first call claims it a record, reusing one
+ *   given back by a thread that has exited if there is one
+ */
+static void epoch_enter(void) {
+    epoch_rec_t *rec = my_rec;
+
+    if (!rec) {
+        for (rec = __atomic_load_n(&epoch_recs, __ATOMIC_ACQUIRE); rec; rec = rec->next) {
+            int unused = 0;
+            if (__atomic_compare_exchange_n(&rec->in_use, &unused, 1, 0,
+                        __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+                break;
+        }
+        if (!rec) {
+            if (posix_memalign((void **)&rec, CACHE_LINE, sizeof(epoch_rec_t)))
+                unix_error("posix_memalign error");
+            rec->active = 0;
+            rec->in_use = 1;
+            rec->next = __atomic_load_n(&epoch_recs, __ATOMIC_RELAXED);
+            while (!__atomic_compare_exchange_n(&epoch_recs, &rec->next, rec, 0,
+                        __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+                ;
+        }
+        my_rec = rec;
+        pthread_setspecific(rec_key, rec);
+    }
+
+    /* the announcement must be visible before any object is loaded */
+    __atomic_store_n(&rec->epoch, __atomic_load_n(&global_epoch, __ATOMIC_RELAXED),
+            __ATOMIC_RELAXED);
+    __atomic_store_n(&rec->active, 1, __ATOMIC_SEQ_CST);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+}
+
+/*
+ * epoch_exit - announce that this thread is done with the objects it saw
+ */
+static void epoch_exit(void) {
+    __atomic_store_n(&my_rec->active, 0, __ATOMIC_RELEASE);
+}
+
+/*
+ * release_rec - give a thread's record back when it exits
+ */
+static void release_rec(void *rec) {
+    __atomic_store_n(&((epoch_rec_t *)rec)->in_use, 0, __ATOMIC_RELEASE);
+}
+
+/*
+ * retire - queue an object nobody holds a reference to for freeing, and
+ *   free whatever earlier retirements have become safe to
+ */
+static void retire(cache_obj_t *obj) {
+    retired_t *r = Malloc(sizeof(retired_t));
+
+    r->obj = obj;
+    pthread_mutex_lock(&retired_lock);
+    r->epoch = __atomic_load_n(&global_epoch, __ATOMIC_SEQ_CST);
+    r->next = retired;
+    retired = r;
+    reclaim();
+    pthread_mutex_unlock(&retired_lock);
+}
+
+/*
+ * reclaim - advance the epoch if every walking thread has seen the current
+ *   one, then free the objects retired two or more epochs ago. called with
+ *   retired_lock held
+ */
+static void reclaim(void) {
+    unsigned long epoch = __atomic_load_n(&global_epoch, __ATOMIC_SEQ_CST);
+    epoch_rec_t *rec;
+    retired_t **rp, *r;
+
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    for (rec = __atomic_load_n(&epoch_recs, __ATOMIC_ACQUIRE); rec; rec = rec->next) {
+        if (__atomic_load_n(&rec->active, __ATOMIC_SEQ_CST) &&
+                __atomic_load_n(&rec->epoch, __ATOMIC_SEQ_CST) != epoch)
+            break;
+    }
+    if (!rec)
+        __atomic_store_n(&global_epoch, ++epoch, __ATOMIC_SEQ_CST);
+
+    for (rp = &retired; (r = *rp); ) {
+        if (r->epoch + 2 <= epoch) {
+            *rp = r->next;
+            free(r->obj->key);
+            free(r->obj->data);
+            free(r->obj);
+            free(r);
+        } else {
+            rp = &r->next;
+        }
+    }
+}
@@ -0,0 +1,34 @@
+/*
+ * cache.h - in-memory web object cache for the proxy
+ */
+#ifndef __CACHE_H__
+#define __CACHE_H__
+
+#include <stddef.h>
+
+/* Recommended max cache and object sizes */
+#define MAX_CACHE_SIZE 1049000
+#define MAX_OBJECT_SIZE 102400
+
+/*
+ * a cached response, headers and body, exactly as the origin sent it.
+ * objects are reference counted: cache_get hands out a reference that the
+ * caller returns with cache_put, so an object evicted while a client is
+ * still being sent it stays alive until the send is done.
+ */
+typedef struct cache_obj {
+    char *key;                  /* normalized uri, see cache_key */
+    char *data;                 /* the response */
+    size_t size;                /* bytes in data */
+    int refcnt;                 /* references, the cache holds one */
+    unsigned long stamp;        /* lru clock at the last hit */
+    struct cache_obj *next;     /* next object in the hash bucket */
+} cache_obj_t;
+
+void cache_init(void);
+void cache_key(char *key, const char *host, const char *port, const char *path);
+cache_obj_t *cache_get(const char *key);
+void cache_put(cache_obj_t *obj);
+void cache_insert(const char *key, const char *data, size_t size);
+
+#endif /* __CACHE_H__ */
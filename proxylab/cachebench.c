@@ -0,0 +1,219 @@
+/*
+ * cachebench.c - hit throughput of the proxy cache against thread count
+ *
+ * Fills the cache with objects and has 1, 2, 4, ... threads look up
+ * random ones of them for a fixed time, touching the data of every hit as
+ * the proxy's send would. Reports hits per second and the speedup over a
+ * single thread. Optionally a share of the operations are inserts, which
+ * replace the object under a random key, so that lookups run concurrently
+ * with evictions and reclamation; and optionally every lookup is done
+ * under one global reader-writer lock, as in a cache with a single lock,
+ * for comparison.
+ *
+ * usage: cachebench [-h] [-l] [-t <threads>] [-s <secs>] [-n <objects>]
+ *                   [-o <bytes>] [-w <inserts per 1000>]
+ */
+#include "csapp.h"
+#include "cache.h"
+
+#define DEFAULT_THREADS 16
+#define DEFAULT_SECS 1.0
+#define DEFAULT_OBJECTS 100
+#define DEFAULT_OBJSIZE 4096
+
+typedef struct {
+    pthread_t tid;
+    unsigned long long seed;
+    unsigned long hits, misses;
+    long sum;
+} worker_t;
+
+static int nobjects = DEFAULT_OBJECTS;
+static int objsize = DEFAULT_OBJSIZE;
+static int inserts = 0;                 /* per 1000 operations */
+static int global_lock = 0;
+static char *data;
+static int stop;
+static pthread_rwlock_t lock = PTHREAD_RWLOCK_INITIALIZER;
+
+static void *worker(void *vargp);
+static double run(int nthreads, double secs, double *miss_rate);
+static void make_key(char *key, int i);
+static unsigned long long next_rand(unsigned long long *state);
+static double now(void);
+static void usage(void);
+
+int main(int argc, char **argv) {
+    int max_threads = DEFAULT_THREADS;
+    double secs = DEFAULT_SECS;
+    double base = 0, hits, miss_rate;
+    char key[MAXLINE];
+    int c, i, t;
+
+    while ((c = getopt(argc, argv, "hlt:s:n:o:w:")) != EOF) {
+        switch (c) {
+        case 'l':
+            global_lock = 1;
+            break;
+        case 't':
+            max_threads = atoi(optarg);
+            break;
+        case 's':
+            secs = atof(optarg);
+            break;
+        case 'n':
+            nobjects = atoi(optarg);
+            break;
+        case 'o':
+            objsize = atoi(optarg);
+            break;
+        case 'w':
+            inserts = atoi(optarg);
+            break;
+        case 'h':
+            usage();
+            return 0;
+        default:
+            usage();
+            return 1;
+        }
+    }
+    if (max_threads < 1 || secs <= 0 || nobjects < 1 || objsize < 1 ||
+            objsize > MAX_OBJECT_SIZE || inserts < 0 || inserts > 1000) {
+        usage();
+        return 1;
+    }
+
+    cache_init();
+    data = Malloc(objsize);
+    memset(data, 'x', objsize);
+    for (i = 0; i < nobjects; i++) {
+        make_key(key, i);
+        cache_insert(key, data, objsize);
+    }
+
+    printf("%d objects of %d bytes, %d inserts per 1000 ops, %s lookups\n",
+            nobjects, objsize, inserts, global_lock ? "locked" : "lock-free");
+    printf("%8s %14s %9s %10s\n", "threads", "hits/s", "speedup", "miss rate");
+    for (t = 1; t <= max_threads; t *= 2) {
+        hits = run(t, secs, &miss_rate);
+        if (t == 1)
+            base = hits;
+        printf("%8d %14.0f %8.2fx %9.2f%%\n", t, hits, hits / base, 100 * miss_rate);
+    }
+    return 0;
+}
+
+/*
+ * run - run `nthreads` workers for `secs` seconds, and return the hits
+ *   per second they achieved together
+ */
+static double run(int nthreads, double secs, double *miss_rate) {
+    worker_t *workers = Calloc(nthreads, sizeof(worker_t));
+    unsigned long hits = 0, misses = 0;
+    double start, elapsed;
+    int i;
+
+    __atomic_store_n(&stop, 0, __ATOMIC_RELAXED);
+    start = now();
+    for (i = 0; i < nthreads; i++) {
+        workers[i].seed = 0x9e3779b97f4a7c15ULL * (i + 1);
+        Pthread_create(&workers[i].tid, NULL, worker, &workers[i]);
+    }
+    while (now() - start < secs)
+        usleep(10000);
+    __atomic_store_n(&stop, 1, __ATOMIC_RELAXED);
+    for (i = 0; i < nthreads; i++) {
+        Pthread_join(workers[i].tid, NULL);
+        hits += workers[i].hits;
+        misses += workers[i].misses;
+    }
+    elapsed = now() - start;
+
+    free(workers);
+    *miss_rate = hits + misses ? (double)misses / (hits + misses) : 0;
+    return hits / elapsed;
+}
+
+/*
+ * worker - look up, or insert, objects under random keys until told to stop
+ */
+static void *worker(void *vargp) {
+    worker_t *w = vargp;
+    char key[MAXLINE];
+    cache_obj_t *obj;
+    unsigned long long r;
+
+    while (!__atomic_load_n(&stop, __ATOMIC_RELAXED)) {
+        r = next_rand(&w->seed);
+        make_key(key, (r >> 16) % nobjects);
+
+        if ((int)(r % 1000) < inserts) {
+            cache_insert(key, data, objsize);
+            continue;
+        }
+
+        if (global_lock)
+            pthread_rwlock_rdlock(&lock);
+        obj = cache_get(key);
+        if (global_lock)
+            pthread_rwlock_unlock(&lock);
+
+        if (!obj) {
+            w->misses++;
+            continue;
+        }
+        w->sum += obj->data[0] + obj->data[obj->size - 1];
+        cache_put(obj);
+        w->hits++;
+    }
+    return NULL;
+}
+
+/*
+ * make_key - the key of object `i`, as the proxy would build it
+ */
+static void make_key(char *key, int i) {
+    char path[MAXLINE];
+
+    sprintf(path, "/objects/%d.html", i);
+    cache_key(key, "localhost", "80", path);
+}
+
+/*
+ * next_rand - xorshift64* step
+ */
+static unsigned long long next_rand(unsigned long long *state) {
+    unsigned long long x = *state;
+
+    x ^= x >> 12;
+    x ^= x << 25;
+    x ^= x >> 27;
+    *state = x;
+    return x * 2685821657736338717ULL;
+}
+
+/*
+ * now - the time in seconds
+ */
+static double now(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/*
+ * usage - explain the command line arguments
+ */
+static void usage(void) {
+    fprintf(stderr, "usage: cachebench [-h] [-l] [-t <threads>] [-s <secs>] [-n <objects>]\n");
+    fprintf(stderr, "                  [-o <bytes>] [-w <inserts per 1000>]\n");
+    fprintf(stderr, "\t-h              Print this message.\n");
+    fprintf(stderr, "\t-l              Take a global lock around every lookup.\n");
+    fprintf(stderr, "\t-n <objects>    Objects cached (default %d).\n", DEFAULT_OBJECTS);
+    fprintf(stderr, "\t-o <bytes>      Bytes per object (default %d).\n", DEFAULT_OBJSIZE);
+    fprintf(stderr, "\t-s <secs>       Seconds per thread count (default %.1f).\n", DEFAULT_SECS);
+    fprintf(stderr, "\t-t <threads>    Most threads, doubling from 1 (default %d).\n", DEFAULT_THREADS);
+    fprintf(stderr, "\t-w <n>          Inserts per 1000 operations (default 0).\n");
+}
@@ -0,0 +1,570 @@
+/*
+ * event.c - event-driven mode of the proxy
+ *
+ * Instead of a thread per connection, a few threads, one per core by
+ * default, each run an epoll loop over non-blocking sockets. Every
+ * connection is a small state machine, advanced whenever the socket it is
+ * waiting on becomes ready:
+ *
+ *   READ_REQUEST    read the client's request, up to the empty line
+ *   CONNECT         connect to the origin server, without blocking
+ *   SEND_REQUEST    send the rewritten request to the origin
+ *   RELAY_HEADERS   relay the response up to the end of its headers
+ *   RELAY_BODY      relay the rest, up to Content-Length bytes or EOF
+ *   SEND_CACHED     send a cached response instead of the three above
+ *
+ * A connection waits on one of its sockets at a time: a relayed chunk is
+ * written to the client before the next one is read from the origin, so a
+ * slow client holds back the origin instead of piling up memory. An idle
+ * connection costs a conn_t and its buffer rather than a thread, so a
+ * loop can hold tens of thousands of them.
+ *
+ * All loops share the listening socket, registered with EPOLLEXCLUSIVE so
+ * that a new connection wakes only one of them. Host names are still
+ * resolved with a blocking getaddrinfo, which is quick for the numeric
+ * and local names the proxy is tested with.
+ */
+#include "csapp.h"
+#include "cache.h"
+#include "proxy.h"
+#include <sys/epoll.h>
+#include <sys/resource.h>
+
+#define MAX_EVENTS 256                  /* events taken per epoll_wait */
+#define CONN_BUFSIZE (MAXLINE + 512)    /* a request, rewritten */
+
+typedef enum {
+    READ_REQUEST, CONNECT, SEND_REQUEST, RELAY_HEADERS, RELAY_BODY, SEND_CACHED
+} conn_state_t;
+
+/* what a step of the state machine left the connection doing */
+enum { STEP_NEXT, STEP_WAIT, STEP_DONE };
+
+typedef struct {
+    conn_state_t state;
+    int epfd;                           /* the loop's epoll instance */
+    int clientfd, serverfd;             /* serverfd is -1 until connecting */
+    unsigned int client_events;         /* registered with epoll */
+    unsigned int server_events;
+    char buf[CONN_BUFSIZE];             /* the request, then relayed data */
+    size_t len, off;                    /* bytes in buf, bytes written */
+    char *key;                          /* cache key of a GET request */
+    struct addrinfo *addrs, *addr;      /* the origin's, the one tried */
+    int status;                         /* of the response */
+    long body_left;                     /* bytes of body to go, -1 to EOF */
+    char *resp;                         /* the response, collected to cache */
+    size_t resp_size, resp_cap;
+    cache_obj_t *obj;                   /* the cached response being sent */
+} conn_t;
+
+static void *loop_thread(void *vargp);
+static void event_loop(int listenfd);
+static void accept_conns(int epfd, int listenfd);
+static void conn_step(conn_t *c);
+static void conn_close(conn_t *c);
+static void wait_for(conn_t *c, int fd, unsigned int events);
+static void watch(conn_t *c, int fd, unsigned int events);
+static int read_request(conn_t *c);
+static int start_request(conn_t *c, size_t hdr_len);
+static int connect_server(conn_t *c);
+static int send_request(conn_t *c);
+static int relay_response(conn_t *c);
+static void parse_response(conn_t *c);
+static void collect(conn_t *c, char *data, size_t n);
+static int send_cached(conn_t *c);
+static char *find_hdr_end(char *buf, size_t len);
+
+/*
+ * run_event_loops - serve connections on `listenfd` from `nloops` event
+ *   loops, one per core if `nloops` is 0. never returns.
+ */
+void run_event_loops(int listenfd, int nloops) {
+    struct rlimit rl;
+    pthread_t tid;
+    int i;
+
+    if (nloops <= 0)
+        nloops = sysconf(_SC_NPROCESSORS_ONLN);
+
+    /* every connection takes a descriptor, two while it is relayed */
+    if (getrlimit(RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur < rl.rlim_max) {
+        rl.rlim_cur = rl.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &rl);
+    }
+
+    if (fcntl(listenfd, F_SETFL, fcntl(listenfd, F_GETFL) | O_NONBLOCK) < 0)
+        unix_error("fcntl error");
+
+    for (i = 1; i < nloops; i++)
+        Pthread_create(&tid, NULL, loop_thread, (void *)(long)listenfd);
+    event_loop(listenfd);
+}
+
+/*
+ * loop_thread - run an event loop in a thread of its own
+ */
+static void *loop_thread(void *vargp) {
+    Pthread_detach(Pthread_self());
+    event_loop((int)(long)vargp);
+    return NULL;
+}
+
+/*
+ * event_loop - wait for sockets to become ready and step their
+ *   connections. a connection only ever has one socket registered, so it
+ *   gets at most one event per epoll_wait, and closing it can't leave a
+ *   stale event behind
+ */
+static void event_loop(int listenfd) {
+    struct epoll_event ev, events[MAX_EVENTS];
+    int epfd, n, i;
+
+    if ((epfd = epoll_create1(0)) < 0)
+        unix_error("epoll_create1 error");
+
+    ev.events = EPOLLIN | EPOLLEXCLUSIVE;
+    ev.data.ptr = NULL;
+    if (epoll_ctl(epfd, EPOLL_CTL_ADD, listenfd, &ev) < 0)
+        unix_error("epoll_ctl error");
+
+    while (1) {
+        if ((n = epoll_wait(epfd, events, MAX_EVENTS, -1)) < 0) {
+            if (errno == EINTR)
+                continue;
+            unix_error("epoll_wait error");
+        }
+        for (i = 0; i < n; i++) {
+            if (events[i].data.ptr == NULL)
+                accept_conns(epfd, listenfd);
+            else
+                conn_step(events[i].data.ptr);
+        }
+    }
+}
+
+/*
+ * accept_conns - accept every pending connection, and wait for each to
+ *   send its request
+ */
+static void accept_conns(int epfd, int listenfd) {
+    conn_t *c;
+    int fd;
+
+    while (1) {
+        if ((fd = accept(listenfd, NULL, NULL)) < 0) {
+            if (errno == EINTR || errno == ECONNABORTED)
+                continue;
+            if (errno != EAGAIN)
+                fprintf(stderr, "accept error: %s\n", strerror(errno));
+            return;
+        }
+        if (fcntl(fd, F_SETFL, O_NONBLOCK) < 0) {
+            close(fd);
+            continue;
+        }
+
+        c = Malloc(sizeof(conn_t));
+        c->state = READ_REQUEST;
+        c->epfd = epfd;
+        c->clientfd = fd;
+        c->serverfd = -1;
+        c->client_events = c->server_events = 0;
+        c->len = c->off = 0;
+        c->key = NULL;
+        c->addrs = c->addr = NULL;
+        c->resp = NULL;
+        c->resp_size = c->resp_cap = 0;
+        c->obj = NULL;
+        wait_for(c, fd, EPOLLIN);
+    }
+}
+
+/*
+ * conn_step - advance connection `c` as far as it goes without blocking
+ */
+static void conn_step(conn_t *c) {
+    int r = STEP_DONE;
+
+    do {
+        switch (c->state) {
+        case READ_REQUEST:
+            r = read_request(c);
+            break;
+        case CONNECT:
+            r = connect_server(c);
+            break;
+        case SEND_REQUEST:
+            r = send_request(c);
+            break;
+        case RELAY_HEADERS:
+        case RELAY_BODY:
+            r = relay_response(c);
+            break;
+        case SEND_CACHED:
+            r = send_cached(c);
+            break;
+        }
+    } while (r == STEP_NEXT);
+
+    if (r == STEP_DONE)
+        conn_close(c);
+}
+
+/*
+ * conn_close - close connection `c`'s sockets, which also takes them off
+ *   the epoll instance, and free it
+ */
+static void conn_close(conn_t *c) {
+    close(c->clientfd);
+    if (c->serverfd >= 0)
+        close(c->serverfd);
+    if (c->addrs)
+        freeaddrinfo(c->addrs);
+    if (c->obj)
+        cache_put(c->obj);
+    free(c->key);
+    free(c->resp);
+    free(c);
+}
+
+/*
+ * wait_for - make `fd`, one of `c`'s sockets, the one it waits on, for
+ *   `events`
+ */
+static void wait_for(conn_t *c, int fd, unsigned int events) {
+    if (fd == c->clientfd) {
+        if (c->serverfd >= 0)
+            watch(c, c->serverfd, 0);
+    } else {
+        watch(c, c->clientfd, 0);
+    }
+    watch(c, fd, events);
+}
+
+/*
+ * watch - register `events` for `fd`, one of `c`'s sockets, with the
+ *   loop's epoll instance, or take it off with no events
+ */
+static void watch(conn_t *c, int fd, unsigned int events) {
+    unsigned int *cur = fd == c->clientfd ? &c->client_events : &c->server_events;
+    struct epoll_event ev;
+    int op;
+
+    if (*cur == events)
+        return;
+    op = !*cur ? EPOLL_CTL_ADD : !events ? EPOLL_CTL_DEL : EPOLL_CTL_MOD;
+    ev.events = events;
+    ev.data.ptr = c;
+    if (epoll_ctl(c->epfd, op, fd, &ev) < 0)
+        unix_error("epoll_ctl error");
+    *cur = events;
+}
+
+/*
+ * read_request - read the client's request line and headers. requests
+ *   longer than MAXLINE are dropped
+ */
+static int read_request(conn_t *c) {
+    char *end;
+    ssize_t n;
+
+    while (!(end = find_hdr_end(c->buf, c->len))) {
+        if (c->len == MAXLINE)
+            return STEP_DONE;
+        if ((n = read(c->clientfd, c->buf + c->len, MAXLINE - c->len)) < 0) {
+            if (errno == EINTR)
+                continue;
+            if (errno == EAGAIN) {
+                wait_for(c, c->clientfd, EPOLLIN);
+                return STEP_WAIT;
+            }
+        }
+        if (n <= 0)
+            return STEP_DONE;
+        c->len += n;
+    }
+    return start_request(c, end + 4 - c->buf);
+}
+
+/*
+ * start_request - answer the request in the first `hdr_len` bytes of
+ *   c->buf from the cache, or rewrite it for the origin server and look
+ *   the server up
+ */
+static int start_request(conn_t *c, size_t hdr_len) {
+    char method[MAXLINE], uri[MAXLINE], version[MAXLINE];
+    char host[MAXLINE] = "", port[10] = "80", path[MAXLINE];
+    char key[3 * MAXLINE], out[CONN_BUFSIZE];
+    struct addrinfo hints;
+    char *line, *eol, *colon;
+    int n, len;
+
+    c->buf[hdr_len] = '\0';
+    if (sscanf(c->buf, "%s %s %s", method, uri, version) != 3 ||
+            parse_uri(uri, host, port, path))
+        return STEP_DONE;
+
+    /* the cached object, if any, is the complete response */
+    if (!strcasecmp(method, "GET")) {
+        cache_key(key, host, port, path);
+        if ((c->obj = cache_get(key))) {
+            c->off = 0;
+            c->state = SEND_CACHED;
+            return STEP_NEXT;
+        }
+        c->key = Malloc(strlen(key) + 1);
+        strcpy(c->key, key);
+    }
+
+    /* the request line and our headers, then the client's extra headers */
+    if ((len = request_hdrs(out, sizeof(out), method, host, path)) < 0)
+        return STEP_DONE;
+    line = strstr(c->buf, "\r\n") + 2;
+    for (; (eol = strstr(line, "\r\n")) != line; line = eol + 2) {
+        colon = memchr(line, ':', eol - line);
+        if (colon && is_extra_header(line, colon - line)) {
+            n = eol + 2 - line;
+            if (len + n > (int)sizeof(out) - 2)
+                return STEP_DONE;
+            memcpy(out + len, line, n);
+            len += n;
+        }
+    }
+    memcpy(out + len, "\r\n", 2);
+    memcpy(c->buf, out, len + 2);
+    c->len = len + 2;
+    c->off = 0;
+
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = AI_NUMERICSERV | AI_ADDRCONFIG;
+    if (getaddrinfo(host, port, &hints, &c->addrs))
+        return STEP_DONE;
+    c->addr = c->addrs;
+    c->state = CONNECT;
+    return STEP_NEXT;
+}
+
+/*
+ * connect_server - connect to the origin server without blocking, trying
+ *   its addresses in turn. called again once a connect in progress has
+ *   finished, one way or the other
+ */
+static int connect_server(conn_t *c) {
+    struct addrinfo *ai;
+    socklen_t errlen = sizeof(int);
+    int err = 0;
+
+    if (c->serverfd >= 0) {
+        if (getsockopt(c->serverfd, SOL_SOCKET, SO_ERROR, &err, &errlen) < 0)
+            err = errno;
+        if (!err)
+            goto connected;
+        close(c->serverfd);
+        c->serverfd = -1;
+        c->server_events = 0;
+        c->addr = c->addr->ai_next;
+    }
+
+    for (; (ai = c->addr); c->addr = ai->ai_next) {
+        c->serverfd = socket(ai->ai_family, ai->ai_socktype | SOCK_NONBLOCK,
+                ai->ai_protocol);
+        if (c->serverfd < 0)
+            continue;
+        if (connect(c->serverfd, ai->ai_addr, ai->ai_addrlen) == 0)
+            goto connected;
+        if (errno == EINPROGRESS) {
+            wait_for(c, c->serverfd, EPOLLOUT);
+            return STEP_WAIT;
+        }
+        close(c->serverfd);
+        c->serverfd = -1;
+    }
+    return STEP_DONE;
+
+connected:
+    freeaddrinfo(c->addrs);
+    c->addrs = c->addr = NULL;
+    c->state = SEND_REQUEST;
+    return STEP_NEXT;
+}
+
+/*
+ * send_request - send the rewritten request in c->buf to the origin server
+ */
+static int send_request(conn_t *c) {
+    ssize_t n;
+
+    while (c->off < c->len) {
+        if ((n = write(c->serverfd, c->buf + c->off, c->len - c->off)) < 0) {
+            if (errno == EINTR)
+                continue;
+            if (errno == EAGAIN) {
+                wait_for(c, c->serverfd, EPOLLOUT);
+                return STEP_WAIT;
+            }
+            return STEP_DONE;
+        }
+        c->off += n;
+    }
+
+    c->len = c->off = 0;
+    c->status = 0;
+    c->body_left = -1;
+    c->state = RELAY_HEADERS;
+    return STEP_NEXT;
+}
+
+/*
+ * relay_response - relay the response from the origin server to the
+ *   client a buffer at a time, each written out before the next is read.
+ *   the response to a GET is collected as it goes, and cached once it is
+ *   complete if it is a 200 and fits
+ */
+static int relay_response(conn_t *c) {
+    ssize_t n;
+
+    while (1) {
+        while (c->off < c->len) {
+            if ((n = write(c->clientfd, c->buf + c->off, c->len - c->off)) < 0) {
+                if (errno == EINTR)
+                    continue;
+                if (errno == EAGAIN) {
+                    wait_for(c, c->clientfd, EPOLLOUT);
+                    return STEP_WAIT;
+                }
+                return STEP_DONE;
+            }
+            c->off += n;
+        }
+        if (c->state == RELAY_BODY && c->body_left == 0)
+            break;
+
+        if ((n = read(c->serverfd, c->buf, CONN_BUFSIZE)) < 0) {
+            if (errno == EINTR)
+                continue;
+            if (errno == EAGAIN) {
+                wait_for(c, c->serverfd, EPOLLIN);
+                return STEP_WAIT;
+            }
+            return STEP_DONE;
+        }
+
+        /* the origin closed: complete unless a Content-Length says not */
+        if (n == 0) {
+            if (c->state == RELAY_BODY && c->body_left < 0)
+                break;
+            return STEP_DONE;
+        }
+
+        c->len = n;
+        c->off = 0;
+        collect(c, c->buf, n);
+        if (c->state == RELAY_HEADERS)
+            parse_response(c);
+        else if (c->body_left > 0)
+            c->body_left = c->body_left > n ? c->body_left - n : 0;
+    }
+
+    if (c->key && c->status == 200 && c->resp && c->resp_size <= MAX_OBJECT_SIZE)
+        cache_insert(c->key, c->resp, c->resp_size);
+    return STEP_DONE;
+}
+
+/*
+ * parse_response - once the collected response holds all of the headers,
+ *   take the status and Content-Length from them and move on to the body.
+ *   headers too long to collect leave the body to be relayed up to EOF
+ */
+static void parse_response(conn_t *c) {
+    char *end, *line;
+    long content_length = -1;
+    size_t body;
+
+    if (!c->resp) {
+        c->state = RELAY_BODY;
+        return;
+    }
+    if (!(end = find_hdr_end(c->resp, c->resp_size)))
+        return;
+
+    sscanf(c->resp, "%*s %d", &c->status);
+    for (line = c->resp; line < end; line = strstr(line, "\r\n") + 2) {
+        if (!strncasecmp(line, "Content-Length:", 15))
+            content_length = atol(line + 15);
+    }
+
+    body = c->resp + c->resp_size - (end + 4);
+    if (content_length >= 0)
+        c->body_left = content_length > (long)body ? content_length - body : 0;
+
+    /* only responses to GET are collected beyond the headers */
+    if (!c->key) {
+        free(c->resp);
+        c->resp = NULL;
+    }
+    c->state = RELAY_BODY;
+}
+
+/*
+ * collect - append `n` bytes of the response to c->resp, growing it up to
+ *   MAX_OBJECT_SIZE. once the response outgrows that it is dropped, and
+ *   so is a response to anything but GET once its headers are in
+ */
+static void collect(conn_t *c, char *data, size_t n) {
+    if (c->state == RELAY_BODY && !c->resp)
+        return;
+
+    if (c->resp_size + n > MAX_OBJECT_SIZE) {
+        free(c->resp);
+        c->resp = NULL;
+        c->resp_size = MAX_OBJECT_SIZE + 1;
+        return;
+    }
+    if (c->resp_size + n > c->resp_cap) {
+        c->resp_cap = c->resp_cap ? 2 * c->resp_cap : CONN_BUFSIZE;
+        while (c->resp_cap < c->resp_size + n)
+            c->resp_cap *= 2;
+        if (c->resp_cap > MAX_OBJECT_SIZE)
+            c->resp_cap = MAX_OBJECT_SIZE;
+        c->resp = Realloc(c->resp, c->resp_cap + 1);
+    }
+    memcpy(c->resp + c->resp_size, data, n);
+    c->resp_size += n;
+    c->resp[c->resp_size] = '\0';
+}
+
+/*
+ * send_cached - send the cached response c->obj to the client
+ */
+static int send_cached(conn_t *c) {
+    ssize_t n;
+
+    while (c->off < c->obj->size) {
+        if ((n = write(c->clientfd, c->obj->data + c->off, c->obj->size - c->off)) < 0) {
+            if (errno == EINTR)
+                continue;
+            if (errno == EAGAIN) {
+                wait_for(c, c->clientfd, EPOLLOUT);
+                return STEP_WAIT;
+            }
+            return STEP_DONE;
+        }
+        c->off += n;
+    }
+    return STEP_DONE;
+}
+
+/*
+ * find_hdr_end - return where the empty line that ends the headers in the
+ *   first `len` bytes of `buf` starts, or NULL if they don't hold it yet
+ */
+static char *find_hdr_end(char *buf, size_t len) {
+    size_t i;
+
+    for (i = 0; i + 4 <= len; i++) {
+        if (buf[i] == '\r' && !memcmp(buf + i, "\r\n\r\n", 4))
+            return buf + i;
+    }
+    return NULL;
+}
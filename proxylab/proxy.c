@@ -1,47 +1,81 @@
 #include <stdio.h>
 #include "csapp.h"
+#include "cache.h"
+#include "sbuf.h"
+#include "proxy.h"
 
-/* Recommended max cache and object sizes */
-#define MAX_CACHE_SIZE 1049000
-#define MAX_OBJECT_SIZE 102400
+#define NTHREADS 16     /* default worker threads */
+#define SBUFSIZE 64     /* default connections waiting for a worker */
 
 /* You won't lose style points for including this long line in your code */
 static const char *user_agent_hdr = "User-Agent: Mozilla/5.0 (X11; Linux x86_64; rv:10.0.3) Gecko/20120305 Firefox/10.0.3\r\n";
 
+/* accepted connections waiting for a worker thread */
+static sbuf_t sbuf;
+
 void *thread(void* vargp);
 void handle_connection(int connfd);
-int parse_uri(char *uri, char *host, char *port, char *path);
-void handle_request(rio_t *conn_rio, rio_t *client_rio, int clientfd, int connfd, char *method, char *host, char *path);
-int is_extra_header(char *str, int length);
+void reject_connection(int connfd);
+void handle_request(rio_t *conn_rio, rio_t *client_rio, int clientfd, int connfd, char *method, char *host, char *path, char *key);
+void relay(int connfd, char *buf, size_t n, char *obj, size_t *obj_size);
+void read_requesthdrs(rio_t *rp);
 
 int main(int argc, char **argv) {
     /* ignore SIGPIPE signals */
     signal(SIGPIPE, SIG_IGN);
 
-    int listenfd;
+    int listenfd, connfd, opt;
+    int nthreads = NTHREADS, nslots = SBUFSIZE, nloops = -1;
     char hostname[MAXLINE], port[MAXLINE];
     socklen_t clientlen;
     pthread_t tid;
     struct sockaddr_storage clientaddr;
 
-    if (argc != 2) {
-        fprintf(stderr, "usage: %s <port>\n", argv[0]);
+    while ((opt = getopt(argc, argv, "t:q:e:")) != -1) {
+        switch (opt) {
+        case 't':
+            nthreads = atoi(optarg);
+            break;
+        case 'q':
+            nslots = atoi(optarg);
+            break;
+        case 'e':
+            nloops = atoi(optarg);
+            break;
+        default:
+            nthreads = 0;
+            break;
+        }
+    }
+    if (optind != argc - 1 || nthreads <= 0 || nslots <= 0) {
+        fprintf(stderr, "usage: %s [-t <threads>] [-q <queue slots>] [-e <loops>] <port>\n", argv[0]);
         return 1;
     }
 
+    cache_init();
+
     /* open a listen file descriptor on <port> */
 
-    listenfd = Open_listenfd(argv[1]);
+    listenfd = Open_listenfd(argv[optind]);
+
+    /* event-driven mode: `nloops` epoll loops, 0 for one per core */
+    if (nloops >= 0)
+        run_event_loops(listenfd, nloops);
+
+    /* prethread the workers; they wait on the empty buffer */
+    sbuf_init(&sbuf, nslots);
+    for (int i = 0; i < nthreads; i++)
+        Pthread_create(&tid, NULL, thread, NULL);
+
     while (1) {
         clientlen = sizeof(clientaddr);
-
-        int *connfdp = malloc(sizeof(int));
-        /* connfdp stores a pointer to the connected file descriptor */
-        *connfdp = Accept(listenfd, (SA *)&clientaddr, &clientlen);
+        connfd = Accept(listenfd, (SA *)&clientaddr, &clientlen);
         Getnameinfo((SA *)&clientaddr, clientlen, hostname, MAXLINE, port, MAXLINE, 0);
         printf("Accepted connection from (%s, %s)\n", hostname, port);
 
-        Pthread_create(&tid, NULL, thread, connfdp);
+        /* every worker is busy and the buffer is full: shed the load */
+        if (!sbuf_tryinsert(&sbuf, connfd))
+            reject_connection(connfd);
     }
 
     Close(listenfd);
@@ -49,25 +83,43 @@ int main(int argc, char **argv) {
 }
 
 /*
- * thread - spawn thread to handle connected file descriptor requests
- *   a pointer to an integer(connected file descriptor) is passed as an argument.
- *   this function calls `handle_connection` with the given argument.
- *   this thread runs in detached mode, so that it will clean itself up.
- *   the passed pointer is dynamically allocated, so we free it with the fd before returning.
+ * thread - worker thread of the pool. takes connected file descriptors off
+ *   the shared buffer, one at a time, and calls `handle_connection` with
+ *   each. this thread runs in detached mode and never returns.
  */
 void *thread(void* vargp) {
-    int connfd = *(int *)(vargp);
     Pthread_detach(Pthread_self());
-    free(vargp);
-    handle_connection(connfd);
-    Close(connfd);
+    while (1) {
+        int connfd = sbuf_remove(&sbuf);
+        handle_connection(connfd);
+        Close(connfd);
+    }
     return NULL;
 }
 
+/*
+ * reject_connection - answer a connection that no worker can take with
+ *   503 Service Unavailable, without reading its request, and close it.
+ *   the response is small enough for the socket buffer of a new
+ *   connection, so this doesn't block the accepting thread.
+ */
+void reject_connection(int connfd) {
+    static const char *response = "HTTP/1.0 503 Service Unavailable\r\n"
+        "Retry-After: 1\r\n"
+        "Content-Length: 0\r\n"
+        "Connection: close\r\n\r\n";
+
+    printf("Rejected connection, %d connections queued\n", sbuf.n);
+    rio_writen(connfd, (void *)response, strlen(response));
+    Close(connfd);
+}
+
 /*
  * handle_connection - receive requests from the connected file descriptor,
  *   then pass it to the host. After that, receive responses from the host and
  *   pass it to the connected file descriptor.
+ *   GET requests for objects in the cache are answered from it, without
+ *   contacting the host.
  */
 void handle_connection(int connfd) {
     rio_t rio;
@@ -85,10 +137,25 @@ void handle_connection(int connfd) {
     sscanf(buf, "%s %s %s", method, uri, version);
 
     /* port is at most 16 bits */
-    char host[MAXLINE], port[10], path[MAXLINE];
-    parse_uri(uri, host, port, path);
+    char host[MAXLINE] = "", port[10] = "80", path[MAXLINE];
+    if (parse_uri(uri, host, port, path))
+        return;
     printf("host: %s\tport: %s\tpath: %s\n", host, port, path);
 
+    /* the cached object, if any, is the complete response */
+    char key[3 * MAXLINE];
+    cache_key(key, host, port, path);
+    if (!strcasecmp(method, "GET")) {
+        cache_obj_t *obj = cache_get(key);
+        if (obj) {
+            printf("cache hit: %s\n", key);
+            read_requesthdrs(&rio);
+            Rio_writen(connfd, obj->data, obj->size);
+            cache_put(obj);
+            return;
+        }
+    }
+
     /* at this point, `host`, `port` and `path` are filled in */
     /* open new file descriptor */
 
@@ -99,7 +166,7 @@ void handle_connection(int connfd) {
     rio_t client_rio;
     Rio_readinitb(&client_rio, clientfd);
 
-    handle_request(&rio, &client_rio, clientfd, connfd, method, host, path);
+    handle_request(&rio, &client_rio, clientfd, connfd, method, host, path, key);
     Close(clientfd);
 }
 
@@ -127,6 +194,7 @@ int parse_uri(char *uri, char *host, char *port, char *path) {
 
         // copy until just before the colon
         strncpy(host, uri, port_ptr - uri);
+        host[port_ptr - uri] = '\0';
     }
 
     sprintf(port, "%d", port_num);
@@ -159,29 +227,19 @@ int parse_uri(char *uri, char *host, char *port, char *path) {
 
 /*
  * handle_request - pass client headers to host and send a request. then, pass the response back to the client
+ *   and cache it under `key`
  */
-void handle_request(rio_t *conn_io, rio_t *client_rio, int clientfd, int connfd, char *method, char *host, char *path) {
+void handle_request(rio_t *conn_io, rio_t *client_rio, int clientfd, int connfd, char *method, char *host, char *path, char *key) {
     char buf[MAXLINE];
-    /* request header information is in the <method> <uri> <version> syntax */
-    sprintf(buf, "%s %s %s\r\n", method, path, "HTTP/1.0");
-    Rio_writen(clientfd, buf, strlen(buf));
-
-    /* start writing header */
-    sprintf(buf, "Host: %s\r\n", host);
-    Rio_writen(clientfd, buf, strlen(buf));
-
-    sprintf(buf, "User-Agent: %s\r\n", user_agent_hdr);
-    Rio_writen(clientfd, buf, strlen(buf));
-
-    sprintf(buf, "Connection: close\r\n");
-    Rio_writen(clientfd, buf, strlen(buf));
 
-    sprintf(buf, "Proxy-Connection: close\r\n\r\n");
-    Rio_writen(clientfd, buf, strlen(buf));
+    /* the request line and the headers the proxy always sends */
+    int hdr_len = request_hdrs(buf, MAXLINE, method, host, path);
+    if (hdr_len < 0)
+        return;
+    Rio_writen(clientfd, buf, hdr_len);
 
     /* read request headers from client */
-    Rio_readlineb(conn_io, buf, MAXLINE);
-    while (strcmp(buf, "\r\n")) {
+    while (Rio_readlineb(conn_io, buf, MAXLINE) > 0 && strcmp(buf, "\r\n")) {
         /* `buf` will have a format of header: value, */
         /* and `colon` will point to the colon */
         char *colon = strchr(buf, ':');
@@ -191,42 +249,97 @@ void handle_request(rio_t *conn_io, rio_t *client_rio, int clientfd, int connfd,
         /* forward headers to server */
         if (colon && is_extra_header(buf, colon - buf))
             Rio_writen(clientfd, buf, strlen(buf));
-
-        Rio_readlineb(conn_io, buf, MAXLINE);
     }
 
+    /* the empty line ends the request; the host may answer right away */
+    Rio_writen(clientfd, "\r\n", 2);
+
+    /* the response is collected as it is relayed, and cached if it fits */
+    char *obj = Malloc(MAX_OBJECT_SIZE);
+    size_t obj_size = 0;
     char header_buf[MAXLINE], value_buf[MAXLINE];
-    int content_length = -1;
+    int content_length = -1, status = 0;
+    ssize_t n;
 
     /* read response headers from server */
-    Rio_readlineb(client_rio, buf, MAXLINE);
-    while (strcmp(buf, "\r\n")) {
+    n = Rio_readlineb(client_rio, buf, MAXLINE);
+    sscanf(buf, "%*s %d", &status);
+    while (n > 0 && strcmp(buf, "\r\n")) {
         sscanf(buf, "%[^:]: %s", header_buf, value_buf);
         if (!strcasecmp(header_buf, "Content-Length"))
             content_length = atoi(value_buf);
 
-        Rio_writen(connfd, buf, strlen(buf));
-        Rio_readlineb(client_rio, buf, MAXLINE);
+        relay(connfd, buf, n, obj, &obj_size);
+        n = Rio_readlineb(client_rio, buf, MAXLINE);
     }
-    Rio_writen(connfd, buf, strlen(buf));
-
-    /* there is no content. return. */
-    if (content_length <= 0)
+    if (n <= 0) {
+        free(obj);
         return;
-
-    /* current buffer is big enough */
-    if (content_length <= MAXLINE) {
-        Rio_readnb(client_rio, buf, content_length);
-        Rio_writen(connfd, buf, content_length);
     }
-
-    /* current buffer is not big enough. allocate new buffer on heap */
-    else {
-        void *alloc_buf = malloc(content_length);
-        Rio_readnb(client_rio, alloc_buf, content_length);
-        Rio_writen(connfd, alloc_buf, content_length);
-        free(alloc_buf);
+    relay(connfd, buf, n, obj, &obj_size);
+
+    /* relay the body: Content-Length bytes of it, or up to EOF without one */
+    while (content_length != 0) {
+        size_t want = MAXLINE;
+        if (content_length > 0 && content_length < MAXLINE)
+            want = content_length;
+        if ((n = Rio_readnb(client_rio, buf, want)) <= 0)
+            break;
+
+        relay(connfd, buf, n, obj, &obj_size);
+        if (content_length > 0)
+            content_length -= n;
     }
+
+    /* cache complete, successful responses to GET */
+    if (!strcasecmp(method, "GET") && status == 200 && content_length <= 0 &&
+            obj_size <= MAX_OBJECT_SIZE)
+        cache_insert(key, obj, obj_size);
+    free(obj);
+}
+
+/*
+ * relay - pass `n` bytes of the response in `buf` to the client, and append
+ *   them to the response collected in `obj`. once the response no longer
+ *   fits in MAX_OBJECT_SIZE, `obj_size` is left past it and nothing more is
+ *   collected.
+ */
+void relay(int connfd, char *buf, size_t n, char *obj, size_t *obj_size) {
+    Rio_writen(connfd, buf, n);
+
+    if (*obj_size + n <= MAX_OBJECT_SIZE)
+        memcpy(obj + *obj_size, buf, n);
+    *obj_size += n;
+    if (*obj_size > MAX_OBJECT_SIZE)
+        *obj_size = MAX_OBJECT_SIZE + 1;
+}
+
+/*
+ * read_requesthdrs - read and discard the client's request headers, for
+ *   requests answered without forwarding them
+ */
+void read_requesthdrs(rio_t *rp) {
+    char buf[MAXLINE];
+
+    while (Rio_readlineb(rp, buf, MAXLINE) > 0 && strcmp(buf, "\r\n"))
+        ;
+}
+
+/*
+ * request_hdrs - write the request line for `method` and `path` and the
+ *   headers the proxy always sends, for `host`, into the `size` bytes at
+ *   `buf`, and return their length, or -1 if they don't fit. the client's
+ *   extra headers and the empty line that ends the request go after them.
+ */
+int request_hdrs(char *buf, size_t size, char *method, char *host, char *path) {
+    int n = snprintf(buf, size, "%s %s HTTP/1.0\r\n"
+            "Host: %s\r\n"
+            "%s"
+            "Connection: close\r\n"
+            "Proxy-Connection: close\r\n",
+            method, path, host, user_agent_hdr);
+
+    return n < 0 || (size_t)n >= size ? -1 : n;
 }
 
 /*
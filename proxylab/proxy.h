@@ -0,0 +1,17 @@
+/*
+ * proxy.h - request handling shared by the threaded and event-driven modes
+ */
+#ifndef __PROXY_H__
+#define __PROXY_H__
+
+#include <stddef.h>
+
+/* proxy.c */
+int parse_uri(char *uri, char *host, char *port, char *path);
+int request_hdrs(char *buf, size_t size, char *method, char *host, char *path);
+int is_extra_header(char *str, int length);
+
+/* event.c */
+void run_event_loops(int listenfd, int nloops);
+
+#endif /* __PROXY_H__ */